@@ -0,0 +1,796 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "bytecode.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "token.hpp"
+
+#include "CLI/CLI.hpp"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    size_t samples;
+
+    // How long each sample should run for. Stages which are faster than this
+    // are repeated within a sample, and the time is divided between them.
+    std::chrono::nanoseconds minSampleTime;
+};
+
+struct SuiteInput {
+    // How the input was written in the suite, which is used in the names of
+    // the benchmarks, so that huge inputs have readable names.
+    std::string spec;
+
+    unacpp::BigInt value;
+};
+
+struct SuiteEntry {
+    std::string file;
+
+    std::string expr;
+
+    std::vector<SuiteInput> inputs;
+};
+
+struct Measurement {
+    std::string name;
+
+    std::string stage;
+
+    // The median and median absolute deviation of the time taken for a single
+    // iteration, across all of the samples.
+    double medianNs;
+
+    double madNs;
+
+    size_t iterations;
+
+    double throughput;
+
+    std::string throughputUnit;
+
+    // How much the benchmark raised the peak resident set size of the process.
+    // The peak is shared by every benchmark, so this is only non-zero for one
+    // which used more memory than any that ran before it.
+    long peakRssGrowthKb;
+};
+
+// Values returned from the benchmarked code are added to this, so that the
+// compiler can't optimize the code away.
+volatile size_t benchmarkSink = 0;
+
+long getPeakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+template <typename Func>
+std::chrono::nanoseconds timeIterations(size_t iterations, Func &func) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        benchmarkSink = benchmarkSink + func();
+    }
+    return Clock::now() - start;
+}
+
+double getMedian(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    auto mid = values.size() / 2;
+    if (values.size() % 2 == 0) {
+        return (values[mid - 1] + values[mid]) / 2;
+    }
+    else {
+        return values[mid];
+    }
+}
+
+// Runs a stage of the interpreter, where runBatch runs the stage the given
+// number of times, and returns how long the runs took, excluding any setup.
+template <typename BatchFunc>
+Measurement measure(const BenchOptions &options, BatchFunc runBatch) {
+    auto peakRssBefore = getPeakRssKb();
+
+    // Run once to warm up, and to get an idea of how many iterations are
+    // needed to fill up a sample.
+    auto firstTime = std::max(runBatch(1), std::chrono::nanoseconds{1});
+    size_t iterations = std::max<size_t>(1, options.minSampleTime / firstTime);
+
+    std::vector<double> times;
+    for (size_t i = 0; i < options.samples; i++) {
+        auto elapsed = runBatch(iterations);
+        times.push_back(static_cast<double>(elapsed.count()) / iterations);
+    }
+
+    auto median = getMedian(times);
+    for (auto &time: times) {
+        time = std::abs(time - median);
+    }
+
+    Measurement measurement;
+    measurement.medianNs = median;
+    measurement.madNs = getMedian(std::move(times));
+    measurement.iterations = iterations;
+    measurement.throughput = 0;
+    measurement.peakRssGrowthKb = getPeakRssKb() - peakRssBefore;
+    return measurement;
+}
+
+// Parses an input, which is either a number, or a power, optionally plus or
+// minus a number, such as 2^64+1.
+std::optional<unacpp::BigInt> parseInput(const std::string &spec) {
+    auto isNumber = [] (std::string_view str) {
+        return !str.empty() && std::all_of(str.begin(), str.end(), [] (char c) {
+            return c >= '0' && c <= '9';
+        });
+    };
+
+    auto offsetPos = spec.find_first_of("+-");
+    auto power = spec.substr(0, offsetPos);
+    auto caretPos = power.find('^');
+
+    unacpp::BigInt value;
+    if (caretPos == std::string::npos) {
+        if (!isNumber(power)) {
+            return std::nullopt;
+        }
+        value = unacpp::BigInt{power};
+    }
+    else {
+        auto base = power.substr(0, caretPos);
+        auto exponent = power.substr(caretPos + 1);
+        if (!isNumber(base) || !isNumber(exponent) || exponent.size() > 6) {
+            return std::nullopt;
+        }
+        value = boost::multiprecision::pow(unacpp::BigInt{base}, std::stoul(exponent));
+    }
+
+    if (offsetPos != std::string::npos) {
+        auto offset = spec.substr(offsetPos + 1);
+        if (!isNumber(offset)) {
+            return std::nullopt;
+        }
+        if (spec[offsetPos] == '+') {
+            value += unacpp::BigInt{offset};
+        }
+        else {
+            value -= unacpp::BigInt{offset};
+        }
+    }
+
+    if (value < 0) {
+        return std::nullopt;
+    }
+
+    return value;
+}
+
+std::optional<std::vector<SuiteEntry>> readSuite(const std::string &filename) {
+    std::ifstream file{filename};
+    if (!file.is_open()) {
+        std::cerr << "Unable to open " << filename << '\n';
+        return std::nullopt;
+    }
+
+    std::vector<SuiteEntry> suite;
+    std::string line;
+    for (size_t lineNum = 1; std::getline(file, line); lineNum++) {
+        if (auto commentPos = line.find('#'); commentPos != std::string::npos) {
+            line.erase(commentPos);
+        }
+
+        std::istringstream lineStream{line};
+        SuiteEntry entry;
+        if (!(lineStream >> entry.file)) {
+            continue;
+        }
+
+        if (!(lineStream >> entry.expr)) {
+            std::cerr << filename << ':' << lineNum << ": Expected an expression after the file\n";
+            return std::nullopt;
+        }
+
+        std::string spec;
+        while (lineStream >> spec) {
+            auto value = parseInput(spec);
+            if (value == std::nullopt) {
+                std::cerr << filename << ':' << lineNum << ": Invalid input " << spec << '\n';
+                return std::nullopt;
+            }
+            entry.inputs.push_back({spec, std::move(*value)});
+        }
+
+        suite.push_back(std::move(entry));
+    }
+
+    return suite;
+}
+
+std::optional<std::string> readFile(const std::filesystem::path &path) {
+    std::ifstream file{path};
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+
+    std::stringstream fileStream;
+    fileStream << file.rdbuf();
+    return fileStream.str();
+}
+
+class SuiteRunner {
+private:
+    const BenchOptions &options_;
+
+    std::string filter_;
+
+    std::vector<Measurement> measurements_;
+
+    bool shouldRun(const std::string &name) const {
+        return name.find(filter_) != std::string::npos;
+    }
+
+    void addMeasurement(Measurement measurement, std::string name, std::string stage, double units, std::string unitName) {
+        measurement.name = std::move(name);
+        measurement.stage = std::move(stage);
+        measurement.throughput = units / (measurement.medianNs / 1e9);
+        measurement.throughputUnit = std::move(unitName);
+
+        std::cout << std::left << std::setw(52) << measurement.name << std::right
+                  << std::setw(14) << std::fixed << std::setprecision(0) << measurement.medianNs << " ns"
+                  << " +-" << std::setw(5) << std::setprecision(1)
+                  << (measurement.medianNs > 0 ? 100 * measurement.madNs / measurement.medianNs : 0.0) << '%'
+                  << std::setw(14) << std::setprecision(1) << measurement.throughput << ' '
+                  << measurement.throughputUnit << std::endl;
+
+        measurements_.push_back(std::move(measurement));
+    }
+
+    void runEntry(const SuiteEntry &entry, const std::string &fileContent, bool tokenize) {
+        auto prefix = entry.file + ':' + entry.expr + ':';
+        auto bytes = static_cast<double>(fileContent.size());
+
+        if (tokenize && shouldRun(entry.file + ":tokenize")) {
+            auto tokenizeOnce = [&] {
+                return unacpp::getTokens(fileContent).size();
+            };
+            addMeasurement(
+                measure(options_, [&] (size_t iterations) { return timeIterations(iterations, tokenizeOnce); }),
+                entry.file + ":tokenize", "tokenize", bytes, "bytes/s"
+            );
+        }
+
+        auto tokens = unacpp::getTokens(fileContent);
+        unacpp::Parser parser{tokens, entry.expr, false};
+        auto parseResult = parser.getParseResult();
+        if (auto errors = std::get_if<unacpp::ParseErrors>(&parseResult); errors) {
+            for (auto &error: *errors) {
+                std::cerr << entry.file << ':' << error.pos.line << ':' << error.pos.col
+                          << ": " << error.message << '\n';
+            }
+            return;
+        }
+
+        auto &programs = std::get<unacpp::ProgramMap>(parseResult);
+        auto &programName = parser.getExpressionName();
+
+        if (shouldRun(prefix + "parse")) {
+            // The tokens are copied before timing, so that this only measures
+            // the parser itself.
+            auto parseBatch = [&] (size_t iterations) {
+                std::vector<std::vector<unacpp::Token>> tokenCopies(iterations, tokens);
+                auto start = Clock::now();
+                for (auto &tokenCopy: tokenCopies) {
+                    unacpp::Parser batchParser{std::move(tokenCopy), entry.expr, false};
+                    benchmarkSink = benchmarkSink + batchParser.getParseResult().index();
+                }
+                return Clock::now() - start;
+            };
+            addMeasurement(measure(options_, parseBatch), prefix + "parse", "parse", bytes, "bytes/s");
+        }
+
+        auto optimized = unacpp::optimizePrograms(programs, programName, parser.getConstantPool());
+
+        if (shouldRun(prefix + "optimize")) {
+            auto optimizeOnce = [&] {
+                return unacpp::optimizePrograms(programs, programName, parser.getConstantPool()).getFunctions().size();
+            };
+            addMeasurement(
+                measure(options_, [&] (size_t iterations) { return timeIterations(iterations, optimizeOnce); }),
+                prefix + "optimize", "optimize", static_cast<double>(programs.size()), "functions/s"
+            );
+        }
+
+        auto bytecode = unacpp::generateBytecode(optimized);
+
+        if (shouldRun(prefix + "codegen")) {
+            auto codegenOnce = [&] {
+                return unacpp::generateBytecode(optimized).instructions.size();
+            };
+            addMeasurement(
+                measure(options_, [&] (size_t iterations) { return timeIterations(iterations, codegenOnce); }),
+                prefix + "codegen", "codegen", static_cast<double>(bytecode.instructions.size()), "bytes/s"
+            );
+        }
+
+        unacpp::Interpreter interpreter;
+        for (auto &input: entry.inputs) {
+            auto name = prefix + "execute:" + input.spec;
+            if (!shouldRun(name)) {
+                continue;
+            }
+
+            auto executeOnce = [&] {
+                return interpreter.getResult(bytecode, input.value).has_value() ? size_t{1} : size_t{0};
+            };
+            addMeasurement(
+                measure(options_, [&] (size_t iterations) { return timeIterations(iterations, executeOnce); }),
+                name, "execute", 1, "runs/s"
+            );
+        }
+    }
+
+public:
+    SuiteRunner(const BenchOptions &options, std::string filter)
+        : options_(options)
+        , filter_(std::move(filter))
+    {
+    }
+
+    bool run(const std::vector<SuiteEntry> &suite, const std::filesystem::path &root) {
+        std::vector<std::string> tokenizedFiles;
+
+        for (auto &entry: suite) {
+            auto fileContent = readFile(root / entry.file);
+            if (fileContent == std::nullopt) {
+                std::cerr << "Unable to open " << (root / entry.file).string() << '\n';
+                return false;
+            }
+
+            // Tokenizing doesn't depend on the expression, so it's only
+            // measured once for each file.
+            bool tokenize = std::find(tokenizedFiles.begin(), tokenizedFiles.end(), entry.file) == tokenizedFiles.end();
+            if (tokenize) {
+                tokenizedFiles.push_back(entry.file);
+            }
+
+            runEntry(entry, *fileContent, tokenize);
+        }
+
+        return true;
+    }
+
+    const std::vector<Measurement> &getMeasurements() const {
+        return measurements_;
+    }
+};
+
+std::string escapeJson(std::string_view str) {
+    std::string escaped;
+    for (auto c: str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            std::ostringstream hex;
+            hex << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+            escaped += hex.str();
+        }
+        else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+std::string measurementsToJson(const std::vector<Measurement> &measurements, const BenchOptions &options) {
+    std::ostringstream json;
+    json << std::setprecision(17);
+    json << "{\n";
+    json << "  \"version\": \"" << escapeJson(UNACPP_VERSION) << "\",\n";
+    json << "  \"samples\": " << options.samples << ",\n";
+    json << "  \"min_sample_ns\": " << options.minSampleTime.count() << ",\n";
+    json << "  \"peak_rss_kb\": " << getPeakRssKb() << ",\n";
+    json << "  \"benchmarks\": [";
+
+    for (size_t i = 0; i < measurements.size(); i++) {
+        auto &measurement = measurements[i];
+        json << (i == 0 ? "\n" : ",\n");
+        json << "    {"
+             << "\"name\": \"" << escapeJson(measurement.name) << "\", "
+             << "\"stage\": \"" << escapeJson(measurement.stage) << "\", "
+             << "\"median_ns\": " << measurement.medianNs << ", "
+             << "\"mad_ns\": " << measurement.madNs << ", "
+             << "\"iterations\": " << measurement.iterations << ", "
+             << "\"throughput\": " << measurement.throughput << ", "
+             << "\"throughput_unit\": \"" << escapeJson(measurement.throughputUnit) << "\", "
+             << "\"peak_rss_growth_kb\": " << measurement.peakRssGrowthKb
+             << "}";
+    }
+
+    json << "\n  ]\n}\n";
+    return json.str();
+}
+
+// Just enough of JSON to read back the files written by this program.
+struct JsonValue {
+    using Array = std::vector<JsonValue>;
+
+    using Object = std::vector<std::pair<std::string, JsonValue>>;
+
+    std::variant<std::nullptr_t, bool, double, std::string, Array, Object> value;
+
+    const JsonValue *get(std::string_view key) const {
+        if (auto object = std::get_if<Object>(&value); object) {
+            for (auto &[name, member]: *object) {
+                if (name == key) {
+                    return &member;
+                }
+            }
+        }
+        return nullptr;
+    }
+};
+
+class JsonReader {
+private:
+    std::string_view json_;
+
+    size_t index_;
+
+    void skipWhitespace() {
+        while (index_ < json_.size() && std::isspace(static_cast<unsigned char>(json_[index_]))) {
+            index_++;
+        }
+    }
+
+    bool consume(char c) {
+        skipWhitespace();
+        if (index_ < json_.size() && json_[index_] == c) {
+            index_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool consumeWord(std::string_view word) {
+        if (json_.substr(index_, word.size()) == word) {
+            index_ += word.size();
+            return true;
+        }
+        return false;
+    }
+
+    std::optional<std::string> readString() {
+        if (!consume('"')) {
+            return std::nullopt;
+        }
+
+        std::string str;
+        while (index_ < json_.size() && json_[index_] != '"') {
+            auto c = json_[index_++];
+            if (c != '\\') {
+                str += c;
+                continue;
+            }
+            if (index_ >= json_.size()) {
+                return std::nullopt;
+            }
+            switch (auto escaped = json_[index_++]) {
+                case 'n': str += '\n'; break;
+                case 't': str += '\t'; break;
+                case 'r': str += '\r'; break;
+                case 'b': str += '\b'; break;
+                case 'f': str += '\f'; break;
+                case 'u': {
+                    if (index_ + 4 > json_.size()) {
+                        return std::nullopt;
+                    }
+                    // Only ASCII escapes are ever written, so anything else
+                    // is replaced with a placeholder.
+                    auto code = std::strtoul(std::string{json_.substr(index_, 4)}.c_str(), nullptr, 16);
+                    str += code < 0x80 ? static_cast<char>(code) : '?';
+                    index_ += 4;
+                    break;
+                }
+                default: str += escaped; break;
+            }
+        }
+
+        if (index_ >= json_.size()) {
+            return std::nullopt;
+        }
+        index_++;
+        return str;
+    }
+
+    std::optional<JsonValue> readValue() {
+        skipWhitespace();
+        if (index_ >= json_.size()) {
+            return std::nullopt;
+        }
+
+        auto c = json_[index_];
+        if (c == '{') {
+            index_++;
+            JsonValue::Object object;
+            if (consume('}')) {
+                return JsonValue{std::move(object)};
+            }
+            do {
+                auto key = readString();
+                if (key == std::nullopt || !consume(':')) {
+                    return std::nullopt;
+                }
+                auto member = readValue();
+                if (member == std::nullopt) {
+                    return std::nullopt;
+                }
+                object.emplace_back(std::move(*key), std::move(*member));
+            } while (consume(','));
+            if (!consume('}')) {
+                return std::nullopt;
+            }
+            return JsonValue{std::move(object)};
+        }
+        else if (c == '[') {
+            index_++;
+            JsonValue::Array array;
+            if (consume(']')) {
+                return JsonValue{std::move(array)};
+            }
+            do {
+                auto element = readValue();
+                if (element == std::nullopt) {
+                    return std::nullopt;
+                }
+                array.push_back(std::move(*element));
+            } while (consume(','));
+            if (!consume(']')) {
+                return std::nullopt;
+            }
+            return JsonValue{std::move(array)};
+        }
+        else if (c == '"') {
+            auto str = readString();
+            if (str == std::nullopt) {
+                return std::nullopt;
+            }
+            return JsonValue{std::move(*str)};
+        }
+        else if (consumeWord("true")) {
+            return JsonValue{true};
+        }
+        else if (consumeWord("false")) {
+            return JsonValue{false};
+        }
+        else if (consumeWord("null")) {
+            return JsonValue{nullptr};
+        }
+        else {
+            std::string rest{json_.substr(index_, 64)};
+            char *end;
+            auto number = std::strtod(rest.c_str(), &end);
+            if (end == rest.c_str()) {
+                return std::nullopt;
+            }
+            index_ += end - rest.c_str();
+            return JsonValue{number};
+        }
+    }
+
+public:
+    JsonReader(std::string_view json)
+        : json_(json)
+        , index_(0)
+    {
+    }
+
+    std::optional<JsonValue> read() {
+        auto value = readValue();
+        skipWhitespace();
+        if (index_ != json_.size()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+};
+
+std::optional<std::vector<Measurement>> readBaseline(const std::string &filename) {
+    auto content = readFile(filename);
+    if (content == std::nullopt) {
+        std::cerr << "Unable to open " << filename << '\n';
+        return std::nullopt;
+    }
+
+    auto json = JsonReader{*content}.read();
+    const JsonValue *benchmarks = json ? json->get("benchmarks") : nullptr;
+    if (benchmarks == nullptr || !std::holds_alternative<JsonValue::Array>(benchmarks->value)) {
+        std::cerr << filename << " is not a benchmark result file\n";
+        return std::nullopt;
+    }
+
+    std::vector<Measurement> measurements;
+    for (auto &benchmark: std::get<JsonValue::Array>(benchmarks->value)) {
+        auto name = benchmark.get("name");
+        auto median = benchmark.get("median_ns");
+        auto mad = benchmark.get("mad_ns");
+        if (name == nullptr || median == nullptr || mad == nullptr
+            || !std::holds_alternative<std::string>(name->value)
+            || !std::holds_alternative<double>(median->value)
+            || !std::holds_alternative<double>(mad->value))
+        {
+            std::cerr << filename << " has a benchmark without a name, median_ns or mad_ns\n";
+            return std::nullopt;
+        }
+
+        Measurement measurement{};
+        measurement.name = std::get<std::string>(name->value);
+        measurement.medianNs = std::get<double>(median->value);
+        measurement.madNs = std::get<double>(mad->value);
+        measurements.push_back(std::move(measurement));
+    }
+
+    return measurements;
+}
+
+// Compares the results against the baseline, returning whether none of the
+// benchmarks got slower. A difference is only counted when it's larger than
+// the relative threshold, and also larger than the noise of both runs, taken
+// as a few times their median absolute deviations, so that noisy benchmarks
+// need a bigger change before they're reported.
+bool compareToBaseline(
+    const std::vector<Measurement> &baseline,
+    const std::vector<Measurement> &current,
+    const std::string &filter,
+    double threshold)
+{
+    constexpr double noiseFactor = 3.0;
+
+    size_t slower = 0;
+    size_t faster = 0;
+
+    std::cout << "\nCompared to the baseline:\n";
+    for (auto &measurement: current) {
+        auto base = std::find_if(baseline.begin(), baseline.end(), [&] (const Measurement &other) {
+            return other.name == measurement.name;
+        });
+        if (base == baseline.end()) {
+            std::cout << std::left << std::setw(52) << measurement.name << " new\n";
+            continue;
+        }
+
+        auto diff = measurement.medianNs - base->medianNs;
+        auto noise = noiseFactor * (measurement.madNs + base->madNs);
+        auto change = base->medianNs > 0 ? diff / base->medianNs : 0.0;
+
+        std::string verdict = "same";
+        if (std::abs(diff) > noise && std::abs(change) > threshold) {
+            verdict = diff > 0 ? "SLOWER" : "faster";
+            (diff > 0 ? slower : faster)++;
+        }
+
+        std::cout << std::left << std::setw(52) << measurement.name << std::right
+                  << std::showpos << std::setw(9) << std::fixed << std::setprecision(1) << 100 * change << '%'
+                  << std::noshowpos << "  " << verdict << '\n';
+    }
+
+    for (auto &base: baseline) {
+        if (base.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        auto found = std::any_of(current.begin(), current.end(), [&] (const Measurement &measurement) {
+            return measurement.name == base.name;
+        });
+        if (!found) {
+            std::cout << std::left << std::setw(52) << base.name << " missing\n";
+        }
+    }
+
+    std::cout << slower << " slower, " << faster << " faster\n";
+    return slower == 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    std::string suiteFile;
+    std::string root = ".";
+    std::string outputFile;
+    std::string baselineFile;
+    std::string filter;
+    size_t samples = 7;
+    double minSampleMs = 20;
+    double thresholdPercent = 5;
+
+    CLI::App app{"Benchmarks each stage of the Unarian interpreter"};
+
+    app.add_option("suite", suiteFile, "The file listing the programs, expressions and inputs to benchmark.")
+       ->required()
+       ->check(CLI::ExistingFile);
+
+    app.add_option("--root", root, "The directory the files in the suite are relative to.");
+
+    app.add_option("-o,--output", outputFile, "Writes the results as JSON to the given file.");
+
+    app.add_option("--baseline", baselineFile, "Compares the results against a JSON file written by an earlier run.")
+       ->check(CLI::ExistingFile);
+
+    app.add_option("--filter", filter, "Only runs the benchmarks whose names contain the given string.");
+
+    app.add_option("--samples", samples, "How many times each benchmark is measured.")
+       ->check(CLI::Range(1, 1000));
+
+    app.add_option("--min-time", minSampleMs, "The minimum time for each sample, in milliseconds.")
+       ->check(CLI::Range(0.0, 60000.0));
+
+    app.add_option("--threshold", thresholdPercent, "How many percent slower than the baseline a benchmark must be to count as a regression.")
+       ->check(CLI::Range(0.0, 1000.0));
+
+    CLI11_PARSE(app, argc, argv);
+
+    auto suite = readSuite(suiteFile);
+    if (suite == std::nullopt) {
+        return 1;
+    }
+
+    std::optional<std::vector<Measurement>> baseline;
+    if (!baselineFile.empty()) {
+        baseline = readBaseline(baselineFile);
+        if (baseline == std::nullopt) {
+            return 1;
+        }
+    }
+
+    BenchOptions options{
+        samples,
+        std::chrono::nanoseconds{static_cast<int64_t>(minSampleMs * 1e6)},
+    };
+
+    SuiteRunner runner{options, filter};
+    if (!runner.run(*suite, root)) {
+        return 1;
+    }
+
+    std::cout << "Peak RSS: " << getPeakRssKb() << " KiB\n";
+
+    if (!outputFile.empty()) {
+        std::ofstream output{outputFile};
+        if (!output.is_open()) {
+            std::cerr << "Unable to open " << outputFile << '\n';
+            return 1;
+        }
+        output << measurementsToJson(runner.getMeasurements(), options);
+    }
+
+    if (baseline && !compareToBaseline(*baseline, runner.getMeasurements(), filter, thresholdPercent / 100)) {
+        return 3;
+    }
+}
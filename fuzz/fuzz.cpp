@@ -0,0 +1,272 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "bytecode.hpp"
+#include "evaluator.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+
+#include "CLI/CLI.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The most instructions and nested calls the reference evaluator runs for a
+// single input. Inputs which need more than this are skipped.
+constexpr uint64_t maxReferenceSteps = 200'000;
+
+constexpr size_t maxReferenceDepth = 5'000;
+
+// Generates random Unarian programs which always terminate. Each function
+// only calls functions defined before it, except that a function may call
+// itself after first subtracting from its input, so the recursion always
+// reaches a branch that doesn't recurse. Many of the functions follow the
+// shapes the optimizer recognizes, like multiplication and division, along
+// with slight variations of them, since those are where the optimizer is
+// most likely to be wrong.
+class ProgramGenerator {
+private:
+    std::mt19937_64 rng_;
+
+    // The functions the function being generated can call.
+    std::vector<std::string> callable_;
+
+    size_t uniform(size_t count) {
+        return static_cast<size_t>(rng_() % count);
+    }
+
+    bool chance(size_t percent) {
+        return uniform(100) < percent;
+    }
+
+    std::string repeat(std::string_view inst, size_t count) {
+        std::string insts;
+        for (size_t i = 0; i < count; i++) {
+            insts += ' ';
+            insts += inst;
+        }
+        return insts;
+    }
+
+    std::string generateBody(size_t depth) {
+        std::string body;
+        auto length = uniform(6);
+
+        for (size_t i = 0; i < length; i++) {
+            auto choice = uniform(10);
+            if (choice < 3) {
+                body += repeat("+", 1 + uniform(3));
+            }
+            else if (choice < 6) {
+                body += repeat("-", 1 + uniform(3));
+            }
+            else if (choice < 9 || depth > 0) {
+                body += ' ' + callable_[uniform(callable_.size())];
+            }
+            else {
+                body += " {" + generateBody(depth + 1) + " |" + generateBody(depth + 1) + " }";
+            }
+        }
+
+        return body;
+    }
+
+    std::string generateBranches(size_t count) {
+        std::string branches;
+        for (size_t i = 0; i < count; i++) {
+            branches += (i == 0 ? "" : " |") + generateBody(0);
+        }
+        return branches;
+    }
+
+    // Returns the body of a function that the optimizer may recognize.
+    std::string generateIdiom(const std::string &name) {
+        auto amount = 1 + uniform(4);
+        auto failBranch = chance(50) ? " 0" : " if=0";
+
+        switch (uniform(5)) {
+            case 0:
+                // Multiplication, or sometimes not quite.
+                return repeat("-", chance(80) ? 1 : amount) + ' ' + name + repeat("+", uniform(5)) + " |";
+
+            case 1:
+                // Division, rounding down or failing on a remainder.
+                return repeat("-", amount) + ' ' + name + repeat("+", chance(80) ? 1 : amount) + " |" + failBranch;
+
+            case 2:
+                // Checking the input modulo some number.
+                return repeat("-", amount) + ' ' + name + repeat("+", chance(80) ? amount : 1) + " |" + failBranch;
+
+            case 3:
+                // Powers, which call the function before this one.
+                return " - " + name + ' ' + callable_.back() + " |" + repeat("+", uniform(2));
+
+            default:
+                // Any other function that recurses on a smaller input.
+                return repeat("-", amount) + ' ' + name + generateBody(0) + " |" + generateBranches(1 + uniform(2));
+        }
+    }
+
+public:
+    explicit ProgramGenerator(uint64_t seed)
+        : rng_(seed)
+    {
+    }
+
+    // Returns the source of the program. The expression to evaluate is always
+    // called main.
+    std::string generate() {
+        std::ostringstream source;
+        source << "0 { - 0 | }\n";
+        source << "if=0 { { - 0 | + } - }\n";
+        callable_ = {"0", "if=0"};
+
+        auto functionCount = 1 + uniform(6);
+        for (size_t i = 0; i < functionCount; i++) {
+            auto name = 'f' + std::to_string(i);
+            if (chance(60)) {
+                source << name << " {" << generateIdiom(name) << " }\n";
+            }
+            else {
+                source << name << " {" << generateBranches(1 + uniform(3)) << " }\n";
+            }
+            callable_.push_back(name);
+        }
+
+        source << "main {" << generateBranches(1 + uniform(2)) << " }\n";
+        return source.str();
+    }
+};
+
+std::string resultToString(const std::optional<unacpp::BigInt> &result) {
+    if (result == std::nullopt) {
+        return "-";
+    }
+    else {
+        return result->str();
+    }
+}
+
+struct FuzzCase {
+    std::string name;
+
+    unacpp::OptimizerOptions options;
+};
+
+// Checks every optimization level against the reference evaluator, along with
+// some random combination of passes, returning false on any difference.
+bool checkProgram(uint64_t seed, size_t inputCount, bool verbose) {
+    ProgramGenerator generator{seed};
+    auto source = generator.generate();
+    if (verbose) {
+        std::cout << "Seed " << seed << ":\n" << source;
+    }
+
+    unacpp::Parser parser{source, "main", false};
+    auto parseResult = parser.getParseResult();
+    if (auto errors = std::get_if<unacpp::ParseErrors>(&parseResult); errors) {
+        std::cerr << "Seed " << seed << " generated a program that doesn't parse:\n" << source;
+        for (auto &error: *errors) {
+            std::cerr << "On line " << error.pos.line << ", column " << error.pos.col
+                      << ": " << error.message << '\n';
+        }
+        return false;
+    }
+
+    auto &programs = std::get<unacpp::ProgramMap>(parseResult);
+    auto &programName = parser.getExpressionName();
+
+    std::vector<FuzzCase> cases;
+    for (unsigned level = 0; level <= unacpp::maxOptimizationLevel; level++) {
+        cases.push_back({"-O" + std::to_string(level), unacpp::OptimizerOptions::forLevel(level)});
+    }
+
+    std::mt19937_64 passRng{seed};
+    unacpp::OptimizerOptions randomOptions;
+    for (auto pass: unacpp::optimizerPassNames) {
+        randomOptions.setPass(pass, passRng() % 2 == 0);
+    }
+    cases.push_back({"passes " + randomOptions.toString(), randomOptions});
+
+    std::vector<unacpp::BytecodeModule> modules;
+    for (auto &fuzzCase: cases) {
+        auto optimized = unacpp::optimizePrograms(programs, programName, parser.getConstantPool(), fuzzCase.options);
+        modules.push_back(unacpp::generateBytecode(optimized));
+    }
+
+    std::vector<unacpp::BigInt> inputs;
+    for (size_t i = 0; i < inputCount; i++) {
+        inputs.emplace_back(i);
+    }
+    for (size_t i = 0; i < inputCount / 4; i++) {
+        inputs.emplace_back(passRng() % 1000);
+    }
+
+    unacpp::ReferenceEvaluator evaluator{programs, maxReferenceSteps, maxReferenceDepth};
+    unacpp::Interpreter interpreter;
+
+    for (auto &input: inputs) {
+        auto expected = evaluator.evaluate(programName, input);
+        if (std::holds_alternative<unacpp::LimitExceeded>(expected)) {
+            continue;
+        }
+        auto &expectedResult = std::get<std::optional<unacpp::BigInt>>(expected);
+
+        for (size_t i = 0; i < cases.size(); i++) {
+            auto actual = interpreter.getResult(modules[i], input);
+            if (actual != expectedResult) {
+                std::cerr << "Mismatch with seed " << seed << " at " << cases[i].name << '\n'
+                          << source
+                          << "Input: " << input << '\n'
+                          << "Expected: " << resultToString(expectedResult) << '\n'
+                          << "Received: " << resultToString(actual) << '\n'
+                          << "Bytecode:\n" << unacpp::bytecodeToString(modules[i]);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    size_t iterations = 1000;
+    size_t inputCount = 16;
+    bool verbose = false;
+
+    CLI::App app{"Checks the optimizer and interpreter against a reference evaluator on random programs"};
+
+    app.add_option("--seed", seed, "The seed of the first program. Each later program uses the next seed.");
+
+    app.add_option("-n,--iterations", iterations, "How many programs to generate.");
+
+    app.add_option("--inputs", inputCount, "How many inputs to check each program with.")
+       ->check(CLI::Range(1, 100000));
+
+    app.add_flag("-v,--verbose", verbose, "Prints each program before checking it.");
+
+    CLI11_PARSE(app, argc, argv);
+
+    for (size_t i = 0; i < iterations; i++) {
+        if (!checkProgram(seed + i, inputCount, verbose)) {
+            return 1;
+        }
+    }
+
+    std::cout << "Checked " << iterations << " programs\n";
+}
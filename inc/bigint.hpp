@@ -10,8 +10,56 @@
 
 #include <boost/multiprecision/cpp_int.hpp>
 
+#include <cstddef>
+
 namespace unacpp {
 
 using BigInt = boost::multiprecision::cpp_int;
 
+// A single limb of a BigInt. Operations between a BigInt and a limb work on
+// the limbs of the number in place, so they never need to allocate, unless
+// the number grows past the memory it already has.
+using Limb = boost::multiprecision::limb_type;
+
+// Returns the bytes taken by the limbs of the number.
+inline size_t getLimbBytes(const BigInt &num) {
+    return num.backend().size() * sizeof(Limb);
+}
+
+void addWord(BigInt &num, Limb word);
+
+// Subtracts the word from the number, returning false and leaving the number
+// unchanged if that would make it negative.
+bool subtractWord(BigInt &num, Limb word);
+
+void multiplyWord(BigInt &num, Limb word);
+
+// Returns whether the number modulo 2 to the power of the given number of
+// bits equals the value. Only the limbs holding those bits are looked at.
+bool lowBitsEqual(const BigInt &num, uint64_t bits, Limb value);
+
+// A nonzero divisor which fits in a single limb, along with its reciprocal,
+// so that dividing by it takes a couple of multiplications per limb instead
+// of a hardware division. This is the method from "Improved division by
+// invariant integers" by Möller and Granlund.
+struct WordDivisor {
+    // The divisor shifted left until its top bit is set.
+    Limb normalized;
+
+    // floor((B^2 - 1) / normalized) - B, where B is 2 to the number of bits
+    // in a limb.
+    Limb reciprocal;
+
+    // How far the divisor was shifted.
+    unsigned shift;
+};
+
+WordDivisor makeWordDivisor(Limb divisor);
+
+// Divides the number by the word in place, returning the remainder.
+Limb divideWord(BigInt &num, const WordDivisor &divisor);
+
+// Returns the number modulo the word, without computing the quotient.
+Limb remainderWord(const BigInt &num, const WordDivisor &divisor);
+
 } // namespace unacpp
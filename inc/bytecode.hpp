@@ -8,37 +8,77 @@
 
 #pragma once
 
+#include "ir.hpp"
+#include "position.hpp"
 #include "program.hpp"
 
 #include <cstdint>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace unacpp {
 
 // Defines the instructions used by the VM. These opcodes can be followed by
-// arguments which are either 4-byte instruction addresses, or 2-byte indexes
-// into an array of constants.
+// arguments which are either 4-byte instruction addresses, 2-byte indexes
+// into an array of constants, or 8-byte immediates. MULT_ADD and the opcodes
+// ending in FAIL_JMP are superinstructions, which fuse the most frequently
+// executed pairs of opcodes so that they're executed in a single dispatch.
+// The opcodes ending in IMM are the same as the opcodes without it, but take
+// their constants as immediates, for constants which fit in a single limb,
+// which lets them work on the limbs of the value directly. The division
+// opcodes have no IMM variants, since their divisors are looked up alongside
+// the reciprocals precomputed for each constant.
 enum OpCode: uint8_t {
     // ADD [constant]
     // Adds the constant to the current value.
     Add,
 
+    // ADD_IMM [immediate]
+    AddImmediate,
+
     // CALL [address]
     // Pushes the address of the next instruction and the current value onto the
     // stack, then continues execution from the given address.
     Call,
 
+    // CALL_FAIL_JMP [address] [address]
+    // The same as CALL followed by FAIL_JMP. Calls the function at the first
+    // address, and if it returns in a failed state, then the value is restored
+    // and execution continues from the second address.
+    CallJumpOnFailure,
+
+    // CALL_NOSAVE [address]
+    // The same as CALL, but only pushes the address of the next instruction,
+    // for calling functions which never restore the value they were called
+    // with.
+    CallNoSave,
+
+    // CALL_NOSAVE_FAIL_JMP [address] [address]
+    // The same as CALL_FAIL_JMP, but only pushes the address of the next
+    // instruction, like CALL_NOSAVE.
+    CallNoSaveJumpOnFailure,
+
     // DEC
     // Subtracts 1 from the current value, and enter a failed state if that
     // causes the value to be negative.
     Dec,
 
+    // DEC_FAIL_JMP [address]
+    // The same as DEC followed by FAIL_JMP.
+    DecJumpOnFailure,
+
     // DIV_FAIL [constant]
     // Divides the current value by the constant. If it does not divide evenly,
     // then the program enters a failed state.
     DivFail,
 
+    // DIV_FAIL_FAIL_JMP [constant] [address]
+    // The same as DIV_FAIL followed by FAIL_JMP.
+    DivFailJumpOnFailure,
+
     // DIV_FLOOR [constant]
     // Divides the current value by the constant, discarding the fractional part
     // if it doesn't divide evenly.
@@ -49,6 +89,16 @@ enum OpCode: uint8_t {
     // enter a failed state.
     Equal,
 
+    // EQ_FAIL_JMP [constant] [address]
+    // The same as EQ followed by FAIL_JMP.
+    EqualJumpOnFailure,
+
+    // EQ_IMM [immediate]
+    EqualImmediate,
+
+    // EQ_IMM_FAIL_JMP [immediate] [address]
+    EqualImmediateJumpOnFailure,
+
     // INC
     // Adds 1 to the current value.
     Inc,
@@ -57,6 +107,8 @@ enum OpCode: uint8_t {
     // If the program is in a failed state, then the failed state is cleared,
     // the value is restored to what it was when the function was first called,
     // and execution continues from the address. Otherwise, it does nothing.
+    // The value is moved out of the stack frame when it's restored, so a
+    // branch which may need to restore it again must start with SAVE.
     JumpOnFailure,
 
     // MOD_EQ [constant] [constant]
@@ -64,10 +116,25 @@ enum OpCode: uint8_t {
     // constant, then the program enters a failed state.
     ModEqual,
 
+    // MOD_EQ_FAIL_JMP [constant] [constant] [address]
+    // The same as MOD_EQ followed by FAIL_JMP.
+    ModEqualJumpOnFailure,
+
     // MULT [constant]
     // Multiplies the current value by the constant.
     Mult,
 
+    // MULT_IMM [immediate]
+    MultImmediate,
+
+    // MULT_ADD [constant] [constant]
+    // Multiplies the current value by the first constant, then adds the second
+    // constant to it.
+    MultAdd,
+
+    // MULT_ADD_IMM [immediate] [immediate]
+    MultAddImmediate,
+
     // NOT
     // If the current value is zero, change the current value to one. Otherwise,
     // the current value is changed to zero.
@@ -77,6 +144,11 @@ enum OpCode: uint8_t {
     // Prints the current value.
     Print,
 
+    // PRINT_STACK
+    // Prints a stack trace, with the function and branch of each frame on the
+    // stack.
+    PrintStack,
+
     // RET
     // Returns execution to the calling function.
     Ret,
@@ -86,28 +158,235 @@ enum OpCode: uint8_t {
     // calling function, retaining the failed state.
     RetOnFailure,
 
+    // SAVE
+    // Saves the current value in the stack frame, as the value to restore if
+    // the branch fails.
+    Save,
+
+    // SHL [immediate]
+    // Shifts the current value left by the immediate, for multiplying by a
+    // power of two.
+    ShiftLeft,
+
+    // SHR_EXACT [immediate]
+    // Shifts the current value right by the immediate, for dividing by a power
+    // of two. If any of the bits shifted out are set, then the program enters
+    // a failed state.
+    ShiftRightExact,
+
+    // SHR_EXACT_FAIL_JMP [immediate] [address]
+    // The same as SHR_EXACT followed by FAIL_JMP.
+    ShiftRightExactJumpOnFailure,
+
+    // SHR_FLOOR [immediate]
+    // Shifts the current value right by the immediate, discarding the bits
+    // shifted out.
+    ShiftRightFloor,
+
+    // SPEC_CALL [address] [address]
+    // Calls a function which was split in two for speculation, like
+    // CALL_NOSAVE with the first address, which holds its first branch. The
+    // rest of its branches, at the second address, may be started with the
+    // current value on another thread first.
+    SpeculativeCall,
+
+    // SPEC_JOIN
+    // Follows SPEC_CALL. If the first branch succeeded, any evaluation of the
+    // rest is cancelled. Otherwise, the result of the rest is waited for, or
+    // if it wasn't started, they're called with the value SPEC_CALL was run
+    // with.
+    SpeculativeJoin,
+
     // SUB [constant]
     // Subtracts the constant to the current value, and enter a failed state if
     // that causes the value to be negative.
     Sub,
 
+    // SUB_FAIL_JMP [constant] [address]
+    // The same as SUB followed by FAIL_JMP.
+    SubJumpOnFailure,
+
+    // SUB_IMM [immediate]
+    SubImmediate,
+
+    // SUB_IMM_FAIL_JMP [immediate] [address]
+    SubImmediateJumpOnFailure,
+
     // TAIL_CALL [address]
     // Replaces the value on top of the stack with the current value, but does
     // not otherwise increase the stack size. Continues execution from the
     // address.
     TailCall,
+
+    // TAIL_CALL_NOSAVE [address]
+    // Continues execution from the address, for tail calling functions which
+    // never restore the value they were called with.
+    TailCallNoSave,
+
+    // TEST_LOW_BITS [immediate] [immediate]
+    // The same as MOD_EQ, for a modulo which is a power of two. If the value
+    // modulo two to the power of the second immediate isn't equal to the
+    // first immediate, then the program enters a failed state. Only the limbs
+    // holding those low bits are looked at.
+    TestLowBits,
+
+    // TEST_LOW_BITS_FAIL_JMP [immediate] [immediate] [address]
+    // The same as TEST_LOW_BITS followed by FAIL_JMP.
+    TestLowBitsJumpOnFailure,
+};
+
+// The version of the serialized bytecode format. This must be bumped whenever
+// the opcodes or the layout of a serialized module changes, so that stale
+// cached modules are never loaded.
+constexpr uint32_t bytecodeFormatVersion = 10;
+
+// Records where the code for a function was placed, so that addresses in the
+// bytecode can be mapped back to the program they came from.
+struct FunctionInfo {
+    // The name of the program. Anonymous programs have the names given to
+    // them by the parser, which end in a space.
+    std::string name;
+
+    // Where the program was defined in the source.
+    FilePosition pos;
+
+    // The address of the first instruction of each branch of the function,
+    // the first of which is the start of the function.
+    std::vector<uint32_t> branchStarts;
 };
 
+// Records where a call in the bytecode was made in the source, so that the
+// frames on the stack can be mapped back to the calls which pushed them.
+struct CallSite {
+    // The address of the instruction after the call, which is where the frame
+    // pushed by the call returns to.
+    uint32_t returnAddress;
+
+    // Where the call was made in the source.
+    FilePosition pos;
+};
+
+// A number which is different for every module, including copies of the same
+// module, so that anything holding on to pointers into a module, like the
+// traces the interpreter records, can tell when it's given a different one.
+class ModuleId {
+private:
+    uint64_t id_;
+
+    static uint64_t next();
+
+public:
+    ModuleId();
+
+    ModuleId(const ModuleId &);
+
+    ModuleId &operator=(const ModuleId &);
+
+    uint64_t get() const;
+};
+
+// Modules must not be changed once they've been evaluated, since interpreters
+// keep what they've learned about a module's loops for as long as it keeps
+// the same id.
 struct BytecodeModule {
     // The instructions for the program
     std::vector<uint8_t> instructions;
 
     // The list of all the constants used by the program
     std::vector<BigInt> constants;
+
+    // The reciprocal of each constant which is a nonzero single limb, for the
+    // division opcodes, or std::nullopt for the other constants. These aren't
+    // serialized, but are worked out whenever a module is generated or loaded.
+    std::vector<std::optional<WordDivisor>> divisors;
+
+    // The functions in the program, ordered by their start address
+    std::vector<FunctionInfo> functions;
+
+    // The address of the function for each expression the module was compiled
+    // from, the first of which is always 0.
+    std::vector<uint32_t> entryPoints;
+
+    // Where each call which pushes a frame was made, ordered by return
+    // address. This is only looked at to print stack traces, never while
+    // the bytecode is running.
+    std::vector<CallSite> callSites;
+
+    ModuleId id;
 };
 
-BytecodeModule generateBytecode(const ProgramMap &program, const std::string &mainName);
+// Generates a module with an entry point for each of the module's entry
+// points, in the same order. The functions are placed in the same order as
+// in the module, and the blocks of each function in the order they're stored.
+// The functions are generated on up to the given number of threads, or one for
+// each hardware thread if it's zero.
+BytecodeModule generateBytecode(const IrModule &module, size_t threadCount = 0);
+
+// Generates the module's functions on the given threads, such as the ones it
+// was optimized with.
+BytecodeModule generateBytecode(const IrModule &module, ParallelThreads &threads);
+
+// A call to an external function, whose address is filled in once the module
+// is linked with the library defining it.
+struct Relocation {
+    // Where the address of the function goes in the instructions.
+    uint32_t byteIndex;
+
+    std::string funcName;
+};
+
+// Generates a module which may call external functions, adding a relocation
+// for each of the calls to them.
+BytecodeModule generateBytecode(const IrModule &module, std::vector<Relocation> &relocations, ParallelThreads &threads);
+
+// Works out what calls to one of the module's functions need to know about it,
+// for libraries which export the function.
+CallSummary summarizeCall(const IrModule &module, const std::string &funcName);
+
+// Adds the functions of another module after the functions of this one, moving
+// its addresses and constants to match. Returns the address the other module's
+// code now starts at, or std::nullopt if there would be too many constants.
+// The other module's entry points aren't added.
+std::optional<uint32_t> appendBytecode(BytecodeModule &module, const BytecodeModule &other);
+
+// Fills in the address of the function for a relocation from a module which
+// was appended at the given offset.
+void resolveRelocation(BytecodeModule &module, uint32_t offset, const Relocation &relocation, uint32_t address);
+
+// Returns the name of the opcode as it appears in the output of
+// bytecodeToString, or "ERROR" if the value isn't a valid opcode.
+std::string_view opcodeName(OpCode opcode);
 
 std::string bytecodeToString(const BytecodeModule &bytecode);
 
+// Returns the index in the function table of the function containing the
+// instruction at the given address.
+size_t getFunctionIndex(const BytecodeModule &bytecode, uint32_t address);
+
+// Returns the index of the branch of the function containing the instruction
+// at the given address.
+size_t getBranchIndex(const FunctionInfo &function, uint32_t address);
+
+// Returns the name of the function to show to users, which is <expression>
+// for the expression the module was compiled from, and <anonymous> for
+// anonymous programs. Specialized copies are shown as the name of the function
+// they were copied from, followed by @ and the value.
+std::string getDisplayName(const BytecodeModule &bytecode, size_t function);
+
+// Returns the call which returns to the given address, or nullptr if the
+// address isn't right after a call.
+const CallSite *findCallSite(const BytecodeModule &bytecode, uint32_t returnAddress);
+
+// Returns whether the module is safe to interpret, meaning that its opcodes
+// are valid, their arguments are in range, and its functions and entry points
+// line up with its instructions.
+bool verifyBytecode(const BytecodeModule &bytecode);
+
+std::vector<uint8_t> serializeBytecode(const BytecodeModule &bytecode);
+
+// Reads back a module written by serializeBytecode. Returns std::nullopt if
+// the data is truncated, was written by a different format version, or
+// contains instructions referring to out of range constants or addresses.
+std::optional<BytecodeModule> deserializeBytecode(std::span<const uint8_t> data);
+
 } // namespace unacpp
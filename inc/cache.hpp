@@ -0,0 +1,61 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bytecode.hpp"
+#include "optimizer.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace unacpp {
+
+// An on-disk cache of optimized bytecode modules, keyed by a hash of
+// everything that affects the generated bytecode. Failures to read or write
+// the cache are never fatal, they only cause the module to be compiled again.
+class BytecodeCache {
+private:
+    std::filesystem::path directory_;
+
+    uintmax_t maxSize_;
+
+    std::filesystem::path getEntryPath(const std::string &key) const;
+
+    void removeOldEntries() const;
+
+public:
+    // The default limit on the total size of all the cached modules.
+    static constexpr uintmax_t defaultMaxSize = 64 * 1024 * 1024;
+
+    BytecodeCache(std::filesystem::path directory, uintmax_t maxSize = defaultMaxSize);
+
+    // Returns $XDG_CACHE_HOME/unarian, falling back to ~/.cache/unarian, or
+    // std::nullopt if neither environment variable is set.
+    static std::optional<std::filesystem::path> getDefaultDirectory();
+
+    // Returns the key for the module compiled from the file and expressions,
+    // and linked with the libraries whose object files are given.
+    static std::string getKey(
+        std::string_view fileContent,
+        std::span<const std::string> exprs,
+        bool debugMode,
+        const OptimizerOptions &options,
+        std::span<const std::vector<uint8_t>> libraries = {});
+
+    std::optional<BytecodeModule> load(const std::string &key) const;
+
+    void store(const std::string &key, const BytecodeModule &bytecode) const;
+};
+
+} // namespace unacpp
@@ -0,0 +1,42 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bytecode.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <variant>
+
+namespace unacpp {
+
+using CompileBytecodeResult = std::variant<BytecodeModule, ParseErrors>;
+
+// Runs the whole pipeline of parsing the file, optimizing the programs and
+// generating the bytecode for the expression.
+CompileBytecodeResult compileBytecode(
+    std::string_view fileContent,
+    std::string_view expr,
+    bool debugMode,
+    const OptimizerOptions &options = {});
+
+// Compiles a module with an entry point for each of the expressions, which
+// share the code for any functions they have in common. If there are stats,
+// the time taken by each step of the pipeline is recorded in them.
+CompileBytecodeResult compileBytecode(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    bool debugMode,
+    const OptimizerOptions &options = {},
+    CompileStats *stats = nullptr);
+
+} // namespace unacpp
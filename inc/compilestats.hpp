@@ -0,0 +1,108 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace unacpp {
+
+struct BytecodeModule;
+
+// Statistics about compiling a program: how long each stage of the compiler
+// took, and what each run of an optimizer pass did to the module, for telling
+// whether a slow program is held up by its frontend or missed by the
+// optimizer. Nothing is collected unless one of these is given to the
+// compiler.
+class CompileStats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // A stage of the compiler other than the optimizer passes.
+    struct Phase {
+        std::string name;
+
+        Clock::duration time;
+    };
+
+    // One run of an optimizer pass.
+    struct PassRun {
+        std::string name;
+
+        // The round of inlining the pass ran in, starting from 1. The passes
+        // run after each round of inlining, until nothing more is inlined.
+        size_t round;
+
+        Clock::duration time;
+
+        size_t functionsBefore;
+
+        size_t functionsAfter;
+
+        size_t instructionsBefore;
+
+        size_t instructionsAfter;
+
+        // How many of the functions left afterwards were rewritten by the
+        // pass, which for the passes recognizing a pattern is how many times
+        // the pattern was found.
+        size_t functionsChanged;
+    };
+
+private:
+    std::vector<Phase> phases_;
+
+    std::vector<PassRun> passes_;
+
+    size_t bytecodeSize_ = 0;
+
+    size_t constantCount_ = 0;
+
+    size_t functionCount_ = 0;
+
+public:
+    void addPhase(std::string_view name, Clock::duration time);
+
+    void addPass(PassRun run);
+
+    // Records the size of the bytecode the program was compiled to.
+    void setBytecode(const BytecodeModule &bytecode);
+
+    const std::vector<Phase> &getPhases() const;
+
+    const std::vector<PassRun> &getPasses() const;
+
+    // Returns tables of the phases, the pass runs and the totals for each
+    // pass, followed by the size of the bytecode.
+    std::string getReport() const;
+
+    // Returns the same statistics as a JSON object, with times in
+    // milliseconds.
+    std::string getJson() const;
+};
+
+// Runs the function, adding the time it took to the stats as a phase with the
+// given name if there are any stats, and returns its result.
+template <typename Function>
+auto timePhase(CompileStats *stats, std::string_view name, Function &&function) {
+    if (stats == nullptr) {
+        return function();
+    }
+
+    auto start = CompileStats::Clock::now();
+    auto result = function();
+    stats->addPhase(name, CompileStats::Clock::now() - start);
+    return result;
+}
+
+} // namespace unacpp
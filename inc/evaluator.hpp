@@ -0,0 +1,57 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bigint.hpp"
+#include "program.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <variant>
+
+namespace unacpp {
+
+// Returned by the reference evaluator when it runs out of steps or stack
+// depth before the program finishes.
+struct LimitExceeded {};
+
+using ReferenceResult = std::variant<std::optional<BigInt>, LimitExceeded>;
+
+// Evaluates programs by walking them directly, without any optimization or
+// bytecode. This is far slower than the interpreter, but is simple enough to
+// be obviously correct, so it's used as the reference to check the optimizer
+// and interpreter against.
+class ReferenceEvaluator {
+private:
+    const ProgramMap &programs_;
+
+    uint64_t maxSteps_;
+
+    size_t maxDepth_;
+
+    uint64_t stepsLeft_;
+
+    size_t depthLeft_;
+
+    bool limitExceeded_;
+
+    std::optional<BigInt> evaluateProgram(const Program &program, const BigInt &input);
+
+    std::optional<BigInt> evaluateBranch(const Branch &branch, BigInt val);
+
+public:
+    // Each evaluation may run at most maxSteps instructions, with at most
+    // maxDepth nested function calls.
+    ReferenceEvaluator(const ProgramMap &programs, uint64_t maxSteps, size_t maxDepth);
+
+    ReferenceResult evaluate(const std::string &programName, BigInt input);
+};
+
+} // namespace unacpp
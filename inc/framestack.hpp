@@ -0,0 +1,119 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bigint.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace unacpp {
+
+// Where a popped frame continues from.
+struct FrameReturn {
+    // Where to continue from when returning to the caller.
+    uint32_t instIndex;
+
+    // Where to continue from when the function fails, if it was called by
+    // CALL_FAIL_JMP.
+    uint32_t failIndex;
+};
+
+// A run of frames on the stack which all return to the same place.
+struct ReturnRun {
+    uint32_t instIndex;
+
+    size_t count;
+};
+
+// The call stack of the interpreter. Linear recursion, like
+// `*3 { - *3 + + + | }`, pushes one frame for every unit of its input, where
+// every frame returns to the same address and saves a value that differs from
+// the one before it by the same amount. Rather than storing each of these
+// frames, consecutive frames like this are stored as a single run, holding the
+// value of the topmost frame in the run and the difference between each frame,
+// so the frames below it are rebuilt one at a time as they're returned to.
+class FrameStack {
+private:
+    struct FrameRun {
+        FrameRun(uint32_t instIndex, uint32_t failIndex, bool saved);
+
+        // The value saved in the topmost frame of the run.
+        BigInt val;
+
+        // How much larger each frame's value is than the one below it. Only
+        // meaningful when the run has more than one frame.
+        BigInt delta;
+
+        uint32_t instIndex;
+
+        uint32_t failIndex;
+
+        size_t count;
+
+        // Whether the frames in the run saved a value. Runs of frames pushed
+        // by the NOSAVE calls never need to rebuild any values.
+        bool saved;
+    };
+
+    // Runs past runCount_ are unused, but are kept around so that the storage
+    // of their values can be reused.
+    std::vector<FrameRun> runs_;
+
+    size_t runCount_ = 0;
+
+    size_t frameCount_ = 0;
+
+    size_t memory_ = 0;
+
+    BigInt scratch_;
+
+    // Returns a run at the top of the stack, reusing an old one if possible.
+    FrameRun &pushRun(uint32_t instIndex, uint32_t failIndex, bool saved);
+
+    // Makes sure the top frame is in a run by itself, so that its value can
+    // be changed without changing the frames below it.
+    FrameRun &splitTop();
+
+    // The bytes taken by the limbs of the values the run needs.
+    static size_t getRunMemory(const FrameRun &run);
+
+public:
+    void clear();
+
+    void push(const BigInt &val, uint32_t instIndex, uint32_t failIndex);
+
+    // Pushes a frame without saving a value in it, for functions which never
+    // need to restore their input.
+    void push(uint32_t instIndex, uint32_t failIndex);
+
+    FrameReturn pop();
+
+    // Swaps the value saved in the top frame with the given value.
+    void swapTop(BigInt &val);
+
+    // Saves the given value in the top frame.
+    void setTop(const BigInt &val);
+
+    // The number of frames on the stack.
+    size_t size() const;
+
+    // The number of runs the frames are stored in.
+    size_t runCount() const;
+
+    // Returns where the frames of the run with the given index return to,
+    // counting up from the bottom of the stack.
+    ReturnRun getRun(size_t index) const;
+
+    // The bytes taken by the limbs of the values needed to rebuild each frame.
+    size_t memoryUsage() const;
+};
+
+} // namespace unacpp
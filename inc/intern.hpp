@@ -0,0 +1,70 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bigint.hpp"
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace unacpp {
+
+// A set of values whose elements never move, split into shards with a lock
+// each, so that threads optimizing different functions rarely wait on each
+// other.
+template <typename T>
+class InternTable {
+private:
+    static constexpr size_t shardCount = 16;
+
+    struct Shard {
+        std::mutex mutex;
+
+        std::unordered_set<T> values;
+    };
+
+    std::array<Shard, shardCount> shards_;
+
+public:
+    const T &intern(T value) {
+        auto &shard = shards_[std::hash<T>{}(value) % shardCount];
+        std::lock_guard lock{shard.mutex};
+        return *shard.values.insert(std::move(value)).first;
+    }
+};
+
+// The single copy of each constant and function name used by the instructions
+// of a module, which point to them instead of each holding a copy of their
+// own. The pool is shared by everything holding instructions made from it,
+// and is freed along with the last of them, so nothing outlives the module
+// it was compiled for. Values may be interned from any thread.
+class ConstantPool {
+private:
+    InternTable<BigInt> constants_;
+
+    InternTable<std::string> names_;
+
+public:
+    ConstantPool() = default;
+
+    ConstantPool(const ConstantPool &) = delete;
+
+    ConstantPool &operator=(const ConstantPool &) = delete;
+
+    const BigInt &internConstant(BigInt value);
+
+    const std::string &internName(std::string_view name);
+};
+
+} // namespace unacpp
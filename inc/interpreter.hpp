@@ -10,11 +10,312 @@
 
 #include "bigint.hpp"
 #include "bytecode.hpp"
+#include "framestack.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <variant>
+#include <vector>
 
 namespace unacpp {
 
+class Profiler;
+
+class ThreadPool;
+
+// Whether the interpreter was built with the opcode_stats option, which makes
+// it count the opcodes it executes. Without it, no counting is done.
+#ifdef UNACPP_OPCODE_STATS
+constexpr bool opcodeStatsEnabled = true;
+#else
+constexpr bool opcodeStatsEnabled = false;
+#endif
+
+// Counts of how many times each opcode was executed, and how many times each
+// pair of opcodes were executed one after the other.
+struct OpcodeStats {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(256);
+
+    // Indexed by the first opcode times 256 plus the second opcode.
+    std::vector<uint64_t> pairCounts = std::vector<uint64_t>(256 * 256);
+
+    // Returns the counts of the opcodes and the pairs, most frequent first.
+    std::string getReport() const;
+};
+
+// Limits on the resources a single evaluation may use. The instruction and
+// memory limits are only checked when a function is called, so an evaluation
+// may go a little past them, by at most what one function can do before it
+// makes a call or returns.
+struct Budget {
+    uint64_t maxInstructions = std::numeric_limits<uint64_t>::max();
+
+    // The most nested function calls there may be at once.
+    size_t maxDepth = std::numeric_limits<size_t>::max();
+
+    // The most bytes that may be used by the limbs of the value being
+    // computed, plus the values the stack keeps to restore each frame's
+    // input. Runs of frames from linear recursion take up very little.
+    size_t maxMemory = std::numeric_limits<size_t>::max();
+
+    bool operator==(const Budget &other) const = default;
+};
+
+enum class BudgetLimit {
+    Instructions,
+    Depth,
+    Memory,
+};
+
+// The result of an evaluation that ran out of its budget before finishing.
+struct BudgetExceeded {
+    BudgetLimit limit;
+};
+
+using BoundedResult = std::variant<std::optional<BigInt>, BudgetExceeded>;
+
+// An instruction of a trace, with its arguments decoded ahead of time.
+struct TraceOp {
+    OpCode opcode;
+
+    // Whether the instruction failed when the trace was recorded, so that the
+    // value was restored and the function continued from its next branch.
+    bool failed = false;
+
+    // The constants and immediates the instruction takes, in order.
+    const BigInt *constants[2] = {};
+
+    Limb immediates[2] = {};
+
+    // The reciprocal of the divisor or modulo, for the division and modulo
+    // instructions.
+    const std::optional<WordDivisor> *divisor = nullptr;
+
+    // The address of the next instruction.
+    uint32_t next = 0;
+
+    // Where execution continues when a FAIL_JMP instruction fails, or when a
+    // function called by CALL_FAIL_JMP fails.
+    uint32_t failTarget = 0;
+};
+
+// A straight line of instructions recorded from one iteration of a loop, made
+// by a function tail calling itself, including the instructions of any
+// functions it calls along the way. Running the loop from the trace skips
+// decoding and dispatching each instruction, and the trace is left for the
+// bytecode as soon as an instruction succeeds or fails differently to when it
+// was recorded.
+struct Trace {
+    std::vector<TraceOp> ops;
+
+    // Whether the tail call saves the value as the input of the next
+    // iteration, as TAIL_CALL does.
+    bool saveInput = false;
+
+    // Whether saving the input can be put off until the trace is left, because
+    // the trace can only be left before the value has been changed.
+    bool deferSave = false;
+};
+
+// A loop found while evaluating, which is traced once it's run often enough.
+struct TracedLoop {
+    // The address of the function which tail calls itself.
+    uint32_t header;
+
+    uint32_t count = 0;
+
+    // Set when the loop couldn't be traced, so it isn't tried again.
+    bool rejected = false;
+
+    std::optional<Trace> trace;
+};
+
+// The result of the later branches of a speculated function, evaluated on
+// another thread while its first branch is. The thread that started it waits
+// for the result if the first branch fails, and cancels it otherwise.
+class SpeculativeResult {
+private:
+    const BigInt input_;
+
+    std::atomic<bool> cancelled_ = false;
+
+    std::mutex mutex_;
+
+    std::condition_variable finishedCondition_;
+
+    bool finished_ = false;
+
+    bool abandoned_ = false;
+
+    std::optional<BigInt> result_;
+
+public:
+    explicit SpeculativeResult(BigInt input);
+
+    const BigInt &getInput() const;
+
+    // Asks the evaluation to stop, which it does the next time it makes a
+    // call.
+    void cancel();
+
+    const std::atomic<bool> &getCancelled() const;
+
+    // Finishes the evaluation with its result. If it was abandoned, because it
+    // would have printed something, the thread that started it evaluates it
+    // again itself, so that the output comes out in order.
+    void finish(std::optional<BigInt> result, bool abandoned);
+
+    // Blocks until the evaluation has finished, returning false if it was
+    // abandoned.
+    bool wait();
+
+    std::optional<BigInt> takeResult();
+};
+
+// A SPEC_CALL which hasn't reached its SPEC_JOIN yet.
+struct PendingSpeculation {
+    // The evaluation of the later branches, or nullptr if they weren't
+    // started, in which case they're evaluated from the input if needed.
+    std::shared_ptr<SpeculativeResult> result;
+
+    // The value SPEC_CALL was run with, when there's no result holding it.
+    BigInt input;
+
+    // The address of the function with the later branches.
+    uint32_t restAddress;
+};
+
+// Holds the state needed to evaluate bytecode. The stack frames and scratch
+// values are kept between evaluations, so that evaluating many inputs with
+// the same interpreter doesn't need to allocate once the stack has grown to
+// its largest size. An interpreter must only be used by one thread at a time.
+class Interpreter {
+private:
+    FrameStack frames_;
+
+    BigInt quotient_;
+
+    BigInt remainder_;
+
+    OpcodeStats *opcodeStats_;
+
+    // Which limit the last evaluation exceeded, if it was stopped early.
+    std::optional<BudgetLimit> exceededLimit_;
+
+    // The address the last evaluation was at when it exceeded its limit.
+    uint32_t exceededAddress_;
+
+    // The loops found while evaluating the module with the given id. They're
+    // kept between evaluations of the same module, so that each evaluation
+    // doesn't have to run its loops enough times to trace them again. Only a
+    // few are tracked, so they're searched through in order.
+    std::vector<TracedLoop> loops_;
+
+    std::optional<uint64_t> loopsModuleId_;
+
+    // Where the later branches of speculated functions are evaluated, or
+    // nullptr to evaluate them in order.
+    ThreadPool *speculationPool_;
+
+    // The speculated calls which haven't been joined yet, innermost last.
+    std::vector<PendingSpeculation> speculations_;
+
+    // The speculations whose first branch succeeded, which may still be
+    // running until they notice they've been cancelled.
+    std::vector<std::shared_ptr<SpeculativeResult>> cancelledSpeculations_;
+
+    // Set while evaluating the later branches of a speculated function, to
+    // stop once their result is no longer needed.
+    const std::atomic<bool> *cancelled_;
+
+    // Set when a speculative evaluation stops because it reached a print.
+    bool abandoned_;
+
+    // Starts evaluating the function at the address from the value on the
+    // speculation pool, returning nullptr if none of its threads are idle.
+    std::shared_ptr<SpeculativeResult> speculate(const BytecodeModule &bytecode, uint32_t address, const BigInt &val);
+
+    // Cancels the speculations which haven't been joined, and waits for every
+    // cancelled speculation to stop, since they read the module being
+    // evaluated.
+    void stopSpeculations();
+
+    // Divides the number by the divisor in place, returning whether it
+    // divided evenly. The word divisor is used when the divisor has one.
+    bool divide(BigInt &num, const BigInt &divisor, const std::optional<WordDivisor> &wordDivisor);
+
+    // Returns whether the number modulo the modulo equals the comparison,
+    // without computing the quotient.
+    bool modEquals(const BigInt &num, const BigInt &modulo, const std::optional<WordDivisor> &wordModulo, const BigInt &cmp);
+
+    // Runs the instruction on the value, returning whether it succeeded.
+    bool runTraceOp(const TraceOp &op, BigInt &val);
+
+    // Records the instructions run by one iteration of the loop starting at
+    // the header, from the given value. Returns std::nullopt if the iteration
+    // doesn't end by tail calling the header, prints anything, or fails.
+    std::optional<Trace> recordTrace(const BytecodeModule &bytecode, uint32_t header, const BigInt &initialVal);
+
+    // Runs the loop from its trace until the trace is left, returning the
+    // address to continue from.
+    uint32_t runTrace(const Trace &trace, std::optional<BigInt> &val);
+
+    // Called on each backwards tail call, returning the address to continue
+    // from. Once the loop has been run enough times, it's traced and run from
+    // the trace.
+    uint32_t enterLoop(const BytecodeModule &bytecode, uint32_t header, std::optional<BigInt> &val);
+
+    // Returns a line for each frame on the stack, starting with the frame
+    // running the instruction at the given address, and then the frames of
+    // the calls leading to it.
+    std::string formatStackTrace(const BytecodeModule &bytecode, uint32_t address) const;
+
+    template <bool Profiling, bool Budgeted>
+    std::optional<BigInt> run(const BytecodeModule &bytecode, BigInt initialVal, uint32_t address, Profiler *profiler, const Budget *budget);
+
+public:
+    Interpreter();
+
+    // Sets where the executed opcodes are counted, when the interpreter was
+    // built with opcode_stats enabled.
+    void setOpcodeStats(OpcodeStats *stats);
+
+    // Sets the pool that speculated functions evaluate their later branches
+    // on, while their first branch is evaluated on the calling thread. Nothing
+    // is evaluated speculatively while profiling or with a budget. Every
+    // speculation has stopped by the time the evaluation which started it
+    // returns, so the module only needs to outlive the evaluation.
+    void setSpeculationPool(ThreadPool *pool);
+
+    // Evaluates the expression of the bytecode with the given index in its
+    // entry points.
+    std::optional<BigInt> getResult(const BytecodeModule &bytecode, BigInt initialVal, size_t entryPoint = 0);
+
+    // Evaluates the bytecode while recording statistics about it in the
+    // profiler. This is much slower than evaluating it normally.
+    std::optional<BigInt> getResult(const BytecodeModule &bytecode, BigInt initialVal, Profiler &profiler, size_t entryPoint = 0);
+
+    // Evaluates the bytecode, stopping early if the evaluation goes over the
+    // budget. If a profiler is given, the evaluation is also profiled.
+    BoundedResult getResult(
+        const BytecodeModule &bytecode,
+        BigInt initialVal,
+        const Budget &budget,
+        Profiler *profiler = nullptr,
+        size_t entryPoint = 0);
+
+    // Returns a stack trace of where the last evaluation was when it went over
+    // its budget, with a line for each frame. This is only meaningful when the
+    // last evaluation returned BudgetExceeded.
+    std::string getStackTrace(const BytecodeModule &bytecode) const;
+};
+
 std::optional<BigInt> getResult(const BytecodeModule &bytecode, BigInt initialVal);
 
 } // namespace unacpp
@@ -0,0 +1,206 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "compilestats.hpp"
+#include "intern.hpp"
+#include "program.hpp"
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace unacpp {
+
+class ParallelThreads;
+
+// A straight line of instructions in a function. Any of the instructions may
+// fail, in which case the value the function was called with is restored and
+// execution continues from the failure edge, the same as when a branch of a
+// program fails. Once every instruction succeeds, execution continues from the
+// success edge.
+struct BasicBlock {
+    std::vector<Instruction> instructions;
+
+    // The index of the block to continue with once the block succeeds, or
+    // std::nullopt to return from the function. The blocks of a function are
+    // emitted in order, so this must be the block right after this one.
+    std::optional<size_t> success;
+
+    // The index of the block to continue with when an instruction fails, or
+    // std::nullopt to return from the function in a failed state. This must
+    // be a later block than this one.
+    std::optional<size_t> failure;
+
+    // Whether any of the instructions can fail without calling a function.
+    bool hasFailingInstruction() const;
+
+    bool operator==(const BasicBlock &) const = default;
+};
+
+// A function made of basic blocks, the first of which is where it starts.
+// Each branch of the program it was lowered from starts off as a single
+// block, whose failure edge leads to the block for the next branch.
+struct IrFunction {
+    std::string name;
+
+    // Where the program was defined in the source.
+    FilePosition pos;
+
+    std::vector<BasicBlock> blocks;
+
+    // Returns whether the function is still a list of branches, where each
+    // block is a whole branch that fails to the next one.
+    bool isBranchList() const;
+
+    // Returns whether execution continues from the block after restoring the
+    // value, which is the case for the first block and any which are the
+    // target of a failure edge. These are where the branches of the function
+    // start.
+    bool startsBranch(size_t blockIndex) const;
+};
+
+// What calls to a function need to know about it to be compiled, for
+// functions which are defined in a separately compiled library.
+struct CallSummary {
+    // Whether the function can return in a failed state.
+    bool canFail;
+
+    // Whether the function may need to restore the value it was called with.
+    bool needsInput;
+};
+
+// The two functions a speculated function is split into, so that its later
+// branches can be evaluated while its first one is. One has just the first
+// branch, and the other has the rest.
+struct SpeculativeSplit {
+    std::string firstName;
+
+    std::string restName;
+};
+
+// The functions of a program, along with the names of the ones which are
+// entry points, which are never removed. The first entry point is always the
+// first function. Calls may also be made to external functions, which are
+// defined in a library the program is linked with.
+class IrModule {
+private:
+    std::vector<IrFunction> functions_;
+
+    std::unordered_map<std::string, size_t> indices_;
+
+    std::vector<std::string> entryNames_;
+
+    std::unordered_map<std::string, CallSummary> externals_;
+
+    std::unordered_map<std::string, SpeculativeSplit> speculations_;
+
+    // The pool the instructions' constants and function names are kept in,
+    // shared with the programs the module was lowered from.
+    std::shared_ptr<ConstantPool> pool_;
+
+    void updateIndices();
+
+public:
+    IrModule(std::vector<IrFunction> functions, std::vector<std::string> entryNames, std::shared_ptr<ConstantPool> pool);
+
+    std::span<IrFunction> getFunctions();
+
+    std::span<const IrFunction> getFunctions() const;
+
+    // Returns the function with the given name, or nullptr if there isn't one.
+    const IrFunction *findFunction(std::string_view name) const;
+
+    std::span<const std::string> getEntryNames() const;
+
+    // Returns the pool that instructions added to the module must be made
+    // with.
+    const std::shared_ptr<ConstantPool> &getConstantPool() const;
+
+    bool isEntryPoint(std::string_view name) const;
+
+    void addExternal(const std::string &name, CallSummary summary);
+
+    // Returns the summary of the external function with the given name, or
+    // nullptr if there isn't one.
+    const CallSummary *findExternal(std::string_view name) const;
+
+    // Marks the function as speculated, so calls to it are made to the
+    // functions it was split into.
+    void addSpeculation(const std::string &name, SpeculativeSplit split);
+
+    // Returns how the function with the given name was split, or nullptr if it
+    // isn't speculated.
+    const SpeculativeSplit *findSpeculation(std::string_view name) const;
+
+    // Adds a function to the end of the module. Adding a function can move the
+    // others, so references to them shouldn't be held on to across this.
+    void addFunction(IrFunction function);
+
+    // Removes the functions the predicate returns true for, other than entry
+    // points, keeping the rest in the same order.
+    void removeFunctions(const std::function<bool(const IrFunction &)> &predicate);
+};
+
+// Separates the name of a function from the value a copy of it was
+// specialized for, in the copy's name. Names in the source can't have spaces,
+// so the copies never clash with them.
+constexpr std::string_view specializedSeparator = " @";
+
+// Modules with fewer functions than this are transformed and compiled one
+// function at a time on a single thread, since it would take longer to start
+// the threads than to do the work.
+constexpr size_t minParallelFunctions = 256;
+
+// Calls the transformation on each function of the module, which may be done
+// in parallel on the given threads, so it mustn't look at any other function.
+// Returns whether it returned true for any of them.
+bool transformFunctions(IrModule &module, ParallelThreads &threads, const std::function<bool(IrFunction &)> &transform);
+
+// Converts the programs into functions of basic blocks. The function for the
+// first entry point comes first, followed by the rest in the order they're
+// stored in the map. The programs' instructions must have been made with the
+// given pool, which the module keeps.
+IrModule lowerPrograms(const ProgramMap &programs, std::span<const std::string> entryNames, std::shared_ptr<ConstantPool> pool);
+
+// A transformation of a module, which returns whether it changed anything.
+using IrPass = std::function<bool(IrModule &module)>;
+
+// Runs the pass, recording how long it took and what it changed in the stats
+// as part of the given round, if there are any stats.
+bool runPass(std::string_view name, const IrPass &pass, IrModule &module, CompileStats *stats, size_t round);
+
+// Runs a list of passes over a module, in the order they were added.
+class PassManager {
+private:
+    struct NamedPass {
+        std::string_view name;
+
+        IrPass pass;
+    };
+
+    std::vector<NamedPass> passes_;
+
+public:
+    void add(std::string_view name, IrPass pass);
+
+    // Runs every pass once, returning whether any of them changed the module.
+    // What each pass did is recorded in the stats, if there are any.
+    bool run(IrModule &module, CompileStats *stats = nullptr, size_t round = 1) const;
+
+    // Returns the names of the passes, in the order they run.
+    std::vector<std::string_view> getPassNames() const;
+};
+
+} // namespace unacpp
@@ -0,0 +1,99 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bytecode.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace unacpp {
+
+// The version of the object format. The code in an object is stored as a
+// serialized module, so objects also stop loading whenever the bytecode
+// format version changes.
+constexpr uint32_t objectFormatVersion = 1;
+
+// What a library tells the programs using it about one of its functions.
+struct FunctionSummary {
+    std::string name;
+
+    CallSummary call;
+
+    // The instructions the function was optimized down to, if it ended up as
+    // a single branch which doesn't call anything. Programs using the library
+    // get their own copy of these, so that the optimizer can inline them.
+    std::optional<std::vector<Instruction>> body;
+};
+
+// Code compiled separately from the code it's linked with. For libraries,
+// every named function in the file is exported, while programs only have
+// entry points for their expressions.
+struct BytecodeObject {
+    // The code of the object, whose entry points are the exported functions
+    // for a library, in the same order as the exports.
+    BytecodeModule code;
+
+    std::vector<FunctionSummary> exports;
+
+    // The pool the constants and names of the exports' bodies are kept in.
+    std::shared_ptr<ConstantPool> pool;
+
+    // The calls to functions exported by other libraries.
+    std::vector<Relocation> relocations;
+};
+
+using CompileObjectResult = std::variant<BytecodeObject, ParseErrors>;
+
+// Compiles each of the functions in the file into a library. They may call the
+// functions exported by the given libraries, which the library will need to be
+// linked with as well. If there are stats, the time taken by each step of the
+// pipeline is recorded in them.
+CompileObjectResult compileLibrary(
+    std::string_view fileContent,
+    std::span<const BytecodeObject> libraries,
+    bool debugMode,
+    const OptimizerOptions &options = {},
+    CompileStats *stats = nullptr);
+
+// Compiles the expressions into a program which calls functions from the given
+// libraries, ready to be linked with them. Stats are recorded the same as for
+// compileLibrary.
+CompileObjectResult compileProgram(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    std::span<const BytecodeObject> libraries,
+    bool debugMode,
+    const OptimizerOptions &options = {},
+    CompileStats *stats = nullptr);
+
+// The linked module, or a message saying why the objects couldn't be linked.
+using LinkResult = std::variant<BytecodeModule, std::string>;
+
+// Links the program with the libraries into a single module, with the same
+// entry points as the program. Each call to an external function goes to the
+// first of the libraries which exports it.
+LinkResult linkObjects(const BytecodeObject &program, std::span<const BytecodeObject> libraries);
+
+std::vector<uint8_t> serializeObject(const BytecodeObject &object);
+
+// Reads back an object written by serializeObject. Returns std::nullopt if the
+// data is truncated, was written by a different format version, or its code
+// doesn't pass the same checks as a serialized module.
+std::optional<BytecodeObject> deserializeObject(std::span<const uint8_t> data);
+
+} // namespace unacpp
@@ -8,10 +8,113 @@
 
 #pragma once
 
+#include "ir.hpp"
 #include "program.hpp"
 
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace unacpp {
 
-ProgramMap optimizePrograms(ProgramMap programs, const std::string &programName);
+// The highest optimization level, which enables every pass.
+constexpr unsigned maxOptimizationLevel = 3;
+
+// The optimization level used when none is given.
+constexpr unsigned defaultOptimizationLevel = 2;
+
+// Which of the optimizer's passes are run. Each pass can be turned on or off
+// independently of the others, but the passes which recognize functions, such
+// as multiply, only find anything once the inline and condense passes have
+// simplified the functions into the shapes they look for.
+struct OptimizerOptions {
+    bool inlinePrograms = true;
+
+    bool condenseMath = true;
+
+    bool simplifyMultiply = true;
+
+    bool simplifyDivide = true;
+
+    bool simplifyModEqual = true;
+
+    bool simplifyNot = true;
+
+    bool simplifyEqual = true;
+
+    // Replaces recursive functions which don't have the shapes the passes
+    // above look for with the arithmetic they compute, once it's proven that
+    // they compute it.
+    bool recognizeIdioms = true;
+
+    // Evaluates calls at compile time when the value they're called with is
+    // already known, such as after *0 +3.
+    bool partialEvaluate = false;
+
+    // The functions whose branches after the first are evaluated on another
+    // thread while the first branch is, when there's one to spare. This isn't
+    // a pass, and is done after all of them.
+    std::vector<std::string> speculate;
+
+    // How many threads the passes and the bytecode generator may use, or zero
+    // for one for each hardware thread. This doesn't change the result, only
+    // how long it takes.
+    size_t threads = 0;
+
+    // Returns the options for the given optimization level. -O0 runs no passes
+    // at all, -O1 only inlines functions and combines arithmetic, and -O2
+    // also replaces recursive functions with the arithmetic they compute. -O3
+    // also evaluates calls with known inputs while compiling.
+    static OptimizerOptions forLevel(unsigned level);
+
+    // Turns the pass with the given name on or off, returning false if there's
+    // no pass with that name.
+    bool setPass(std::string_view name, bool enabled);
+
+    // Returns the names of the enabled passes, separated by commas.
+    std::string toString() const;
+};
+
+// The names of the passes, as accepted by OptimizerOptions::setPass.
+constexpr std::array<std::string_view, 9> optimizerPassNames = {
+    "inline",
+    "condense",
+    "multiply",
+    "divide",
+    "mod-eq",
+    "not",
+    "equal",
+    "idiom",
+    "partial",
+};
+
+// Lowers the programs into a module of basic blocks, and runs the enabled
+// passes over it. The module keeps the pool the programs were made with, and
+// makes its own instructions with it too. If there are stats, the time taken
+// to lower the programs and what each pass did are recorded in them. The passes
+// run on the given threads, which the caller can go on to generate the
+// bytecode with, or on ones started for options.threads if there are none.
+IrModule optimizePrograms(
+    const ProgramMap &programs,
+    const std::string &programName,
+    std::shared_ptr<ConstantPool> pool,
+    const OptimizerOptions &options = {},
+    CompileStats *stats = nullptr,
+    ParallelThreads *threads = nullptr);
+
+// Optimizes the programs for several expressions at once. None of the named
+// programs are inlined away, so each of them can still be used as an entry
+// point.
+IrModule optimizePrograms(
+    const ProgramMap &programs,
+    std::span<const std::string> programNames,
+    std::shared_ptr<ConstantPool> pool,
+    const OptimizerOptions &options = {},
+    CompileStats *stats = nullptr,
+    ParallelThreads *threads = nullptr);
 
 } // namespace unacpp
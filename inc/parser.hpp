@@ -8,12 +8,17 @@
 
 #pragma once
 
+#include "intern.hpp"
 #include "position.hpp"
 #include "program.hpp"
 #include "token.hpp"
 
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 namespace unacpp {
 
@@ -44,7 +49,14 @@ private:
 
     ProgramMap programs_;
 
-    std::string exprName_;
+    std::shared_ptr<ConstantPool> pool_;
+
+    // The names given to the anonymous programs for each expression.
+    std::vector<std::string> exprNames_;
+
+    // The names of the functions defined by the libraries the programs are
+    // linked with, which can be called without being defined in the file.
+    std::unordered_set<std::string> externalNames_;
 
     static TokenType getType(const Token &token);
 
@@ -56,6 +68,8 @@ private:
 
     std::optional<Program> parseProgram();
 
+    void addBuiltinPrograms(bool debugMode);
+
     void parseExpression(std::string_view expr);
 
     void parseNamedProgram();
@@ -69,9 +83,36 @@ private:
 public:
     Parser(std::string_view fileContent, std::string_view expr, bool debugMode);
 
+    // Parses tokens that were already read from a file. The file content the
+    // tokens refer to must outlive the parser.
+    Parser(std::vector<Token> tokens, std::string_view expr, bool debugMode);
+
+    // Parses a program for each of the expressions, which share the programs
+    // defined in the file. The expressions must outlive the parser. Programs
+    // may call the external functions as well as the ones in the file.
+    Parser(
+        std::string_view fileContent,
+        std::span<const std::string> exprs,
+        bool debugMode,
+        std::span<const std::string> externalNames = {});
+
+    // The same, for tokens which were already read from the file.
+    Parser(
+        std::vector<Token> tokens,
+        std::span<const std::string> exprs,
+        bool debugMode,
+        std::span<const std::string> externalNames = {});
+
+    // Returns the name of the program for the first expression.
     const std::string &getExpressionName() const;
 
+    const std::vector<std::string> &getExpressionNames() const;
+
     FileParseResult getParseResult() const;
+
+    // Returns the pool the programs' constants and function names are kept
+    // in, which has to be kept for as long as the programs are used.
+    const std::shared_ptr<ConstantPool> &getConstantPool() const;
 };
 
 } // namespace unacpp
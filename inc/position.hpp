@@ -14,6 +14,8 @@ namespace unacpp {
 
 struct FilePosition {
     size_t line, col;
+
+    bool operator==(const FilePosition &) const = default;
 };
 
 } // namespace unacpp
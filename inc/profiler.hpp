@@ -0,0 +1,128 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bytecode.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace unacpp {
+
+// Collects per-function statistics while the interpreter runs, attributed
+// back to the source using the function table of the bytecode. A profiler
+// can be passed to any number of evaluations of the same module, and
+// accumulates the statistics of all of them.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct FunctionStats {
+        uint64_t calls = 0;
+
+        // The instructions executed by the function itself.
+        uint64_t selfInstructions = 0;
+
+        // The instructions executed by the function and everything it called.
+        // Recursive calls are only counted once.
+        uint64_t inclusiveInstructions = 0;
+
+        Clock::duration inclusiveTime{};
+
+        // How many times each branch of the function failed. Failures of the
+        // last branch are failures of the whole function.
+        std::vector<uint64_t> branchFailures;
+    };
+
+private:
+    // A node in the calling context tree, which records the instructions
+    // executed for each distinct stack of function calls.
+    struct StackNode {
+        size_t function;
+
+        size_t parent;
+
+        std::vector<std::pair<size_t, size_t>> children;
+
+        uint64_t selfInstructions;
+    };
+
+    struct ActiveCall {
+        size_t function;
+
+        size_t node;
+
+        uint64_t startInstructions;
+
+        Clock::time_point startTime;
+    };
+
+    const BytecodeModule &bytecode_;
+
+    // The index of the function containing each address of the bytecode.
+    std::vector<uint32_t> addressFunctions_;
+
+    std::vector<FunctionStats> stats_;
+
+    // How many calls to each function are currently on the stack.
+    std::vector<size_t> activeCounts_;
+
+    // The calling context tree, with the root at index 0.
+    std::vector<StackNode> nodes_;
+
+    std::vector<ActiveCall> calls_;
+
+    uint64_t instructionCount_;
+
+    size_t getChildNode(size_t parent, size_t function);
+
+    void startCall(size_t function, size_t parentNode);
+
+    void finishCall();
+
+public:
+    explicit Profiler(const BytecodeModule &bytecode);
+
+    // Starts recording an evaluation of the function at the address.
+    void startEvaluation(uint32_t address);
+
+    void finishEvaluation();
+
+    void countInstruction() {
+        instructionCount_++;
+        nodes_[calls_.back().node].selfInstructions++;
+    }
+
+    void callFunction(uint32_t address);
+
+    void tailCallFunction(uint32_t address);
+
+    // Called when the current function returns from the instruction at the
+    // given address.
+    void returnFromFunction(uint32_t address, bool failed);
+
+    // Called when the failure of the instruction at the given address causes
+    // execution to continue from the next branch of the function.
+    void branchFailed(uint32_t address);
+
+    const std::vector<FunctionStats> &getStats() const;
+
+    // Returns a table of the statistics of every function that was called,
+    // sorted by the number of instructions each function executed itself.
+    std::string getReport() const;
+
+    // Returns the instructions executed for each stack of function calls, in
+    // the collapsed stack format used by flame graph tools.
+    std::string getCollapsedStacks() const;
+};
+
+} // namespace unacpp
@@ -20,16 +20,28 @@
 
 namespace unacpp {
 
-class DebugPrint {};
+class ConstantPool;
+
+class DebugPrint {
+public:
+    bool operator==(const DebugPrint &) const = default;
+};
+
+class DebugStackTrace {
+public:
+    bool operator==(const DebugStackTrace &) const = default;
+};
 
 class AddProgram {
 private:
-    BigInt amount_;
+    const BigInt *amount_;
 
 public:
-    AddProgram(BigInt amount);
+    AddProgram(ConstantPool &pool, BigInt amount);
 
     const BigInt &getAmount() const;
+
+    bool operator==(const AddProgram &) const = default;
 };
 
 class DivideProgram {
@@ -40,81 +52,102 @@ public:
     };
 
 private:
-    BigInt divisor_;
+    const BigInt *divisor_;
 
     Remainder remainder_;
 
 public:
-    DivideProgram(BigInt divisor, Remainder remainder);
+    DivideProgram(ConstantPool &pool, BigInt divisor, Remainder remainder);
 
     const BigInt &getDivisor() const;
 
     Remainder getRemainderBehavior() const;
+
+    bool operator==(const DivideProgram &) const = default;
 };
 
 class EqualProgram {
 private:
-    BigInt amount_;
+    const BigInt *amount_;
 
 public:
-    EqualProgram(BigInt amount);
+    EqualProgram(ConstantPool &pool, BigInt amount);
 
     const BigInt &getAmount() const;
+
+    bool operator==(const EqualProgram &) const = default;
 };
 
 class FuncCall {
 private:
-    std::string funcName_;
+    const std::string *funcName_;
 
     FilePosition pos_;
 
 public:
-    FuncCall(std::string_view funcName, FilePosition pos);
+    FuncCall(ConstantPool &pool, std::string_view funcName, FilePosition pos);
 
     const std::string &getFuncName() const;
 
     const FilePosition &getPos() const;
+
+    bool operator==(const FuncCall &) const = default;
 };
 
 class ModEqualProgram {
 private:
-    BigInt amount_;
+    const BigInt *amount_;
 
-    BigInt modulo_;
+    const BigInt *modulo_;
 
 public:
-    ModEqualProgram(BigInt amount, BigInt modulo);
+    ModEqualProgram(ConstantPool &pool, BigInt amount, BigInt modulo);
 
     const BigInt &getAmount() const;
 
     const BigInt &getModulo() const;
+
+    bool operator==(const ModEqualProgram &) const = default;
 };
 
 class MultiplyProgram {
 private:
-    BigInt amount_;
+    const BigInt *amount_;
 
 public:
-    MultiplyProgram(BigInt amount);
+    MultiplyProgram(ConstantPool &pool, BigInt amount);
 
     const BigInt &getAmount() const;
+
+    bool operator==(const MultiplyProgram &) const = default;
 };
 
-class NotProgram {};
+class NotProgram {
+public:
+    bool operator==(const NotProgram &) const = default;
+};
 
 class SubtractProgram {
 private:
-    BigInt amount_;
+    const BigInt *amount_;
 
 public:
-    SubtractProgram(BigInt amount);
+    SubtractProgram(ConstantPool &pool, BigInt amount);
 
     const BigInt &getAmount() const;
+
+    bool operator==(const SubtractProgram &) const = default;
 };
 
+// Instructions point to their constants and the names of the functions they
+// call, which are interned in the pool they were made with, so that they can
+// be copied without allocating and compared by address. Instructions made with
+// different pools can't be compared, and can't be used after their pool is
+// freed.
 using Instruction = std::variant<
     AddProgram,
     DebugPrint,
+    DebugStackTrace,
     DivideProgram,
     EqualProgram,
     FuncCall,
@@ -124,6 +157,10 @@ using Instruction = std::variant<
     SubtractProgram
 >;
 
+// Returns the same instruction, with its constants and names interned in the
+// given pool, for moving instructions from one module to another.
+Instruction copyInstruction(ConstantPool &pool, const Instruction &inst);
+
 class Branch {
 private:
     std::vector<Instruction> instructions_;
@@ -138,10 +175,16 @@ class Program {
 private:
     std::vector<Branch> branches_;
 
+    FilePosition pos_;
+
 public:
-    Program(std::vector<Branch> branches);
+    Program(std::vector<Branch> branches, FilePosition pos);
 
     std::span<const Branch> getBranches() const;
+
+    // The position the program was defined at, or line 0 for the built-in
+    // programs.
+    const FilePosition &getPos() const;
 };
 
 using ProgramMap = std::unordered_map<std::string, Program>;
@@ -0,0 +1,54 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bigint.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace unacpp {
+
+// Numbers are written big-endian, and strings and numbers of any size are
+// written as their size followed by their bytes.
+void writeUint32(std::vector<uint8_t> &data, uint32_t val);
+
+void writeString(std::vector<uint8_t> &data, std::string_view str);
+
+void writeBigInt(std::vector<uint8_t> &data, const BigInt &num);
+
+// Reads back the values written by the functions above. Each of the methods
+// returns std::nullopt if there aren't enough bytes left.
+class ByteReader {
+private:
+    std::span<const uint8_t> data_;
+
+    size_t index_;
+
+public:
+    ByteReader(std::span<const uint8_t> data);
+
+    std::optional<std::span<const uint8_t>> getBytes(size_t count);
+
+    std::optional<uint8_t> getUint8();
+
+    std::optional<uint32_t> getUint32();
+
+    std::optional<std::string> getString();
+
+    std::optional<BigInt> getBigInt();
+
+    bool atEnd() const;
+};
+
+} // namespace unacpp
@@ -0,0 +1,107 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "threadpool.hpp"
+#include "unarian.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+
+namespace unacpp {
+
+// Either a compiled module, or the reason it couldn't be compiled.
+using PooledModule = std::variant<Module, std::string>;
+
+// Keeps the modules compiled from the most recently used files and
+// expressions, recompiling them whenever their file is modified. Safe to use
+// from any number of threads.
+class ModulePool {
+private:
+    struct Entry {
+        std::filesystem::file_time_type modifiedTime;
+
+        // Set once the module has been compiled, which happens without
+        // holding the lock, so that requests for other modules don't wait for
+        // it.
+        std::shared_future<PooledModule> module;
+
+        // The value of useCount_ when the entry was last used.
+        uint64_t lastUsed = 0;
+    };
+
+    OptimizerOptions options_;
+
+    std::map<std::pair<std::string, std::string>, Entry> entries_;
+
+    // Counts calls to get, to find the least recently used entry.
+    uint64_t useCount_ = 0;
+
+    std::mutex mutex_;
+
+    PooledModule compile(const std::string &file, const std::string &expr) const;
+
+public:
+    explicit ModulePool(const OptimizerOptions &options);
+
+    PooledModule get(const std::string &file, const std::string &expr);
+};
+
+struct ServerOptions {
+    OptimizerOptions optimizerOptions;
+
+    // The limits on each evaluation, if any.
+    std::optional<Budget> budget;
+
+    // How many worker threads evaluate requests, or zero for one per
+    // hardware thread.
+    size_t threadCount = 0;
+};
+
+// Evaluates requests sent over a Unix domain socket. Every message, in either
+// direction, is a 4 byte big-endian length followed by that many bytes. A
+// request is made of lines holding an id chosen by the client, the file and
+// expression to evaluate, and then the inputs, separated by whitespace. The
+// response starts with the request's id, followed by either a line with "ok"
+// and a line for the result of each input, or a line with "error" and a
+// message. Clients may send any number of requests without waiting for their
+// responses, which are sent as soon as they're finished, so they may come back
+// in a different order.
+class Server {
+private:
+    std::string socketPath_;
+
+    ServerOptions options_;
+
+    ModulePool modules_;
+
+    ThreadPool workers_;
+
+    void handleConnection(int fd);
+
+    std::string handleRequest(const std::string &request);
+
+public:
+    Server(std::string socketPath, const ServerOptions &options);
+
+    // Accepts connections until the process is stopped. Only returns if the
+    // socket couldn't be set up, with the reason why.
+    std::string run();
+};
+
+} // namespace unacpp
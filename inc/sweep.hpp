@@ -0,0 +1,119 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bigint.hpp"
+#include "bytecode.hpp"
+#include "interpreter.hpp"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace unacpp {
+
+// The inputs from first to last, inclusive, counting up by step.
+struct InputRange {
+    BigInt first;
+
+    BigInt last;
+
+    BigInt step = 1;
+
+    // Parses a range written as a..b, or a..b:step. Returns std::nullopt if
+    // it's malformed, or has more inputs than fit in 64 bits.
+    static std::optional<InputRange> parse(std::string_view str);
+
+    uint64_t size() const;
+};
+
+// The ways the results of evaluating a range of inputs can be combined.
+enum class Reduction {
+    Sum,
+    Min,
+    Max,
+    ArgMax,
+    Count,
+    FailCount,
+    Histogram,
+};
+
+// The names of the reductions, in the same order as the enum.
+constexpr std::array<std::string_view, 7> reductionNames = {
+    "sum",
+    "min",
+    "max",
+    "argmax",
+    "count",
+    "fail-count",
+    "histogram",
+};
+
+std::optional<Reduction> parseReduction(std::string_view name);
+
+// Combines the results of evaluating some inputs. Accumulators for different
+// parts of a range can be merged, and give the same result no matter how the
+// range was split up or which order they're merged in.
+class Accumulator {
+private:
+    Reduction reduction_;
+
+    BigInt sum_;
+
+    // The smallest or largest result so far, and the first input which gave
+    // it, for the reductions which need it.
+    std::optional<BigInt> best_;
+
+    BigInt bestInput_;
+
+    uint64_t count_ = 0;
+
+    uint64_t failCount_ = 0;
+
+    uint64_t exceededCount_ = 0;
+
+    std::map<BigInt, uint64_t> histogram_;
+
+    void addBest(const BigInt &input, const BigInt &result);
+
+public:
+    explicit Accumulator(Reduction reduction);
+
+    void add(const BigInt &input, const std::optional<BigInt> &result);
+
+    // Counts an evaluation which went over its budget. These are left out of
+    // every reduction, apart from being shown in histograms as ?.
+    void addExceeded();
+
+    void merge(const Accumulator &other);
+
+    uint64_t getExceededCount() const;
+
+    // Returns the reduced value, or - if there were no results to reduce. A
+    // histogram has a line for each result with how many times it occurred,
+    // in increasing order, followed by the number of failures.
+    std::string getReport() const;
+};
+
+// Evaluates every input in the range, at each of the entry points of the
+// bytecode, splitting the inputs between the given number of threads, or one
+// for each hardware thread if it's zero. Returns the combined results for
+// each entry point.
+std::vector<Accumulator> sweepRange(
+    const BytecodeModule &bytecode,
+    const InputRange &range,
+    Reduction reduction,
+    size_t threadCount,
+    const std::optional<Budget> &budget);
+
+} // namespace unacpp
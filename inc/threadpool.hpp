@@ -0,0 +1,97 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace unacpp {
+
+// A fixed number of worker threads which run tasks in the order they were
+// submitted. Destroying the pool waits for every task submitted before then
+// to finish.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers_;
+
+    std::deque<std::function<void()>> tasks_;
+
+    std::mutex mutex_;
+
+    std::condition_variable taskAvailable_;
+
+    std::condition_variable tasksFinished_;
+
+    // The number of tasks which have been submitted but haven't finished.
+    size_t pendingCount_ = 0;
+
+    bool stopping_ = false;
+
+    void runWorker();
+
+public:
+    // Starts the given number of threads, or one for each hardware thread if
+    // it's zero.
+    explicit ThreadPool(size_t threadCount = 0);
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    // Submits the task only if one of the threads is idle, so that it starts
+    // right away instead of waiting behind the others. Returns whether it was
+    // submitted.
+    bool trySubmit(std::function<void()> task);
+
+    // Blocks until every submitted task has finished.
+    void wait();
+
+    size_t size() const;
+};
+
+// The threads shared by every parallelFor of one job, such as compiling a
+// module, so that they're started once instead of for every call. They aren't
+// started until a call has enough work to be worth it. Only one parallelFor
+// may use them at a time.
+class ParallelThreads {
+private:
+    size_t threadCount_;
+
+    std::optional<ThreadPool> pool_;
+
+public:
+    // Uses the given number of threads, or one for each hardware thread if
+    // it's zero.
+    explicit ParallelThreads(size_t threadCount = 0);
+
+    size_t size() const;
+
+    // Returns the pool, starting its threads the first time.
+    ThreadPool &getPool();
+};
+
+// Calls the body with every index below the count, spread across the threads.
+// Starting the threads costs more than a little work would take, so when the
+// count is below the minimum, or there's only one thread, the indices are run
+// in order on the calling thread instead. If the body throws, the rest of the
+// indices may still be run, and the first exception is rethrown once they've
+// finished.
+void parallelFor(size_t count, size_t minParallelCount, ParallelThreads &threads, const std::function<void(size_t)> &body);
+
+} // namespace unacpp
@@ -0,0 +1,106 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#ifndef UNARIAN_H
+#define UNARIAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A compiled expression. Modules are immutable, and may be shared between
+// threads.
+typedef struct unarian_module unarian_module;
+
+// The state used to evaluate modules. A context must only be used by one
+// thread at a time, but can be reused for any number of evaluations.
+typedef struct unarian_context unarian_context;
+
+typedef enum unarian_status {
+    // The evaluation succeeded, and the output holds the result.
+    UNARIAN_SUCCESS = 0,
+
+    // The evaluated expression failed for the given input.
+    UNARIAN_FAILURE = 1,
+
+    // The input was not a valid non-negative decimal number.
+    UNARIAN_INVALID_INPUT = 2,
+
+    // The evaluation went over one of the limits set with
+    // unarian_context_set_budget, and was stopped.
+    UNARIAN_BUDGET_EXCEEDED = 3,
+
+    // The evaluation couldn't be finished for a reason other than the
+    // program, such as running out of memory.
+    UNARIAN_INTERNAL_ERROR = 4,
+} unarian_status;
+
+// Compiles expr, with the programs defined in the source available to it.
+// On failure, NULL is returned, and if errors is not NULL it is set to a
+// description of the parse errors, which must be freed with
+// unarian_string_free. If the module couldn't be compiled for another reason,
+// such as running out of memory, NULL is returned with errors set to NULL.
+unarian_module *unarian_module_compile(
+    const char *source,
+    size_t source_length,
+    const char *expr,
+    int debug_mode,
+    char **errors);
+
+void unarian_module_free(unarian_module *module);
+
+// Returns NULL if the context couldn't be allocated.
+unarian_context *unarian_context_new(void);
+
+void unarian_context_free(unarian_context *context);
+
+// Limits every later evaluation with the context to the given number of
+// instructions, nested calls, and bytes of memory for the values being
+// computed. A limit of 0 means there's no limit, so passing 0 for all three
+// removes the budget.
+void unarian_context_set_budget(
+    unarian_context *context,
+    uint64_t max_instructions,
+    size_t max_depth,
+    size_t max_memory);
+
+// Evaluates the module with the given decimal input. On success, output is
+// set to the decimal result, which must be freed with unarian_string_free.
+unarian_status unarian_evaluate(
+    unarian_context *context,
+    const unarian_module *module,
+    const char *input,
+    char **output);
+
+unarian_status unarian_evaluate_u64(
+    unarian_context *context,
+    const unarian_module *module,
+    uint64_t input,
+    char **output);
+
+// Evaluates the module for each of the count inputs. The status of each
+// evaluation is written to statuses, and successful results are written to
+// outputs, with the outputs of unsuccessful evaluations set to NULL.
+void unarian_evaluate_batch(
+    unarian_context *context,
+    const unarian_module *module,
+    const char *const *inputs,
+    size_t count,
+    char **outputs,
+    unarian_status *statuses);
+
+void unarian_string_free(char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UNARIAN_H
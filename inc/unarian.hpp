@@ -0,0 +1,67 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#pragma once
+
+#include "bigint.hpp"
+#include "bytecode.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace unacpp {
+
+// A compiled Unarian expression. Modules are immutable once compiled, so a
+// single module can be shared between any number of threads, and copying a
+// module only copies a reference to the compiled bytecode.
+class Module {
+private:
+    std::shared_ptr<const BytecodeModule> bytecode_;
+
+    explicit Module(BytecodeModule bytecode);
+
+public:
+    // Compiles the expression, with the programs defined in source available
+    // to it.
+    static std::variant<Module, ParseErrors> compile(
+        std::string_view source,
+        std::string_view expr = "main",
+        bool debugMode = false,
+        const OptimizerOptions &options = {});
+
+    static Module fromBytecode(BytecodeModule bytecode);
+
+    const BytecodeModule &getBytecode() const;
+};
+
+using CompileResult = std::variant<Module, ParseErrors>;
+
+// The per-thread state used to evaluate modules. A context is cheap to keep
+// around, and reusing one for many evaluations avoids reallocating the stack
+// each time. Contexts must not be used by more than one thread at a time.
+class Context {
+private:
+    Interpreter interpreter_;
+
+public:
+    std::optional<BigInt> evaluate(const Module &module, BigInt input);
+
+    std::vector<std::optional<BigInt>> evaluate(const Module &module, std::span<const BigInt> inputs);
+
+    // Evaluates the module, giving up if the evaluation goes over the budget.
+    BoundedResult evaluate(const Module &module, BigInt input, const Budget &budget);
+};
+
+} // namespace unacpp
@@ -0,0 +1,154 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "bigint.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+namespace unacpp {
+
+namespace {
+
+using DoubleLimb = boost::multiprecision::double_limb_type;
+
+constexpr unsigned limbBits = sizeof(Limb) * CHAR_BIT;
+
+// Returns the bits that shifting the limb left by the given amount shifts out.
+Limb shiftedOut(Limb limb, unsigned shift) {
+    return shift == 0 ? 0 : limb >> (limbBits - shift);
+}
+
+// Returns the limb at the index of the number shifted left by the given
+// amount, which is less than the number of bits in a limb.
+Limb shiftedLimb(const Limb *limbs, size_t index, unsigned shift) {
+    auto limb = limbs[index] << shift;
+    if (index > 0) {
+        limb |= shiftedOut(limbs[index - 1], shift);
+    }
+    return limb;
+}
+
+// Divides the two limb number made of the remainder and the low limb by the
+// normalized divisor, returning the quotient and replacing the remainder with
+// the new remainder. The remainder must be less than the divisor.
+Limb divideTwoLimbs(Limb &remainder, Limb low, const WordDivisor &divisor) {
+    auto product = static_cast<DoubleLimb>(divisor.reciprocal) * remainder;
+    product += (static_cast<DoubleLimb>(remainder + 1) << limbBits) | low;
+
+    auto quotient = static_cast<Limb>(product >> limbBits);
+    auto fraction = static_cast<Limb>(product);
+
+    // The quotient estimate is at most one too large or one too small.
+    remainder = low - quotient * divisor.normalized;
+    if (remainder > fraction) {
+        quotient--;
+        remainder += divisor.normalized;
+    }
+    if (remainder >= divisor.normalized) {
+        quotient++;
+        remainder -= divisor.normalized;
+    }
+    return quotient;
+}
+
+} // anonymous namespace
+
+void addWord(BigInt &num, Limb word) {
+    num += word;
+}
+
+bool subtractWord(BigInt &num, Limb word) {
+    if (num < word) {
+        return false;
+    }
+    num -= word;
+    return true;
+}
+
+void multiplyWord(BigInt &num, Limb word) {
+    num *= word;
+}
+
+bool lowBitsEqual(const BigInt &num, uint64_t bits, Limb value) {
+    auto &backend = num.backend();
+    auto *limbs = backend.limbs();
+    auto size = backend.size();
+
+    // A value with bits above the low bits can never be equal to them.
+    if (bits < limbBits && (value >> bits) != 0) {
+        return false;
+    }
+
+    // The limbs past the end of the number are all zero, so the only limbs
+    // that need to be checked are the ones it has which hold the low bits.
+    auto wholeLimbs = bits / limbBits;
+    auto partialBits = static_cast<unsigned>(bits % limbBits);
+    for (size_t i = 0; i < std::min<uint64_t>(wholeLimbs, size); i++) {
+        if (limbs[i] != (i == 0 ? value : 0)) {
+            return false;
+        }
+    }
+
+    if (partialBits != 0 && wholeLimbs < size) {
+        auto mask = (Limb{1} << partialBits) - 1;
+        if ((limbs[wholeLimbs] & mask) != (wholeLimbs == 0 ? value : 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+WordDivisor makeWordDivisor(Limb divisor) {
+    WordDivisor result{};
+    result.shift = static_cast<unsigned>(std::countl_zero(divisor));
+    result.normalized = divisor << result.shift;
+
+    // (B^2 - 1) / normalized - B, where the top limb of the dividend is
+    // B - 1 - normalized rather than B - 1, which subtracts B from the
+    // quotient and keeps it in a single limb.
+    auto dividend = (static_cast<DoubleLimb>(~result.normalized) << limbBits) | ~Limb{0};
+    result.reciprocal = static_cast<Limb>(dividend / result.normalized);
+    return result;
+}
+
+Limb divideWord(BigInt &num, const WordDivisor &divisor) {
+    auto &backend = num.backend();
+    auto *limbs = backend.limbs();
+    auto size = backend.size();
+
+    // The number is divided as though it were shifted left by the same amount
+    // as the divisor, so the bits shifted out of the top limb start off the
+    // remainder. Each step then divides a two limb number whose top limb is
+    // less than the divisor, from the most significant limb down.
+    auto remainder = shiftedOut(limbs[size - 1], divisor.shift);
+    for (auto i = size; i-- > 0; ) {
+        auto low = shiftedLimb(limbs, i, divisor.shift);
+        limbs[i] = divideTwoLimbs(remainder, low, divisor);
+    }
+
+    backend.normalize();
+    return remainder >> divisor.shift;
+}
+
+Limb remainderWord(const BigInt &num, const WordDivisor &divisor) {
+    auto &backend = num.backend();
+    auto *limbs = backend.limbs();
+    auto size = backend.size();
+
+    auto remainder = shiftedOut(limbs[size - 1], divisor.shift);
+    for (auto i = size; i-- > 0; ) {
+        divideTwoLimbs(remainder, shiftedLimb(limbs, i, divisor.shift), divisor);
+    }
+
+    return remainder >> divisor.shift;
+}
+
+} // namespace unacpp
@@ -7,7 +7,14 @@
 //
 
 #include "bytecode.hpp"
+#include "serialize.hpp"
+#include "threadpool.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <sstream>
 
 namespace unacpp {
@@ -18,12 +25,33 @@ using FuncFailureMap = std::unordered_map<std::string, bool>;
 
 using ConstantMap = std::unordered_map<BigInt, uint16_t>;
 
+// Whether the constant can be given to the opcodes ending in IMM.
+bool fitsImmediate(const BigInt &val) {
+    return val <= std::numeric_limits<Limb>::max();
+}
+
+// Returns the power of two the constant is, if it's a power of two.
+std::optional<uint64_t> getPowerOfTwo(const BigInt &val) {
+    if (val == 0 || (val & (val - 1)) != 0) {
+        return std::nullopt;
+    }
+    return boost::multiprecision::msb(val);
+}
+
 struct ProgramReference {
     uint32_t byteIndex;
 
     std::string_view funcName;
 };
 
+// The address of a block, which is filled in once every block of the
+// function has been placed.
+struct BlockReference {
+    uint32_t byteIndex;
+
+    size_t blockIndex;
+};
+
 void replacePlaceholderAddress(std::vector<uint8_t> &bytecode, uint32_t replaceIndex, uint32_t address) {
     bytecode[replaceIndex + 0] = (address >> 24) & 0xFF;
     bytecode[replaceIndex + 1] = (address >> 16) & 0xFF;
@@ -31,20 +59,16 @@ void replacePlaceholderAddress(std::vector<uint8_t> &bytecode, uint32_t replaceI
     bytecode[replaceIndex + 3] = (address >>  0) & 0xFF;
 }
 
-bool funcCallCanFail(const ProgramMap &programs, const std::string &funcName, FuncFailureMap &funcsFail);
+// Returns whether the block has an instruction that can fail, using the given
+// function to tell whether each of its calls can.
+bool blockCanFail(const BasicBlock &block, const std::function<bool(const std::string &)> &callCanFail) {
+    if (block.hasFailingInstruction()) {
+        return true;
+    }
 
-bool branchCanFail(const ProgramMap &programs, const Branch &branch, std::unordered_map<std::string, bool> &funcsFail) {
-    for (auto &inst: branch.getInstructions()) {
-        if (std::holds_alternative<SubtractProgram>(inst) ||
-            std::holds_alternative<EqualProgram>(inst) ||
-            std::holds_alternative<ModEqualProgram>(inst) ||
-            (std::holds_alternative<DivideProgram>(inst) &&
-             std::get<DivideProgram>(inst).getRemainderBehavior() == DivideProgram::Remainder::Fail))
-        {
-            return true;
-        }
-        else if (auto func = std::get_if<FuncCall>(&inst); func) {
-            if (funcCallCanFail(programs, func->getFuncName(), funcsFail)) {
+    for (auto &inst: block.instructions) {
+        if (auto func = std::get_if<FuncCall>(&inst); func) {
+            if (callCanFail(func->getFuncName())) {
                 return true;
             }
         }
@@ -53,7 +77,31 @@ bool branchCanFail(const ProgramMap &programs, const Branch &branch, std::unorde
     return false;
 }
 
-bool funcCallCanFail(const ProgramMap &programs, const std::string &funcName, FuncFailureMap &funcsFail) {
+bool findCallCanFail(const IrModule &module, const std::string &funcName, FuncFailureMap &funcsFail);
+
+// Returns whether execution starting from the block can end up returning from
+// the function in a failed state.
+bool blockCanReturnFailure(const IrModule &module, const IrFunction &function, size_t blockIndex, FuncFailureMap &funcsFail) {
+    auto &block = function.blocks[blockIndex];
+    auto callCanFail = [&] (const std::string &funcName) {
+        return findCallCanFail(module, funcName, funcsFail);
+    };
+    if (blockCanFail(block, callCanFail)) {
+        if (!block.failure || blockCanReturnFailure(module, function, *block.failure, funcsFail)) {
+            return true;
+        }
+    }
+
+    return block.success && blockCanReturnFailure(module, function, *block.success, funcsFail);
+}
+
+// Works out whether a call to the function can fail, adding it and every
+// function it depends on to the map.
+bool findCallCanFail(const IrModule &module, const std::string &funcName, FuncFailureMap &funcsFail) {
+    if (auto external = module.findExternal(funcName); external) {
+        return external->canFail;
+    }
+
     auto funcIt = funcsFail.find(funcName);
     if (funcIt != funcsFail.end()) {
         return funcIt->second;
@@ -61,28 +109,66 @@ bool funcCallCanFail(const ProgramMap &programs, const std::string &funcName, Fu
 
     funcsFail[funcName] = true;
 
-    auto &program = programs.at(funcName);
-    for (auto &branch: program.getBranches()) {
-        if (!branchCanFail(programs, branch, funcsFail)) {
-            funcsFail[funcName] = false;
-            return false;
+    auto canFail = blockCanReturnFailure(module, *module.findFunction(funcName), 0, funcsFail);
+    funcsFail[funcName] = canFail;
+    return canFail;
+}
+
+// Looks up whether a call to the function can fail, once findCallCanFail has
+// added it to the map. The map is only read, so it can be shared by threads.
+bool funcCallCanFail(const IrModule &module, const std::string &funcName, const FuncFailureMap &funcsFail) {
+    if (auto external = module.findExternal(funcName); external) {
+        return external->canFail;
+    }
+
+    return funcsFail.at(funcName);
+}
+
+// Returns whether the branch starting at the block can fail to another block
+// of the function, rather than returning.
+bool branchCanFailToBlock(const IrModule &module, const IrFunction &function, size_t blockIndex, const FuncFailureMap &funcsFail) {
+    auto callCanFail = [&] (const std::string &funcName) {
+        return funcCallCanFail(module, funcName, funcsFail);
+    };
+    for (std::optional<size_t> index = blockIndex; index; index = function.blocks[*index].success) {
+        auto &block = function.blocks[*index];
+        if (block.failure && blockCanFail(block, callCanFail)) {
+            return true;
         }
     }
 
-    return true;
+    return false;
 }
 
-void generateBranch(
+// Returns whether the function may need to restore the value it was called
+// with, which is only the case if one of its blocks can fail to another.
+bool funcNeedsInput(const IrModule &module, const std::string &funcName, const FuncFailureMap &funcsFail) {
+    if (auto external = module.findExternal(funcName); external) {
+        return external->needsInput;
+    }
+
+    auto &function = *module.findFunction(funcName);
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        if (function.startsBranch(i) && branchCanFailToBlock(module, function, i, funcsFail)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void generateBlock(
     std::vector<uint8_t> &bytecode,
-    const ProgramMap &programs,
-    const Branch &branch,
+    const IrModule &module,
+    const BasicBlock &block,
     std::vector<ProgramReference> &unresolvedReferences,
-    FuncFailureMap funcsFail,
-    ConstantMap &constants,
-    bool lastBranch)
+    std::vector<BlockReference> &failureReferences,
+    std::vector<CallSite> &callSites,
+    const FuncFailureMap &funcsFail,
+    ConstantMap &constants)
 {
-    auto instructions = branch.getInstructions();
-    std::vector<uint32_t> nextBranchReferences;
+    auto &instructions = block.instructions;
+    bool lastBranch = !block.failure;
 
     auto addPlaceholderAddress = [&] {
         bytecode.insert(bytecode.end(), 4, 255);
@@ -104,19 +190,32 @@ void generateBranch(
         bytecode.push_back((index & 0x00FF) >> 0);
     };
 
+    auto addImmediate = [&] (const BigInt &val) {
+        auto immediate = static_cast<uint64_t>(val);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            bytecode.push_back((immediate >> shift) & 0xFF);
+        }
+    };
+
     for (size_t i = 0; i < instructions.size(); i++) {
         auto &inst = instructions[i];
         bool lastInst = (i == instructions.size() - 1);
 
+        // In blocks with a failure edge, instructions which can fail are
+        // fused with the jump to the block it leads to, and are followed by
+        // the address of that block.
+        auto addFailingOpCode = [&] (OpCode opcode, OpCode fusedOpcode) {
+            bytecode.push_back(lastBranch ? opcode : fusedOpcode);
+        };
+
         auto addFailureCheck = [&] {
             if (lastBranch) {
-                if (!lastInst) {
+                if (!lastInst || block.success) {
                     bytecode.push_back(OpCode::RetOnFailure);
                 }
             }
             else {
-                bytecode.push_back(OpCode::JumpOnFailure);
-                nextBranchReferences.push_back(static_cast<uint32_t>(bytecode.size()));
+                failureReferences.push_back({static_cast<uint32_t>(bytecode.size()), *block.failure});
                 addPlaceholderAddress();
             }
         };
@@ -125,23 +224,66 @@ void generateBranch(
             if (add->getAmount() == 1) {
                 bytecode.push_back(OpCode::Inc);
             }
+            else if (fitsImmediate(add->getAmount())) {
+                bytecode.push_back(OpCode::AddImmediate);
+                addImmediate(add->getAmount());
+            }
             else {
                 bytecode.push_back(OpCode::Add);
                 addValue(add->getAmount());
             }
         }
         else if (auto mult = std::get_if<MultiplyProgram>(&inst); mult) {
-            bytecode.push_back(OpCode::Mult);
-            addValue(mult->getAmount());
+            auto nextAdd = lastInst ? nullptr : std::get_if<AddProgram>(&instructions[i + 1]);
+            bool immediate = fitsImmediate(mult->getAmount()) && (!nextAdd || fitsImmediate(nextAdd->getAmount()));
+            auto power = getPowerOfTwo(mult->getAmount());
+            if (power && !nextAdd) {
+                bytecode.push_back(OpCode::ShiftLeft);
+                addImmediate(*power);
+            }
+            else if (nextAdd && immediate) {
+                bytecode.push_back(OpCode::MultAddImmediate);
+                addImmediate(mult->getAmount());
+                addImmediate(nextAdd->getAmount());
+                i++;
+            }
+            else if (nextAdd) {
+                bytecode.push_back(OpCode::MultAdd);
+                addValue(mult->getAmount());
+                addValue(nextAdd->getAmount());
+                i++;
+            }
+            else if (immediate) {
+                bytecode.push_back(OpCode::MultImmediate);
+                addImmediate(mult->getAmount());
+            }
+            else {
+                bytecode.push_back(OpCode::Mult);
+                addValue(mult->getAmount());
+            }
         }
         else if (auto div = std::get_if<DivideProgram>(&inst); div) {
-            if (div->getRemainderBehavior() == DivideProgram::Remainder::Floor) {
-                bytecode.push_back(OpCode::DivFloor);
-                addValue(div->getDivisor());
+            auto power = getPowerOfTwo(div->getDivisor());
+            bool floor = div->getRemainderBehavior() == DivideProgram::Remainder::Floor;
+            if (power) {
+                if (floor) {
+                    bytecode.push_back(OpCode::ShiftRightFloor);
+                }
+                else {
+                    addFailingOpCode(OpCode::ShiftRightExact, OpCode::ShiftRightExactJumpOnFailure);
+                }
+                addImmediate(*power);
             }
             else {
-                bytecode.push_back(OpCode::DivFail);
+                if (floor) {
+                    bytecode.push_back(OpCode::DivFloor);
+                }
+                else {
+                    addFailingOpCode(OpCode::DivFail, OpCode::DivFailJumpOnFailure);
+                }
                 addValue(div->getDivisor());
+            }
+            if (div->getRemainderBehavior() == DivideProgram::Remainder::Fail) {
                 addFailureCheck();
             }
         }
@@ -149,79 +291,155 @@ void generateBranch(
             bytecode.push_back(OpCode::Not);
         }
         else if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
-            bytecode.push_back(OpCode::Equal);
-            addValue(eq->getAmount());
+            if (fitsImmediate(eq->getAmount())) {
+                addFailingOpCode(OpCode::EqualImmediate, OpCode::EqualImmediateJumpOnFailure);
+                addImmediate(eq->getAmount());
+            }
+            else {
+                addFailingOpCode(OpCode::Equal, OpCode::EqualJumpOnFailure);
+                addValue(eq->getAmount());
+            }
             addFailureCheck();
         }
         else if (auto modEq = std::get_if<ModEqualProgram>(&inst); modEq) {
-            bytecode.push_back(OpCode::ModEqual);
-            addValue(modEq->getAmount());
-            addValue(modEq->getModulo());
+            auto power = getPowerOfTwo(modEq->getModulo());
+            if (power && fitsImmediate(modEq->getAmount())) {
+                addFailingOpCode(OpCode::TestLowBits, OpCode::TestLowBitsJumpOnFailure);
+                addImmediate(modEq->getAmount());
+                addImmediate(*power);
+            }
+            else {
+                addFailingOpCode(OpCode::ModEqual, OpCode::ModEqualJumpOnFailure);
+                addValue(modEq->getAmount());
+                addValue(modEq->getModulo());
+            }
             addFailureCheck();
         }
         else if (auto sub = std::get_if<SubtractProgram>(&inst); sub) {
             if (sub->getAmount() == 1) {
-                bytecode.push_back(OpCode::Dec);
+                addFailingOpCode(OpCode::Dec, OpCode::DecJumpOnFailure);
+            }
+            else if (fitsImmediate(sub->getAmount())) {
+                addFailingOpCode(OpCode::SubImmediate, OpCode::SubImmediateJumpOnFailure);
+                addImmediate(sub->getAmount());
             }
             else {
-                bytecode.push_back(OpCode::Sub);
+                addFailingOpCode(OpCode::Sub, OpCode::SubJumpOnFailure);
                 addValue(sub->getAmount());
             }
             addFailureCheck();
         }
+        else if (auto call = std::get_if<FuncCall>(&inst); call && module.findSpeculation(call->getFuncName())) {
+            auto split = module.findSpeculation(call->getFuncName());
+            bytecode.push_back(OpCode::SpeculativeCall);
+            unresolvedReferences.emplace_back(static_cast<uint32_t>(bytecode.size()), split->firstName);
+            addPlaceholderAddress();
+            unresolvedReferences.emplace_back(static_cast<uint32_t>(bytecode.size()), split->restName);
+            addPlaceholderAddress();
+
+            // Both the first branch and, when it's not speculated, the rest
+            // return to the caller from a call made here.
+            callSites.push_back({static_cast<uint32_t>(bytecode.size()), call->getPos()});
+            bytecode.push_back(OpCode::SpeculativeJoin);
+            callSites.push_back({static_cast<uint32_t>(bytecode.size()), call->getPos()});
+
+            if (funcCallCanFail(module, call->getFuncName(), funcsFail)) {
+                if (!lastBranch) {
+                    bytecode.push_back(OpCode::JumpOnFailure);
+                }
+                addFailureCheck();
+            }
+        }
         else if (auto call = std::get_if<FuncCall>(&inst); call) {
-            bool callCanFail = funcCallCanFail(programs, call->getFuncName(), funcsFail);
+            bool callCanFail = funcCallCanFail(module, call->getFuncName(), funcsFail);
+
+            // Functions that never restore the value they were called with
+            // don't need it saved in their stack frame.
+            bool save = funcNeedsInput(module, call->getFuncName(), funcsFail);
+            bool tailCall = lastInst && !block.success && (!callCanFail || lastBranch);
 
-            if (lastInst && (!callCanFail || lastBranch)) {
-                bytecode.push_back(OpCode::TailCall);
+            if (tailCall) {
+                bytecode.push_back(save ? OpCode::TailCall : OpCode::TailCallNoSave);
+            }
+            else if (callCanFail && save) {
+                addFailingOpCode(OpCode::Call, OpCode::CallJumpOnFailure);
+            }
+            else if (callCanFail) {
+                addFailingOpCode(OpCode::CallNoSave, OpCode::CallNoSaveJumpOnFailure);
             }
             else {
-                bytecode.push_back(OpCode::Call);
+                bytecode.push_back(save ? OpCode::Call : OpCode::CallNoSave);
             }
             unresolvedReferences.emplace_back(static_cast<uint32_t>(bytecode.size()), call->getFuncName());
             addPlaceholderAddress();
 
-            if (callCanFail) {
-                if (!lastBranch) {
-                    bytecode.push_back(OpCode::JumpOnFailure);
-                    nextBranchReferences.push_back(static_cast<uint32_t>(bytecode.size()));
-                    addPlaceholderAddress();
-                }
-                else if (!lastInst) {
-                    bytecode.push_back(OpCode::RetOnFailure);
-                }
+            // The fused opcodes are followed by the address to jump to when
+            // the call fails, which comes before where the call returns to.
+            if (callCanFail && !lastBranch) {
+                addFailureCheck();
+            }
+            if (!tailCall) {
+                callSites.push_back({static_cast<uint32_t>(bytecode.size()), call->getPos()});
+            }
+            if (callCanFail && lastBranch) {
+                addFailureCheck();
             }
         }
         else if (std::holds_alternative<DebugPrint>(inst)) {
             bytecode.push_back(OpCode::Print);
         }
+        else if (std::holds_alternative<DebugStackTrace>(inst)) {
+            bytecode.push_back(OpCode::PrintStack);
+        }
     }
 
-    bytecode.push_back(OpCode::Ret);
-
-    for (auto ref: nextBranchReferences) {
-        replacePlaceholderAddress(bytecode, ref, static_cast<uint32_t>(bytecode.size()));
+    // A block with a success edge falls through to the block after it.
+    if (!block.success) {
+        bytecode.push_back(OpCode::Ret);
     }
 }
 
-void generateProgram(
+FunctionInfo generateFunction(
     std::vector<uint8_t> &bytecode,
-    const ProgramMap &programs,
-    const Program &program,
+    const IrModule &module,
+    const IrFunction &function,
     std::vector<ProgramReference> &unresolvedReferences,
-    FuncFailureMap &funcsFail,
+    std::vector<CallSite> &callSites,
+    const FuncFailureMap &funcsFail,
     ConstantMap &constants)
 {
-    auto branches = program.getBranches();
+    FunctionInfo info{function.name, function.pos, {}};
+    std::vector<uint32_t> blockStarts;
+    std::vector<BlockReference> failureReferences;
+
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        auto start = static_cast<uint32_t>(bytecode.size());
+        blockStarts.push_back(start);
+
+        // Restoring the value when a block fails moves it out of the stack
+        // frame, so the branches after the first need to save it again if
+        // they can fail to another block too.
+        if (function.startsBranch(i)) {
+            info.branchStarts.push_back(start);
+            if (i > 0 && branchCanFailToBlock(module, function, i, funcsFail)) {
+                bytecode.push_back(OpCode::Save);
+            }
+        }
 
-    for (size_t i = 0; i < branches.size(); i++) {
-        generateBranch(bytecode, programs, branches[i], unresolvedReferences, funcsFail, constants, i + 1 == branches.size());
+        generateBlock(bytecode, module, function.blocks[i], unresolvedReferences, failureReferences, callSites, funcsFail, constants);
     }
+
+    for (auto [byteIndex, blockIndex]: failureReferences) {
+        replacePlaceholderAddress(bytecode, byteIndex, blockStarts[blockIndex]);
+    }
+
+    return info;
 }
 
 enum class ArgType {
     Constant,
     Address,
+    Immediate,
 };
 
 std::vector<ArgType> argumentType(OpCode opcode) {
@@ -235,60 +453,366 @@ std::vector<ArgType> argumentType(OpCode opcode) {
             return { ArgType::Constant };
 
         case OpCode::Call:
+        case OpCode::CallNoSave:
+        case OpCode::DecJumpOnFailure:
         case OpCode::JumpOnFailure:
         case OpCode::TailCall:
+        case OpCode::TailCallNoSave:
             return { ArgType::Address };
 
+        case OpCode::CallJumpOnFailure:
+        case OpCode::CallNoSaveJumpOnFailure:
+        case OpCode::SpeculativeCall:
+            return { ArgType::Address, ArgType::Address };
+
+        case OpCode::DivFailJumpOnFailure:
+        case OpCode::EqualJumpOnFailure:
+        case OpCode::SubJumpOnFailure:
+            return { ArgType::Constant, ArgType::Address };
+
         case OpCode::ModEqual:
+        case OpCode::MultAdd:
             return { ArgType::Constant, ArgType::Constant };
 
+        case OpCode::ModEqualJumpOnFailure:
+            return { ArgType::Constant, ArgType::Constant, ArgType::Address };
+
+        case OpCode::AddImmediate:
+        case OpCode::EqualImmediate:
+        case OpCode::MultImmediate:
+        case OpCode::ShiftLeft:
+        case OpCode::ShiftRightExact:
+        case OpCode::ShiftRightFloor:
+        case OpCode::SubImmediate:
+            return { ArgType::Immediate };
+
+        case OpCode::EqualImmediateJumpOnFailure:
+        case OpCode::ShiftRightExactJumpOnFailure:
+        case OpCode::SubImmediateJumpOnFailure:
+            return { ArgType::Immediate, ArgType::Address };
+
+        case OpCode::MultAddImmediate:
+        case OpCode::TestLowBits:
+            return { ArgType::Immediate, ArgType::Immediate };
+
+        case OpCode::TestLowBitsJumpOnFailure:
+            return { ArgType::Immediate, ArgType::Immediate, ArgType::Address };
+
         default:
             return {};
     }
 }
 
-std::string_view opcodeName(OpCode opcode) {
-    switch (opcode) {
-        case OpCode::Add:           return "ADD";
-        case OpCode::Call:          return "CALL";
-        case OpCode::Dec:           return "DEC";
-        case OpCode::DivFail:       return "DIV_FAIL";
-        case OpCode::DivFloor:      return "DIV_FLOOR";
-        case OpCode::Equal:         return "EQ";
-        case OpCode::Inc:           return "INC";
-        case OpCode::JumpOnFailure: return "FAIL_JMP";
-        case OpCode::ModEqual:      return "MOD_EQ";
-        case OpCode::Mult:          return "MULT";
-        case OpCode::Not:           return "NOT";
-        case OpCode::Print:         return "PRINT";
-        case OpCode::Ret:           return "RET";
-        case OpCode::RetOnFailure:  return "FAIL_RET";
-        case OpCode::Sub:           return "SUB";
-        case OpCode::TailCall:      return "TAIL_CALL";
-        default:                    return "ERROR";
+// Moves code which was placed at the offset, after being generated as though
+// it started at zero, by moving its addresses forward by the offset and
+// replacing its constant indices with the given ones.
+void relocateInstructions(std::vector<uint8_t> &instructions, uint32_t offset, std::span<const uint16_t> constantIndices) {
+    for (size_t i = offset; i < instructions.size(); i++) {
+        for (auto argType: argumentType(static_cast<OpCode>(instructions[i]))) {
+            if (argType == ArgType::Address) {
+                uint32_t address = 0;
+                for (size_t j = 1; j <= 4; j++) {
+                    address = (address << 8) | instructions[i + j];
+                }
+                replacePlaceholderAddress(instructions, static_cast<uint32_t>(i + 1), address + offset);
+                i += 4;
+            }
+            else if (argType == ArgType::Constant) {
+                auto index = constantIndices[(instructions[i + 1] << 8) | instructions[i + 2]];
+                instructions[i + 1] = (index & 0xFF00) >> 8;
+                instructions[i + 2] = (index & 0x00FF) >> 0;
+                i += 2;
+            }
+            else if (argType == ArgType::Immediate) {
+                i += 8;
+            }
+        }
+    }
+}
+
+// The code for a single function, generated as though it started at address
+// zero, with its own table of constants. This lets functions be generated in
+// parallel, and then placed one after another.
+struct FunctionCode {
+    std::vector<uint8_t> instructions;
+
+    std::vector<ProgramReference> programReferences;
+
+    std::vector<CallSite> callSites;
+
+    // The constants, in the order the function first uses them.
+    std::vector<BigInt> constants;
+
+    FunctionInfo info;
+};
+
+FunctionCode generateFunctionCode(const IrModule &module, const IrFunction &function, const FuncFailureMap &funcsFail) {
+    FunctionCode code;
+    ConstantMap constantsMap;
+    code.info = generateFunction(code.instructions, module, function, code.programReferences, code.callSites, funcsFail, constantsMap);
+
+    code.constants.resize(constantsMap.size());
+    for (auto &[constant, index]: constantsMap) {
+        code.constants[index] = constant;
+    }
+
+    return code;
+}
+
+constexpr uint8_t serializedMagic[] = { 'U', 'N', 'B', 'C' };
+
+uint64_t readImmediate(const std::vector<uint8_t> &instructions, size_t index) {
+    uint64_t immediate = 0;
+    for (size_t i = 0; i < 8; i++) {
+        immediate = (immediate << 8) | instructions[index + i];
+    }
+    return immediate;
+}
+
+std::vector<std::optional<WordDivisor>> getDivisors(const std::vector<BigInt> &constants) {
+    std::vector<std::optional<WordDivisor>> divisors;
+    for (auto &constant: constants) {
+        if (constant != 0 && fitsImmediate(constant)) {
+            divisors.push_back(makeWordDivisor(static_cast<Limb>(constant)));
+        }
+        else {
+            divisors.emplace_back();
+        }
+    }
+    return divisors;
+}
+
+// Returns how the function with the given name is shown to users.
+std::string getDisplayName(std::string_view name) {
+    if (auto separator = name.rfind(specializedSeparator); separator != std::string_view::npos) {
+        auto value = name.substr(separator + specializedSeparator.size());
+        return getDisplayName(name.substr(0, separator)) + "@" + std::string{value};
+    }
+    else if (!name.empty() && name.back() == ' ') {
+        return "<anonymous>";
+    }
+    else {
+        return std::string{name};
     }
 }
 
 } // anonymous namespace
 
-BytecodeModule generateBytecode(const ProgramMap &programs, const std::string &mainName) {
+uint64_t ModuleId::next() {
+    static std::atomic<uint64_t> nextId = 0;
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+ModuleId::ModuleId()
+    : id_(next())
+{}
+
+ModuleId::ModuleId(const ModuleId &)
+    : id_(next())
+{}
+
+ModuleId &ModuleId::operator=(const ModuleId &) {
+    id_ = next();
+    return *this;
+}
+
+uint64_t ModuleId::get() const {
+    return id_;
+}
+
+bool verifyBytecode(const BytecodeModule &bytecode) {
+    auto &instructions = bytecode.instructions;
+    auto &constants = bytecode.constants;
+
+    for (size_t i = 0; i < instructions.size(); i++) {
+        auto opcode = static_cast<OpCode>(instructions[i]);
+        if (opcodeName(opcode) == "ERROR") {
+            return false;
+        }
+
+        // The last constant of each of these is a divisor, which the
+        // interpreter assumes isn't zero.
+        bool dividesByConstant =
+            opcode == OpCode::DivFail ||
+            opcode == OpCode::DivFailJumpOnFailure ||
+            opcode == OpCode::DivFloor ||
+            opcode == OpCode::ModEqual ||
+            opcode == OpCode::ModEqualJumpOnFailure;
+        uint16_t lastConstant = 0;
+
+        // The last immediate of each of these is a number of bits to shift
+        // by, which is limited so that a corrupt module can't make the
+        // interpreter try to allocate an absurd amount of memory.
+        bool shiftsByImmediate =
+            opcode == OpCode::ShiftLeft ||
+            opcode == OpCode::ShiftRightExact ||
+            opcode == OpCode::ShiftRightExactJumpOnFailure ||
+            opcode == OpCode::ShiftRightFloor ||
+            opcode == OpCode::TestLowBits ||
+            opcode == OpCode::TestLowBitsJumpOnFailure;
+        uint64_t lastImmediate = 0;
+
+        for (auto argType: argumentType(opcode)) {
+            if (argType == ArgType::Address) {
+                if (instructions.size() - i <= 4) {
+                    return false;
+                }
+                uint32_t address = 0;
+                address |= instructions[++i] << 24;
+                address |= instructions[++i] << 16;
+                address |= instructions[++i] <<  8;
+                address |= instructions[++i] <<  0;
+                if (address >= instructions.size()) {
+                    return false;
+                }
+            }
+            else if (argType == ArgType::Constant) {
+                if (instructions.size() - i <= 2) {
+                    return false;
+                }
+                uint16_t index = 0;
+                index |= instructions[++i] << 8;
+                index |= instructions[++i] << 0;
+                if (index >= constants.size()) {
+                    return false;
+                }
+                lastConstant = index;
+            }
+            else if (argType == ArgType::Immediate) {
+                if (instructions.size() - i <= 8) {
+                    return false;
+                }
+                lastImmediate = readImmediate(instructions, i + 1);
+                i += 8;
+                if (lastImmediate > std::numeric_limits<Limb>::max()) {
+                    return false;
+                }
+            }
+        }
+
+        if (dividesByConstant && constants[lastConstant] == 0) {
+            return false;
+        }
+        if (shiftsByImmediate && lastImmediate > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+    }
+
+    if (instructions.empty() || bytecode.functions.empty()) {
+        return false;
+    }
+
+    // The branches of all the functions should partition the bytecode.
+    uint32_t prevStart = 0;
+    for (auto &function: bytecode.functions) {
+        for (auto start: function.branchStarts) {
+            if (start < prevStart || start >= instructions.size()) {
+                return false;
+            }
+            prevStart = start;
+        }
+        if (function.branchStarts.empty()) {
+            return false;
+        }
+    }
+
+    if (bytecode.functions[0].branchStarts[0] != 0 || bytecode.entryPoints.empty() || bytecode.entryPoints[0] != 0) {
+        return false;
+    }
+
+    // Each entry point must be the start of a function.
+    for (auto entryPoint: bytecode.entryPoints) {
+        auto &function = bytecode.functions[getFunctionIndex(bytecode, entryPoint)];
+        if (function.branchStarts[0] != entryPoint) {
+            return false;
+        }
+    }
+
+    // The call sites are binary searched, and each one must follow an
+    // instruction, so that the call can be looked up from it.
+    uint32_t prevReturn = 0;
+    for (auto &callSite: bytecode.callSites) {
+        if (callSite.returnAddress <= prevReturn || callSite.returnAddress > instructions.size()) {
+            return false;
+        }
+        prevReturn = callSite.returnAddress;
+    }
+
+    return true;
+}
+
+BytecodeModule generateBytecode(const IrModule &module, size_t threadCount) {
+    ParallelThreads threads{threadCount};
+    return generateBytecode(module, threads);
+}
+
+BytecodeModule generateBytecode(const IrModule &module, ParallelThreads &threads) {
+    std::vector<Relocation> relocations;
+    return generateBytecode(module, relocations, threads);
+}
+
+BytecodeModule generateBytecode(const IrModule &module, std::vector<Relocation> &relocations, ParallelThreads &threads) {
     std::vector<uint8_t> instructions;
     std::vector<ProgramReference> programReferences;
     std::unordered_map<std::string_view, uint32_t> programStarts;
-    FuncFailureMap funcsFail;
+    std::vector<FunctionInfo> functions;
+    std::vector<CallSite> callSites;
     ConstantMap constantsMap;
 
-    generateProgram(instructions, programs, programs.at(mainName), programReferences, funcsFail, constantsMap);
+    // Whether each function can fail is worked out before any code is
+    // generated, so that generating the functions in parallel only reads it.
+    FuncFailureMap funcsFail;
+    for (auto &function: module.getFunctions()) {
+        findCallCanFail(module, function.name, funcsFail);
+    }
+
+    auto irFunctions = module.getFunctions();
+    std::vector<FunctionCode> codes(irFunctions.size());
+    parallelFor(irFunctions.size(), minParallelFunctions, threads, [&] (size_t i) {
+        codes[i] = generateFunctionCode(module, irFunctions[i], funcsFail);
+    });
+
+    // The functions are placed in order, and their constants numbered in the
+    // order they're first used, so the result is the same however many
+    // threads generated them.
+    for (size_t i = 0; i < codes.size(); i++) {
+        auto &code = codes[i];
+        auto offset = static_cast<uint32_t>(instructions.size());
+        programStarts[irFunctions[i].name] = offset;
 
-    for (auto &[progName, program]: programs) {
-        if (mainName != progName) {
-            programStarts[progName] = static_cast<uint32_t>(instructions.size());
-            generateProgram(instructions, programs, program, programReferences, funcsFail, constantsMap);
+        std::vector<uint16_t> constantIndices;
+        for (auto &constant: code.constants) {
+            auto it = constantsMap.try_emplace(constant, static_cast<uint16_t>(constantsMap.size())).first;
+            constantIndices.push_back(it->second);
+        }
+
+        instructions.insert(instructions.end(), code.instructions.begin(), code.instructions.end());
+        relocateInstructions(instructions, offset, constantIndices);
+
+        for (auto &start: code.info.branchStarts) {
+            start += offset;
+        }
+        functions.push_back(std::move(code.info));
+
+        for (auto [byteIndex, funcName]: code.programReferences) {
+            programReferences.push_back({byteIndex + offset, funcName});
+        }
+        for (auto callSite: code.callSites) {
+            callSite.returnAddress += offset;
+            callSites.push_back(callSite);
         }
     }
 
+    // Calls to external functions are left pointing at the start of the
+    // module until they're linked, so that the module can still be verified.
     for (auto [index, funcName]: programReferences) {
-        replacePlaceholderAddress(instructions, index, programStarts.at(funcName));
+        if (auto it = programStarts.find(funcName); it != programStarts.end()) {
+            replacePlaceholderAddress(instructions, index, it->second);
+        }
+        else {
+            replacePlaceholderAddress(instructions, index, 0);
+            relocations.push_back({index, std::string{funcName}});
+        }
     }
 
     std::vector<BigInt> constants(constantsMap.size());
@@ -296,12 +820,130 @@ BytecodeModule generateBytecode(const ProgramMap &programs, const std::string &m
         constants[index] = constant;
     }
 
-    return { instructions, constants };
+    std::vector<uint32_t> entryPoints;
+    for (auto &name: module.getEntryNames()) {
+        entryPoints.push_back(programStarts.at(name));
+    }
+
+    auto divisors = getDivisors(constants);
+    return { instructions, constants, divisors, functions, entryPoints, callSites, {} };
+}
+
+CallSummary summarizeCall(const IrModule &module, const std::string &funcName) {
+    // Whether the function needs its input depends on whether the functions
+    // it calls can fail, so they're worked out first.
+    FuncFailureMap funcsFail;
+    bool canFail = findCallCanFail(module, funcName, funcsFail);
+    for (auto &block: module.findFunction(funcName)->blocks) {
+        for (auto &inst: block.instructions) {
+            if (auto call = std::get_if<FuncCall>(&inst); call) {
+                findCallCanFail(module, call->getFuncName(), funcsFail);
+            }
+        }
+    }
+    return {canFail, funcNeedsInput(module, funcName, funcsFail)};
+}
+
+std::optional<uint32_t> appendBytecode(BytecodeModule &module, const BytecodeModule &other) {
+    auto offset = static_cast<uint32_t>(module.instructions.size());
+
+    // Constants the modules share are only kept once.
+    ConstantMap constantsMap;
+    for (size_t i = 0; i < module.constants.size(); i++) {
+        constantsMap.emplace(module.constants[i], static_cast<uint16_t>(i));
+    }
+
+    std::vector<uint16_t> constantIndices;
+    for (size_t i = 0; i < other.constants.size(); i++) {
+        auto it = constantsMap.find(other.constants[i]);
+        if (it == constantsMap.end()) {
+            if (module.constants.size() > std::numeric_limits<uint16_t>::max()) {
+                return std::nullopt;
+            }
+            auto index = static_cast<uint16_t>(module.constants.size());
+            module.constants.push_back(other.constants[i]);
+            module.divisors.push_back(other.divisors[i]);
+            it = constantsMap.emplace(other.constants[i], index).first;
+        }
+        constantIndices.push_back(it->second);
+    }
+
+    auto &instructions = module.instructions;
+    instructions.insert(instructions.end(), other.instructions.begin(), other.instructions.end());
+    relocateInstructions(instructions, offset, constantIndices);
+
+    for (auto function: other.functions) {
+        for (auto &start: function.branchStarts) {
+            start += offset;
+        }
+        module.functions.push_back(std::move(function));
+    }
+
+    for (auto callSite: other.callSites) {
+        callSite.returnAddress += offset;
+        module.callSites.push_back(callSite);
+    }
+
+    return offset;
+}
+
+void resolveRelocation(BytecodeModule &module, uint32_t offset, const Relocation &relocation, uint32_t address) {
+    replacePlaceholderAddress(module.instructions, offset + relocation.byteIndex, address);
+}
+
+std::string_view opcodeName(OpCode opcode) {
+    switch (opcode) {
+        case OpCode::Add:                          return "ADD";
+        case OpCode::AddImmediate:                 return "ADD_IMM";
+        case OpCode::Call:                         return "CALL";
+        case OpCode::CallJumpOnFailure:            return "CALL_FAIL_JMP";
+        case OpCode::CallNoSave:                   return "CALL_NOSAVE";
+        case OpCode::CallNoSaveJumpOnFailure:      return "CALL_NOSAVE_FAIL_JMP";
+        case OpCode::Dec:                          return "DEC";
+        case OpCode::DecJumpOnFailure:             return "DEC_FAIL_JMP";
+        case OpCode::DivFail:                      return "DIV_FAIL";
+        case OpCode::DivFailJumpOnFailure:         return "DIV_FAIL_FAIL_JMP";
+        case OpCode::DivFloor:                     return "DIV_FLOOR";
+        case OpCode::Equal:                        return "EQ";
+        case OpCode::EqualJumpOnFailure:           return "EQ_FAIL_JMP";
+        case OpCode::EqualImmediate:               return "EQ_IMM";
+        case OpCode::EqualImmediateJumpOnFailure:  return "EQ_IMM_FAIL_JMP";
+        case OpCode::Inc:                          return "INC";
+        case OpCode::JumpOnFailure:                return "FAIL_JMP";
+        case OpCode::ModEqual:                     return "MOD_EQ";
+        case OpCode::ModEqualJumpOnFailure:        return "MOD_EQ_FAIL_JMP";
+        case OpCode::Mult:                         return "MULT";
+        case OpCode::MultImmediate:                return "MULT_IMM";
+        case OpCode::MultAdd:                      return "MULT_ADD";
+        case OpCode::MultAddImmediate:             return "MULT_ADD_IMM";
+        case OpCode::Not:                          return "NOT";
+        case OpCode::Print:                        return "PRINT";
+        case OpCode::PrintStack:                   return "PRINT_STACK";
+        case OpCode::Ret:                          return "RET";
+        case OpCode::RetOnFailure:                 return "FAIL_RET";
+        case OpCode::Save:                         return "SAVE";
+        case OpCode::ShiftLeft:                    return "SHL";
+        case OpCode::ShiftRightExact:              return "SHR_EXACT";
+        case OpCode::ShiftRightExactJumpOnFailure: return "SHR_EXACT_FAIL_JMP";
+        case OpCode::ShiftRightFloor:              return "SHR_FLOOR";
+        case OpCode::SpeculativeCall:              return "SPEC_CALL";
+        case OpCode::SpeculativeJoin:              return "SPEC_JOIN";
+        case OpCode::Sub:                          return "SUB";
+        case OpCode::SubJumpOnFailure:             return "SUB_FAIL_JMP";
+        case OpCode::SubImmediate:                 return "SUB_IMM";
+        case OpCode::SubImmediateJumpOnFailure:    return "SUB_IMM_FAIL_JMP";
+        case OpCode::TailCall:                     return "TAIL_CALL";
+        case OpCode::TailCallNoSave:               return "TAIL_CALL_NOSAVE";
+        case OpCode::TestLowBits:                  return "TEST_LOW_BITS";
+        case OpCode::TestLowBitsJumpOnFailure:     return "TEST_LOW_BITS_FAIL_JMP";
+        default:                                   return "ERROR";
+    }
 }
 
 std::string bytecodeToString(const BytecodeModule &bytecode) {
     std::stringstream stream;
-    auto &[instructions, constants] = bytecode;
+    auto &instructions = bytecode.instructions;
+    auto &constants = bytecode.constants;
 
     for (size_t i = 0; i < instructions.size(); i++) {
         stream << i << ": " << opcodeName(static_cast<OpCode>(instructions[i]));
@@ -323,6 +965,10 @@ std::string bytecodeToString(const BytecodeModule &bytecode) {
                 index |= instructions[++i] << 0;
                 stream << " " << constants[index];
             }
+            else if (argType == ArgType::Immediate) {
+                stream << " " << readImmediate(instructions, i + 1);
+                i += 8;
+            }
         }
 
         stream << '\n';
@@ -331,4 +977,170 @@ std::string bytecodeToString(const BytecodeModule &bytecode) {
     return stream.str();
 }
 
+size_t getFunctionIndex(const BytecodeModule &bytecode, uint32_t address) {
+    auto &functions = bytecode.functions;
+    auto func = std::upper_bound(functions.begin(), functions.end(), address, [] (uint32_t address, const FunctionInfo &func) {
+        return address < func.branchStarts[0];
+    });
+    return static_cast<size_t>(func - functions.begin()) - 1;
+}
+
+size_t getBranchIndex(const FunctionInfo &function, uint32_t address) {
+    auto &starts = function.branchStarts;
+    return static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), address) - starts.begin()) - 1;
+}
+
+std::string getDisplayName(const BytecodeModule &bytecode, size_t function) {
+    if (function == 0) {
+        return "<expression>";
+    }
+    return getDisplayName(bytecode.functions[function].name);
+}
+
+const CallSite *findCallSite(const BytecodeModule &bytecode, uint32_t returnAddress) {
+    auto &callSites = bytecode.callSites;
+    auto it = std::lower_bound(callSites.begin(), callSites.end(), returnAddress, [] (const CallSite &callSite, uint32_t address) {
+        return callSite.returnAddress < address;
+    });
+    if (it == callSites.end() || it->returnAddress != returnAddress) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+std::vector<uint8_t> serializeBytecode(const BytecodeModule &bytecode) {
+    auto &instructions = bytecode.instructions;
+    auto &constants = bytecode.constants;
+    std::vector<uint8_t> data{std::begin(serializedMagic), std::end(serializedMagic)};
+
+    writeUint32(data, bytecodeFormatVersion);
+
+    writeUint32(data, static_cast<uint32_t>(instructions.size()));
+    data.insert(data.end(), instructions.begin(), instructions.end());
+
+    writeUint32(data, static_cast<uint32_t>(constants.size()));
+    for (auto &constant: constants) {
+        writeBigInt(data, constant);
+    }
+
+    writeUint32(data, static_cast<uint32_t>(bytecode.functions.size()));
+    for (auto &function: bytecode.functions) {
+        writeString(data, function.name);
+        writeUint32(data, static_cast<uint32_t>(function.pos.line));
+        writeUint32(data, static_cast<uint32_t>(function.pos.col));
+        writeUint32(data, static_cast<uint32_t>(function.branchStarts.size()));
+        for (auto start: function.branchStarts) {
+            writeUint32(data, start);
+        }
+    }
+
+    writeUint32(data, static_cast<uint32_t>(bytecode.entryPoints.size()));
+    for (auto entryPoint: bytecode.entryPoints) {
+        writeUint32(data, entryPoint);
+    }
+
+    writeUint32(data, static_cast<uint32_t>(bytecode.callSites.size()));
+    for (auto &callSite: bytecode.callSites) {
+        writeUint32(data, callSite.returnAddress);
+        writeUint32(data, static_cast<uint32_t>(callSite.pos.line));
+        writeUint32(data, static_cast<uint32_t>(callSite.pos.col));
+    }
+
+    return data;
+}
+
+std::optional<BytecodeModule> deserializeBytecode(std::span<const uint8_t> data) {
+    ByteReader reader{data};
+
+    auto magic = reader.getBytes(sizeof(serializedMagic));
+    if (magic == std::nullopt || !std::equal(magic->begin(), magic->end(), std::begin(serializedMagic))) {
+        return std::nullopt;
+    }
+
+    if (reader.getUint32() != bytecodeFormatVersion) {
+        return std::nullopt;
+    }
+
+    BytecodeModule bytecode;
+
+    auto instructionCount = reader.getUint32();
+    if (instructionCount == std::nullopt) {
+        return std::nullopt;
+    }
+    auto instructions = reader.getBytes(*instructionCount);
+    if (instructions == std::nullopt) {
+        return std::nullopt;
+    }
+    bytecode.instructions.assign(instructions->begin(), instructions->end());
+
+    auto constantCount = reader.getUint32();
+    if (constantCount == std::nullopt) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *constantCount; i++) {
+        auto constant = reader.getBigInt();
+        if (constant == std::nullopt) {
+            return std::nullopt;
+        }
+        bytecode.constants.push_back(std::move(*constant));
+    }
+
+    auto functionCount = reader.getUint32();
+    if (functionCount == std::nullopt) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *functionCount; i++) {
+        auto name = reader.getString();
+        auto line = reader.getUint32();
+        auto col = reader.getUint32();
+        auto branchCount = reader.getUint32();
+        if (name == std::nullopt || line == std::nullopt || col == std::nullopt || branchCount == std::nullopt) {
+            return std::nullopt;
+        }
+
+        FunctionInfo function{std::move(*name), {*line, *col}, {}};
+        for (uint32_t j = 0; j < *branchCount; j++) {
+            auto start = reader.getUint32();
+            if (start == std::nullopt) {
+                return std::nullopt;
+            }
+            function.branchStarts.push_back(*start);
+        }
+        bytecode.functions.push_back(std::move(function));
+    }
+
+    auto entryPointCount = reader.getUint32();
+    if (entryPointCount == std::nullopt) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *entryPointCount; i++) {
+        auto entryPoint = reader.getUint32();
+        if (entryPoint == std::nullopt) {
+            return std::nullopt;
+        }
+        bytecode.entryPoints.push_back(*entryPoint);
+    }
+
+    auto callSiteCount = reader.getUint32();
+    if (callSiteCount == std::nullopt) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *callSiteCount; i++) {
+        auto returnAddress = reader.getUint32();
+        auto line = reader.getUint32();
+        auto col = reader.getUint32();
+        if (returnAddress == std::nullopt || line == std::nullopt || col == std::nullopt) {
+            return std::nullopt;
+        }
+        bytecode.callSites.push_back({*returnAddress, {*line, *col}});
+    }
+
+    if (!reader.atEnd() || !verifyBytecode(bytecode)) {
+        return std::nullopt;
+    }
+    bytecode.divisors = getDivisors(bytecode.constants);
+
+    return bytecode;
+}
+
 } // namespace unacpp
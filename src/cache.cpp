@@ -0,0 +1,243 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "cache.hpp"
+
+#include <boost/multiprecision/cpp_int.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <span>
+#include <sstream>
+#include <vector>
+
+namespace unacpp {
+
+namespace {
+
+constexpr std::string_view entryExtension = ".unbc";
+
+// 128-bit FNV-1a, which is plenty to make accidental collisions between
+// cached programs practically impossible.
+class Hasher {
+private:
+    using uint128 = boost::multiprecision::uint128_t;
+
+    static inline const uint128 prime = (uint128{1} << 88) + 0x13B;
+
+    uint128 hash_;
+
+public:
+    Hasher()
+        : hash_((uint128{0x6C62272E07BB0142} << 64) | 0x62B821756295C58D)
+    {}
+
+    void add(std::string_view data) {
+        for (unsigned char c: data) {
+            hash_ ^= c;
+            hash_ *= prime;
+        }
+    }
+
+    // Adds the data prefixed with its length, so that the boundaries between
+    // the hashed fields are unambiguous.
+    void addField(std::string_view data) {
+        add(std::to_string(data.size()));
+        add(":");
+        add(data);
+    }
+
+    std::string getDigest() const {
+        std::stringstream stream;
+        stream << std::hex << std::setw(32) << std::setfill('0') << hash_;
+        return stream.str();
+    }
+};
+
+std::string getChecksum(std::span<const uint8_t> data) {
+    Hasher hasher;
+    hasher.add({reinterpret_cast<const char *>(data.data()), data.size()});
+    return hasher.getDigest();
+}
+
+} // anonymous namespace
+
+BytecodeCache::BytecodeCache(std::filesystem::path directory, uintmax_t maxSize)
+    : directory_(std::move(directory))
+    , maxSize_(maxSize)
+{}
+
+std::optional<std::filesystem::path> BytecodeCache::getDefaultDirectory() {
+    if (auto cacheHome = std::getenv("XDG_CACHE_HOME"); cacheHome && *cacheHome) {
+        return std::filesystem::path{cacheHome} / "unarian";
+    }
+    if (auto home = std::getenv("HOME"); home && *home) {
+        return std::filesystem::path{home} / ".cache" / "unarian";
+    }
+    return std::nullopt;
+}
+
+std::string BytecodeCache::getKey(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    bool debugMode,
+    const OptimizerOptions &options,
+    std::span<const std::vector<uint8_t>> libraries)
+{
+    Hasher hasher;
+    hasher.addField(UNACPP_VERSION);
+    hasher.addField(std::to_string(bytecodeFormatVersion));
+    hasher.addField(fileContent);
+    hasher.addField(std::to_string(exprs.size()));
+    for (auto &expr: exprs) {
+        hasher.addField(expr);
+    }
+    hasher.addField(debugMode ? "debug" : "release");
+    hasher.addField(options.toString());
+    hasher.addField(std::to_string(options.speculate.size()));
+    for (auto &name: options.speculate) {
+        hasher.addField(name);
+    }
+    hasher.addField(std::to_string(libraries.size()));
+    for (auto &library: libraries) {
+        hasher.addField({reinterpret_cast<const char *>(library.data()), library.size()});
+    }
+    return hasher.getDigest();
+}
+
+std::filesystem::path BytecodeCache::getEntryPath(const std::string &key) const {
+    return directory_ / (key + std::string{entryExtension});
+}
+
+std::optional<BytecodeModule> BytecodeCache::load(const std::string &key) const {
+    auto path = getEntryPath(key);
+
+    std::ifstream file{path, std::ios::binary};
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+
+    // Each entry is the serialized module followed by a checksum of it, so
+    // that a corrupted entry is treated the same as a missing one.
+    auto checksumSize = getChecksum({}).size();
+    if (data.size() < checksumSize) {
+        return std::nullopt;
+    }
+    auto payload = std::span{data}.first(data.size() - checksumSize);
+    auto checksum = std::span{data}.last(checksumSize);
+    auto expected = getChecksum(payload);
+    if (!std::equal(checksum.begin(), checksum.end(), expected.begin())) {
+        return std::nullopt;
+    }
+
+    auto bytecode = deserializeBytecode(payload);
+    if (bytecode != std::nullopt) {
+        // Touch the entry, so that the least recently used entries are the
+        // ones removed when the cache grows too large.
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    }
+
+    return bytecode;
+}
+
+void BytecodeCache::store(const std::string &key, const BytecodeModule &bytecode) const {
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    if (error) {
+        return;
+    }
+
+    auto data = serializeBytecode(bytecode);
+    auto checksum = getChecksum(data);
+    data.insert(data.end(), checksum.begin(), checksum.end());
+
+    // Write to a uniquely named temporary file first and then rename it over
+    // the entry, so that concurrent runs never observe a partially written
+    // entry.
+    std::random_device random;
+    auto tempPath = directory_ / (key + ".tmp" + std::to_string(random()));
+
+    {
+        std::ofstream file{tempPath, std::ios::binary};
+        if (!file.is_open()) {
+            return;
+        }
+        file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tempPath, error);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tempPath, getEntryPath(key), error);
+    if (error) {
+        std::filesystem::remove(tempPath, error);
+        return;
+    }
+
+    removeOldEntries();
+}
+
+void BytecodeCache::removeOldEntries() const {
+    struct Entry {
+        std::filesystem::path path;
+
+        std::filesystem::file_time_type lastUse;
+
+        uintmax_t size;
+    };
+
+    std::vector<Entry> entries;
+    uintmax_t totalSize = 0;
+    std::error_code error;
+
+    for (auto &dirEntry: std::filesystem::directory_iterator{directory_, error}) {
+        if (dirEntry.path().extension() != entryExtension) {
+            continue;
+        }
+
+        auto size = dirEntry.file_size(error);
+        if (error) {
+            continue;
+        }
+        auto lastUse = dirEntry.last_write_time(error);
+        if (error) {
+            continue;
+        }
+
+        entries.emplace_back(dirEntry.path(), lastUse, size);
+        totalSize += size;
+    }
+
+    if (totalSize <= maxSize_) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [] (const Entry &a, const Entry &b) {
+        return a.lastUse < b.lastUse;
+    });
+
+    for (auto &entry: entries) {
+        if (totalSize <= maxSize_) {
+            break;
+        }
+        if (std::filesystem::remove(entry.path, error)) {
+            totalSize -= entry.size;
+        }
+    }
+}
+
+} // namespace unacpp
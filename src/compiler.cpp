@@ -0,0 +1,69 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "compiler.hpp"
+#include "threadpool.hpp"
+
+namespace unacpp {
+
+CompileBytecodeResult compileBytecode(
+    std::string_view fileContent,
+    std::string_view expr,
+    bool debugMode,
+    const OptimizerOptions &options)
+{
+    Parser parser{fileContent, expr, debugMode};
+    auto fileParseResult = parser.getParseResult();
+    if (std::holds_alternative<ParseErrors>(fileParseResult)) {
+        return std::get<ParseErrors>(fileParseResult);
+    }
+
+    auto &programs = std::get<ProgramMap>(fileParseResult);
+    auto &programName = parser.getExpressionName();
+    // The passes and the generator share threads, which are only started if
+    // one of them has enough functions to be worth it.
+    ParallelThreads threads{options.threads};
+    auto module = optimizePrograms(programs, programName, parser.getConstantPool(), options, nullptr, &threads);
+
+    return generateBytecode(module, threads);
+}
+
+CompileBytecodeResult compileBytecode(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    bool debugMode,
+    const OptimizerOptions &options,
+    CompileStats *stats)
+{
+    auto tokens = timePhase(stats, "tokenize", [&] {
+        return getTokens(fileContent);
+    });
+    auto parser = timePhase(stats, "parse", [&] {
+        return Parser{std::move(tokens), exprs, debugMode};
+    });
+    auto fileParseResult = parser.getParseResult();
+    if (std::holds_alternative<ParseErrors>(fileParseResult)) {
+        return std::get<ParseErrors>(fileParseResult);
+    }
+
+    auto &programs = std::get<ProgramMap>(fileParseResult);
+    auto &programNames = parser.getExpressionNames();
+    ParallelThreads threads{options.threads};
+    auto module = optimizePrograms(programs, programNames, parser.getConstantPool(), options, stats, &threads);
+
+    auto bytecode = timePhase(stats, "generate", [&] {
+        return generateBytecode(module, threads);
+    });
+    if (stats != nullptr) {
+        stats->setBytecode(bytecode);
+    }
+
+    return bytecode;
+}
+
+} // namespace unacpp
@@ -0,0 +1,165 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "compilestats.hpp"
+#include "bytecode.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace unacpp {
+
+namespace {
+
+// The combined runs of a pass, over every round.
+struct PassTotal {
+    std::string_view name;
+
+    size_t runs = 0;
+
+    CompileStats::Clock::duration time{};
+
+    size_t functionsChanged = 0;
+};
+
+double toMillis(CompileStats::Clock::duration time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+}
+
+// Returns the totals for each pass, in the order the passes first ran.
+std::vector<PassTotal> getPassTotals(const std::vector<CompileStats::PassRun> &passes) {
+    std::vector<PassTotal> totals;
+    for (auto &run: passes) {
+        auto it = std::find_if(totals.begin(), totals.end(), [&] (const PassTotal &total) {
+            return total.name == run.name;
+        });
+        if (it == totals.end()) {
+            it = totals.insert(totals.end(), PassTotal{run.name});
+        }
+        it->runs++;
+        it->time += run.time;
+        it->functionsChanged += run.functionsChanged;
+    }
+    return totals;
+}
+
+} // anonymous namespace
+
+void CompileStats::addPhase(std::string_view name, Clock::duration time) {
+    phases_.push_back({std::string{name}, time});
+}
+
+void CompileStats::addPass(PassRun run) {
+    passes_.push_back(std::move(run));
+}
+
+void CompileStats::setBytecode(const BytecodeModule &bytecode) {
+    bytecodeSize_ = bytecode.instructions.size();
+    constantCount_ = bytecode.constants.size();
+    functionCount_ = bytecode.functions.size();
+}
+
+const std::vector<CompileStats::Phase> &CompileStats::getPhases() const {
+    return phases_;
+}
+
+const std::vector<CompileStats::PassRun> &CompileStats::getPasses() const {
+    return passes_;
+}
+
+std::string CompileStats::getReport() const {
+    std::stringstream stream;
+    stream << std::fixed << std::setprecision(3);
+
+    stream << std::left << std::setw(16) << "Phase" << std::right << std::setw(12) << "Time ms" << '\n';
+    for (auto &phase: phases_) {
+        stream << std::left << std::setw(16) << phase.name << std::right << std::setw(12) << toMillis(phase.time) << '\n';
+    }
+
+    stream << '\n'
+           << std::left << std::setw(16) << "Pass" << std::right
+           << std::setw(8) << "Round"
+           << std::setw(12) << "Time ms"
+           << std::setw(20) << "Functions"
+           << std::setw(20) << "Instructions"
+           << std::setw(10) << "Changed" << '\n';
+    for (auto &run: passes_) {
+        auto functions = std::to_string(run.functionsBefore) + " -> " + std::to_string(run.functionsAfter);
+        auto instructions = std::to_string(run.instructionsBefore) + " -> " + std::to_string(run.instructionsAfter);
+        stream << std::left << std::setw(16) << run.name << std::right
+               << std::setw(8) << run.round
+               << std::setw(12) << toMillis(run.time)
+               << std::setw(20) << functions
+               << std::setw(20) << instructions
+               << std::setw(10) << run.functionsChanged << '\n';
+    }
+
+    stream << '\n'
+           << std::left << std::setw(16) << "Pass total" << std::right
+           << std::setw(8) << "Runs"
+           << std::setw(12) << "Time ms"
+           << std::setw(10) << "Changed" << '\n';
+    for (auto &total: getPassTotals(passes_)) {
+        stream << std::left << std::setw(16) << total.name << std::right
+               << std::setw(8) << total.runs
+               << std::setw(12) << toMillis(total.time)
+               << std::setw(10) << total.functionsChanged << '\n';
+    }
+
+    stream << '\n' << "Bytecode: " << bytecodeSize_ << " bytes, " << constantCount_ << " constants, "
+           << functionCount_ << " functions\n";
+
+    return stream.str();
+}
+
+std::string CompileStats::getJson() const {
+    std::stringstream stream;
+    stream << std::setprecision(6);
+
+    // Every name is one of the compiler's own, so none need escaping.
+    stream << "{\n  \"phases\": [";
+    for (size_t i = 0; i < phases_.size(); i++) {
+        stream << (i == 0 ? "\n" : ",\n")
+               << "    {\"name\": \"" << phases_[i].name << "\", \"ms\": " << toMillis(phases_[i].time) << "}";
+    }
+
+    stream << "\n  ],\n  \"passes\": [";
+    for (size_t i = 0; i < passes_.size(); i++) {
+        auto &run = passes_[i];
+        stream << (i == 0 ? "\n" : ",\n")
+               << "    {\"name\": \"" << run.name << "\""
+               << ", \"round\": " << run.round
+               << ", \"ms\": " << toMillis(run.time)
+               << ", \"functions_before\": " << run.functionsBefore
+               << ", \"functions_after\": " << run.functionsAfter
+               << ", \"instructions_before\": " << run.instructionsBefore
+               << ", \"instructions_after\": " << run.instructionsAfter
+               << ", \"functions_changed\": " << run.functionsChanged << "}";
+    }
+
+    auto totals = getPassTotals(passes_);
+    stream << "\n  ],\n  \"pass_totals\": [";
+    for (size_t i = 0; i < totals.size(); i++) {
+        stream << (i == 0 ? "\n" : ",\n")
+               << "    {\"name\": \"" << totals[i].name << "\""
+               << ", \"runs\": " << totals[i].runs
+               << ", \"ms\": " << toMillis(totals[i].time)
+               << ", \"functions_changed\": " << totals[i].functionsChanged << "}";
+    }
+
+    stream << "\n  ],\n"
+           << "  \"bytecode_bytes\": " << bytecodeSize_ << ",\n"
+           << "  \"constants\": " << constantCount_ << ",\n"
+           << "  \"functions\": " << functionCount_ << "\n"
+           << "}\n";
+
+    return stream.str();
+}
+
+} // namespace unacpp
@@ -0,0 +1,110 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "evaluator.hpp"
+
+#include <iostream>
+
+namespace unacpp {
+
+ReferenceEvaluator::ReferenceEvaluator(const ProgramMap &programs, uint64_t maxSteps, size_t maxDepth)
+    : programs_(programs)
+    , maxSteps_(maxSteps)
+    , maxDepth_(maxDepth)
+    , stepsLeft_(maxSteps)
+    , depthLeft_(maxDepth)
+    , limitExceeded_(false)
+{
+}
+
+std::optional<BigInt> ReferenceEvaluator::evaluateProgram(const Program &program, const BigInt &input) {
+    if (depthLeft_ == 0) {
+        limitExceeded_ = true;
+        return std::nullopt;
+    }
+
+    depthLeft_--;
+    std::optional<BigInt> result;
+    for (auto &branch: program.getBranches()) {
+        result = evaluateBranch(branch, input);
+        if (result != std::nullopt || limitExceeded_) {
+            break;
+        }
+    }
+    depthLeft_++;
+
+    return result;
+}
+
+std::optional<BigInt> ReferenceEvaluator::evaluateBranch(const Branch &branch, BigInt val) {
+    for (auto &inst: branch.getInstructions()) {
+        if (stepsLeft_ == 0) {
+            limitExceeded_ = true;
+            return std::nullopt;
+        }
+        stepsLeft_--;
+
+        if (auto add = std::get_if<AddProgram>(&inst); add) {
+            val += add->getAmount();
+        }
+        else if (std::holds_alternative<DebugPrint>(inst)) {
+            std::cout << val << '\n';
+        }
+        else if (auto div = std::get_if<DivideProgram>(&inst); div) {
+            if (div->getRemainderBehavior() == DivideProgram::Remainder::Fail && val % div->getDivisor() != 0) {
+                return std::nullopt;
+            }
+            val /= div->getDivisor();
+        }
+        else if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
+            if (val != eq->getAmount()) {
+                return std::nullopt;
+            }
+        }
+        else if (auto call = std::get_if<FuncCall>(&inst); call) {
+            auto result = evaluateProgram(programs_.at(call->getFuncName()), val);
+            if (result == std::nullopt) {
+                return std::nullopt;
+            }
+            val = std::move(*result);
+        }
+        else if (auto modEq = std::get_if<ModEqualProgram>(&inst); modEq) {
+            if (val % modEq->getModulo() != modEq->getAmount()) {
+                return std::nullopt;
+            }
+        }
+        else if (auto mul = std::get_if<MultiplyProgram>(&inst); mul) {
+            val *= mul->getAmount();
+        }
+        else if (std::holds_alternative<NotProgram>(inst)) {
+            val = val == 0 ? 1 : 0;
+        }
+        else if (auto sub = std::get_if<SubtractProgram>(&inst); sub) {
+            if (val < sub->getAmount()) {
+                return std::nullopt;
+            }
+            val -= sub->getAmount();
+        }
+    }
+
+    return val;
+}
+
+ReferenceResult ReferenceEvaluator::evaluate(const std::string &programName, BigInt input) {
+    stepsLeft_ = maxSteps_;
+    depthLeft_ = maxDepth_;
+    limitExceeded_ = false;
+
+    auto result = evaluateProgram(programs_.at(programName), input);
+    if (limitExceeded_) {
+        return LimitExceeded{};
+    }
+    return result;
+}
+
+} // namespace unacpp
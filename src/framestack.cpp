@@ -0,0 +1,171 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "framestack.hpp"
+
+namespace unacpp {
+
+FrameStack::FrameRun::FrameRun(uint32_t instIndex, uint32_t failIndex, bool saved)
+    : instIndex(instIndex)
+    , failIndex(failIndex)
+    , count(1)
+    , saved(saved)
+{}
+
+size_t FrameStack::getRunMemory(const FrameRun &run) {
+    if (!run.saved) {
+        return 0;
+    }
+
+    auto memory = getLimbBytes(run.val);
+    if (run.count > 1) {
+        memory += getLimbBytes(run.delta);
+    }
+    return memory;
+}
+
+FrameStack::FrameRun &FrameStack::pushRun(uint32_t instIndex, uint32_t failIndex, bool saved) {
+    if (runCount_ < runs_.size()) {
+        auto &run = runs_[runCount_];
+        run.instIndex = instIndex;
+        run.failIndex = failIndex;
+        run.count = 1;
+        run.saved = saved;
+    }
+    else {
+        runs_.emplace_back(instIndex, failIndex, saved);
+    }
+    return runs_[runCount_++];
+}
+
+FrameStack::FrameRun &FrameStack::splitTop() {
+    auto index = runCount_ - 1;
+    if (runs_[index].count == 1) {
+        return runs_[index];
+    }
+
+    memory_ -= getRunMemory(runs_[index]);
+    auto &run = pushRun(runs_[index].instIndex, runs_[index].failIndex, runs_[index].saved);
+    auto &below = runs_[index];
+    below.count--;
+    if (below.saved) {
+        run.val.swap(below.val);
+        below.val = run.val;
+        below.val -= below.delta;
+    }
+    memory_ += getRunMemory(below) + getRunMemory(run);
+    return run;
+}
+
+void FrameStack::clear() {
+    runCount_ = 0;
+    frameCount_ = 0;
+    memory_ = 0;
+}
+
+void FrameStack::push(const BigInt &val, uint32_t instIndex, uint32_t failIndex) {
+    frameCount_++;
+
+    if (runCount_ > 0) {
+        auto &top = runs_[runCount_ - 1];
+        if (top.saved && top.instIndex == instIndex && top.failIndex == failIndex) {
+            if (top.count == 1) {
+                // Any two frames make a run, which the frames after them
+                // can only join if they keep the same difference.
+                memory_ -= getRunMemory(top);
+                top.delta = val - top.val;
+                top.val = val;
+                top.count = 2;
+                memory_ += getRunMemory(top);
+                return;
+            }
+
+            scratch_ = top.val + top.delta;
+            if (scratch_ == val) {
+                memory_ -= getRunMemory(top);
+                top.val.swap(scratch_);
+                top.count++;
+                memory_ += getRunMemory(top);
+                return;
+            }
+        }
+    }
+
+    auto &run = pushRun(instIndex, failIndex, true);
+    run.val = val;
+    memory_ += getRunMemory(run);
+}
+
+void FrameStack::push(uint32_t instIndex, uint32_t failIndex) {
+    frameCount_++;
+
+    if (runCount_ > 0) {
+        auto &top = runs_[runCount_ - 1];
+        if (!top.saved && top.instIndex == instIndex && top.failIndex == failIndex) {
+            top.count++;
+            return;
+        }
+    }
+
+    pushRun(instIndex, failIndex, false);
+}
+
+FrameReturn FrameStack::pop() {
+    frameCount_--;
+
+    auto &top = runs_[runCount_ - 1];
+    FrameReturn frameReturn{top.instIndex, top.failIndex};
+    memory_ -= getRunMemory(top);
+
+    if (top.count == 1) {
+        runCount_--;
+    }
+    else {
+        top.count--;
+        if (top.saved) {
+            top.val -= top.delta;
+        }
+        memory_ += getRunMemory(top);
+    }
+
+    return frameReturn;
+}
+
+void FrameStack::swapTop(BigInt &val) {
+    auto &top = splitTop();
+    memory_ -= getRunMemory(top);
+    top.val.swap(val);
+    top.saved = true;
+    memory_ += getRunMemory(top);
+}
+
+void FrameStack::setTop(const BigInt &val) {
+    auto &top = splitTop();
+    memory_ -= getRunMemory(top);
+    top.val = val;
+    top.saved = true;
+    memory_ += getRunMemory(top);
+}
+
+size_t FrameStack::size() const {
+    return frameCount_;
+}
+
+size_t FrameStack::runCount() const {
+    return runCount_;
+}
+
+ReturnRun FrameStack::getRun(size_t index) const {
+    return {runs_[index].instIndex, runs_[index].count};
+}
+
+size_t FrameStack::memoryUsage() const {
+    return memory_;
+}
+
+} // namespace unacpp
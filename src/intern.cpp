@@ -0,0 +1,21 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "intern.hpp"
+
+namespace unacpp {
+
+const BigInt &ConstantPool::internConstant(BigInt value) {
+    return constants_.intern(std::move(value));
+}
+
+const std::string &ConstantPool::internName(std::string_view name) {
+    return names_.intern(std::string{name});
+}
+
+} // namespace unacpp
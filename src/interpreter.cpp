@@ -8,37 +8,27 @@
 
 #include "interpreter.hpp"
 #include "bytecode.hpp"
+#include "profiler.hpp"
+#include "threadpool.hpp"
 
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <numeric>
+#include <span>
+#include <sstream>
 
 namespace unacpp {
 
 namespace {
 
-struct StackFrame {
-    StackFrame(BigInt val, uint32_t instIndex);
-
-    BigInt val;
-
-    uint32_t instIndex;
-};
-
-StackFrame::StackFrame(BigInt val, uint32_t instIndex)
-    : val(std::move(val))
-    , instIndex(instIndex)
-{}
+// The failure address of frames which weren't pushed by CALL_FAIL_JMP.
+constexpr uint32_t noFailureTarget = UINT32_MAX;
 
 void add(BigInt &num, const BigInt &addend) {
     num += addend;
 }
 
-bool divide(BigInt &num, const BigInt &divisor) {
-    BigInt rem = num % divisor;
-    BigInt result = num / divisor;
-    num = result;
-    return rem == 0;
-}
-
 void multiply(BigInt &num, const BigInt &factor) {
     num *= factor;
 }
@@ -51,23 +41,740 @@ bool subtract(BigInt &num, const BigInt &subtrahend) {
     return true;
 }
 
+// How many times a loop has to run before it's traced.
+constexpr uint32_t traceThreshold = 64;
+
+// The most instructions a single trace may have.
+constexpr size_t maxTraceLength = 64;
+
+// How many loops are tracked for each module. Later loops are just run from
+// the bytecode.
+constexpr size_t maxTracedLoops = 16;
+
+// The most lines printed for a stack trace, after which the number of frames
+// left is printed instead, since a trace of deep recursion can have millions.
+constexpr size_t maxStackTraceLines = 32;
+
+uint64_t readBytes(std::span<const uint8_t> bytecode, uint32_t &index, int count) {
+    uint64_t value = 0;
+    for (int i = 0; i < count; i++) {
+        value = (value << 8) | bytecode[index++];
+    }
+    return value;
+}
+
+bool isJumpOnFailure(OpCode opcode) {
+    switch (opcode) {
+        case OpCode::DecJumpOnFailure:
+        case OpCode::DivFailJumpOnFailure:
+        case OpCode::EqualJumpOnFailure:
+        case OpCode::EqualImmediateJumpOnFailure:
+        case OpCode::ModEqualJumpOnFailure:
+        case OpCode::ShiftRightExactJumpOnFailure:
+        case OpCode::SubJumpOnFailure:
+        case OpCode::SubImmediateJumpOnFailure:
+        case OpCode::TestLowBitsJumpOnFailure:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool canFail(OpCode opcode) {
+    switch (opcode) {
+        case OpCode::Dec:
+        case OpCode::DivFail:
+        case OpCode::Equal:
+        case OpCode::EqualImmediate:
+        case OpCode::ModEqual:
+        case OpCode::ShiftRightExact:
+        case OpCode::Sub:
+        case OpCode::SubImmediate:
+        case OpCode::TestLowBits:
+            return true;
+
+        default:
+            return isJumpOnFailure(opcode);
+    }
+}
+
+// Returns whether the instruction only checks the value, without changing it.
+bool onlyChecksValue(OpCode opcode) {
+    switch (opcode) {
+        case OpCode::Equal:
+        case OpCode::EqualJumpOnFailure:
+        case OpCode::EqualImmediate:
+        case OpCode::EqualImmediateJumpOnFailure:
+        case OpCode::ModEqual:
+        case OpCode::ModEqualJumpOnFailure:
+        case OpCode::Save:
+        case OpCode::TestLowBits:
+        case OpCode::TestLowBitsJumpOnFailure:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Returns whether the input to each iteration only has to be saved once the
+// trace is left. Every instruction which can fail has to come before the
+// value is changed, and mustn't change it when it fails, so that the value is
+// still the input when the trace is left.
+bool canDeferSave(const Trace &trace) {
+    bool changed = false;
+    for (auto &op: trace.ops) {
+        // The value to save has to go in the loop's frame, rather than the
+        // frame of a function it calls.
+        if (op.failed || op.opcode == OpCode::Call || op.opcode == OpCode::CallNoSave ||
+            op.opcode == OpCode::CallJumpOnFailure || op.opcode == OpCode::CallNoSaveJumpOnFailure)
+        {
+            return false;
+        }
+        if (canFail(op.opcode)) {
+            bool changesOnFailure = op.opcode == OpCode::DivFail || op.opcode == OpCode::DivFailJumpOnFailure;
+            if (changed || changesOnFailure) {
+                return false;
+            }
+        }
+        changed = changed || !onlyChecksValue(op.opcode);
+    }
+    return true;
+}
+
 } // anonymous namespace
 
-std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt initialVal) {
-    auto &[bytecode, constants] = bytecodeModule;
-    std::vector<StackFrame> frames = { { initialVal, 0 } };
-    std::optional<BigInt> val = initialVal;
-    uint32_t instIndex = 0;
+std::string OpcodeStats::getReport() const {
+    std::stringstream stream;
+    auto total = std::accumulate(counts.begin(), counts.end(), uint64_t{0});
+
+    auto printCounts = [&] (const std::vector<uint64_t> &countsToPrint, auto getName) {
+        std::vector<size_t> order(countsToPrint.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+            return countsToPrint[a] > countsToPrint[b];
+        });
+
+        for (auto index: order) {
+            if (countsToPrint[index] == 0) {
+                break;
+            }
+            auto percent = 100.0 * static_cast<double>(countsToPrint[index]) / static_cast<double>(total);
+            stream << std::left << std::setw(32) << getName(index) << std::right
+                   << std::setw(16) << countsToPrint[index]
+                   << std::setw(9) << std::fixed << std::setprecision(2) << percent << "%\n";
+        }
+    };
+
+    stream << "Opcodes:\n";
+    printCounts(counts, [] (size_t op) {
+        return std::string{opcodeName(static_cast<OpCode>(op))};
+    });
+
+    stream << "\nOpcode pairs:\n";
+    printCounts(pairCounts, [] (size_t pair) {
+        return std::string{opcodeName(static_cast<OpCode>(pair / 256))} + " " +
+               std::string{opcodeName(static_cast<OpCode>(pair % 256))};
+    });
+
+    return stream.str();
+}
+
+SpeculativeResult::SpeculativeResult(BigInt input)
+    : input_(std::move(input))
+{}
+
+const BigInt &SpeculativeResult::getInput() const {
+    return input_;
+}
+
+void SpeculativeResult::cancel() {
+    cancelled_.store(true, std::memory_order_relaxed);
+}
+
+const std::atomic<bool> &SpeculativeResult::getCancelled() const {
+    return cancelled_;
+}
+
+void SpeculativeResult::finish(std::optional<BigInt> result, bool abandoned) {
+    {
+        std::lock_guard lock{mutex_};
+        result_ = std::move(result);
+        abandoned_ = abandoned;
+        finished_ = true;
+    }
+    finishedCondition_.notify_one();
+}
+
+bool SpeculativeResult::wait() {
+    std::unique_lock lock{mutex_};
+    finishedCondition_.wait(lock, [this] { return finished_; });
+    return !abandoned_;
+}
+
+std::optional<BigInt> SpeculativeResult::takeResult() {
+    return std::move(result_);
+}
+
+Interpreter::Interpreter()
+    : opcodeStats_(nullptr)
+    , exceededAddress_(0)
+    , speculationPool_(nullptr)
+    , cancelled_(nullptr)
+    , abandoned_(false)
+{}
+
+void Interpreter::setOpcodeStats(OpcodeStats *stats) {
+    opcodeStats_ = stats;
+}
+
+void Interpreter::setSpeculationPool(ThreadPool *pool) {
+    speculationPool_ = pool;
+}
+
+bool Interpreter::divide(BigInt &num, const BigInt &divisor, const std::optional<WordDivisor> &wordDivisor) {
+    if (wordDivisor) {
+        return divideWord(num, *wordDivisor) == 0;
+    }
+    boost::multiprecision::divide_qr(num, divisor, quotient_, remainder_);
+    num.swap(quotient_);
+    return remainder_ == 0;
+}
+
+bool Interpreter::modEquals(const BigInt &num, const BigInt &modulo, const std::optional<WordDivisor> &wordModulo, const BigInt &cmp) {
+    if (wordModulo) {
+        return cmp == remainderWord(num, *wordModulo);
+    }
+    remainder_ = num % modulo;
+    return remainder_ == cmp;
+}
+
+bool Interpreter::runTraceOp(const TraceOp &op, BigInt &val) {
+    switch (op.opcode) {
+        case OpCode::Add:
+            add(val, *op.constants[0]);
+            return true;
+
+        case OpCode::AddImmediate:
+            addWord(val, op.immediates[0]);
+            return true;
+
+        case OpCode::Dec:
+        case OpCode::DecJumpOnFailure:
+            return subtract(val, 1);
+
+        case OpCode::DivFail:
+        case OpCode::DivFailJumpOnFailure:
+            return divide(val, *op.constants[0], *op.divisor);
+
+        case OpCode::DivFloor:
+            divide(val, *op.constants[0], *op.divisor);
+            return true;
+
+        case OpCode::Equal:
+        case OpCode::EqualJumpOnFailure:
+            return val == *op.constants[0];
+
+        case OpCode::EqualImmediate:
+        case OpCode::EqualImmediateJumpOnFailure:
+            return val == op.immediates[0];
+
+        case OpCode::Inc:
+            add(val, 1);
+            return true;
+
+        case OpCode::ModEqual:
+        case OpCode::ModEqualJumpOnFailure:
+            return modEquals(val, *op.constants[1], *op.divisor, *op.constants[0]);
+
+        case OpCode::Mult:
+            multiply(val, *op.constants[0]);
+            return true;
+
+        case OpCode::MultImmediate:
+            multiplyWord(val, op.immediates[0]);
+            return true;
+
+        case OpCode::MultAdd:
+            multiply(val, *op.constants[0]);
+            add(val, *op.constants[1]);
+            return true;
+
+        case OpCode::MultAddImmediate:
+            multiplyWord(val, op.immediates[0]);
+            addWord(val, op.immediates[1]);
+            return true;
+
+        case OpCode::Not:
+            val = val == 0 ? 1 : 0;
+            return true;
+
+        case OpCode::ShiftLeft:
+            val <<= op.immediates[0];
+            return true;
+
+        case OpCode::ShiftRightExact:
+        case OpCode::ShiftRightExactJumpOnFailure:
+            if (!lowBitsEqual(val, op.immediates[0], 0)) {
+                return false;
+            }
+            val >>= op.immediates[0];
+            return true;
+
+        case OpCode::ShiftRightFloor:
+            val >>= op.immediates[0];
+            return true;
+
+        case OpCode::Sub:
+        case OpCode::SubJumpOnFailure:
+            return subtract(val, *op.constants[0]);
+
+        case OpCode::SubImmediate:
+        case OpCode::SubImmediateJumpOnFailure:
+            return subtractWord(val, op.immediates[0]);
+
+        case OpCode::TestLowBits:
+        case OpCode::TestLowBitsJumpOnFailure:
+            return lowBitsEqual(val, op.immediates[1], op.immediates[0]);
+
+        default:
+            return true;
+    }
+}
+
+std::optional<Trace> Interpreter::recordTrace(const BytecodeModule &bytecodeModule, uint32_t header, const BigInt &initialVal) {
+    auto &bytecode = bytecodeModule.instructions;
+    auto &constants = bytecodeModule.constants;
+    auto &divisors = bytecodeModule.divisors;
+
+    // The iteration is run on copies, since the interpreter runs it again
+    // once it's been recorded. The calls made in the iteration are followed
+    // into, keeping the input and the return address of each of them.
+    BigInt val = initialVal;
+    std::vector<BigInt> inputs{initialVal};
+    std::vector<uint32_t> returnAddresses;
+    uint32_t instIndex = header;
+    Trace trace;
+
+    auto readConstant = [&] (TraceOp &op, int arg) {
+        auto index = readBytes(bytecode, instIndex, 2);
+        op.constants[arg] = &constants[index];
+        op.divisor = &divisors[index];
+    };
+
+    while (trace.ops.size() < maxTraceLength) {
+        TraceOp op;
+        op.opcode = static_cast<OpCode>(bytecode[instIndex++]);
+
+        switch (op.opcode) {
+            case OpCode::Add:
+            case OpCode::DivFail:
+            case OpCode::DivFloor:
+            case OpCode::Equal:
+            case OpCode::Mult:
+            case OpCode::Sub:
+                readConstant(op, 0);
+                break;
+
+            case OpCode::DivFailJumpOnFailure:
+            case OpCode::EqualJumpOnFailure:
+            case OpCode::SubJumpOnFailure:
+                readConstant(op, 0);
+                op.failTarget = readBytes(bytecode, instIndex, 4);
+                break;
+
+            case OpCode::ModEqual:
+            case OpCode::MultAdd:
+                readConstant(op, 0);
+                readConstant(op, 1);
+                break;
+
+            case OpCode::ModEqualJumpOnFailure:
+                readConstant(op, 0);
+                readConstant(op, 1);
+                op.failTarget = readBytes(bytecode, instIndex, 4);
+                break;
+
+            case OpCode::AddImmediate:
+            case OpCode::EqualImmediate:
+            case OpCode::MultImmediate:
+            case OpCode::ShiftLeft:
+            case OpCode::ShiftRightExact:
+            case OpCode::ShiftRightFloor:
+            case OpCode::SubImmediate:
+                op.immediates[0] = readBytes(bytecode, instIndex, 8);
+                break;
+
+            case OpCode::EqualImmediateJumpOnFailure:
+            case OpCode::ShiftRightExactJumpOnFailure:
+            case OpCode::SubImmediateJumpOnFailure:
+                op.immediates[0] = readBytes(bytecode, instIndex, 8);
+                op.failTarget = readBytes(bytecode, instIndex, 4);
+                break;
+
+            case OpCode::MultAddImmediate:
+            case OpCode::TestLowBits:
+                op.immediates[0] = readBytes(bytecode, instIndex, 8);
+                op.immediates[1] = readBytes(bytecode, instIndex, 8);
+                break;
+
+            case OpCode::TestLowBitsJumpOnFailure:
+                op.immediates[0] = readBytes(bytecode, instIndex, 8);
+                op.immediates[1] = readBytes(bytecode, instIndex, 8);
+                op.failTarget = readBytes(bytecode, instIndex, 4);
+                break;
+
+            case OpCode::DecJumpOnFailure:
+                op.failTarget = readBytes(bytecode, instIndex, 4);
+                break;
+
+            case OpCode::Dec:
+            case OpCode::Inc:
+            case OpCode::Not:
+            case OpCode::RetOnFailure:
+            case OpCode::Save:
+                break;
+
+            case OpCode::JumpOnFailure:
+                instIndex += 4;
+                break;
+
+            case OpCode::Call:
+            case OpCode::CallNoSave:
+            case OpCode::CallJumpOnFailure:
+            case OpCode::CallNoSaveJumpOnFailure: {
+                auto address = readBytes(bytecode, instIndex, 4);
+                bool jumpOnFailure = op.opcode == OpCode::CallJumpOnFailure || op.opcode == OpCode::CallNoSaveJumpOnFailure;
+                op.failTarget = jumpOnFailure ? readBytes(bytecode, instIndex, 4) : noFailureTarget;
+                op.next = instIndex;
+                inputs.push_back(val);
+                returnAddresses.push_back(instIndex);
+                instIndex = address;
+                trace.ops.push_back(op);
+                continue;
+            }
+
+            case OpCode::Ret:
+                // Returning from the function itself ends the loop.
+                if (returnAddresses.empty()) {
+                    return std::nullopt;
+                }
+                instIndex = returnAddresses.back();
+                returnAddresses.pop_back();
+                inputs.pop_back();
+                trace.ops.push_back(op);
+                continue;
+
+            case OpCode::TailCall:
+            case OpCode::TailCallNoSave: {
+                auto address = readBytes(bytecode, instIndex, 4);
+                if (!returnAddresses.empty()) {
+                    if (op.opcode == OpCode::TailCall) {
+                        inputs.back() = val;
+                    }
+                    instIndex = address;
+                    trace.ops.push_back(op);
+                    continue;
+                }
+                if (address != header) {
+                    return std::nullopt;
+                }
+                trace.saveInput = op.opcode == OpCode::TailCall;
+                trace.deferSave = trace.saveInput && canDeferSave(trace);
+                return trace;
+            }
+
+            default:
+                return std::nullopt;
+        }
+        op.next = instIndex;
+
+        // The value is never in a failed state in the trace, since it's left
+        // as soon as a failing instruction doesn't jump to the next branch, so
+        // these do nothing.
+        if (op.opcode == OpCode::JumpOnFailure || op.opcode == OpCode::RetOnFailure) {
+            continue;
+        }
+
+        if (op.opcode == OpCode::Save) {
+            inputs.back() = val;
+        }
+        else if (!runTraceOp(op, val)) {
+            if (!isJumpOnFailure(op.opcode)) {
+                return std::nullopt;
+            }
+            op.failed = true;
+            val = inputs.back();
+            instIndex = op.failTarget;
+        }
+        trace.ops.push_back(op);
+    }
+
+    return std::nullopt;
+}
+
+uint32_t Interpreter::runTrace(const Trace &trace, std::optional<BigInt> &val) {
+    while (true) {
+        for (auto &op: trace.ops) {
+            switch (op.opcode) {
+                case OpCode::Save:
+                    if (!trace.deferSave) {
+                        frames_.setTop(*val);
+                    }
+                    continue;
+
+                case OpCode::Call:
+                case OpCode::CallJumpOnFailure:
+                    frames_.push(*val, op.next, op.failTarget);
+                    continue;
+
+                case OpCode::CallNoSave:
+                case OpCode::CallNoSaveJumpOnFailure:
+                    frames_.push(op.next, op.failTarget);
+                    continue;
+
+                case OpCode::Ret:
+                    frames_.pop();
+                    continue;
+
+                case OpCode::TailCall:
+                    frames_.setTop(*val);
+                    continue;
+
+                case OpCode::TailCallNoSave:
+                    continue;
+
+                default:
+                    break;
+            }
+
+            bool succeeded = runTraceOp(op, *val);
+            if (succeeded != op.failed) {
+                if (op.failed) {
+                    frames_.swapTop(*val);
+                }
+                continue;
+            }
+
+            // The iteration went a different way to the one recorded, so the
+            // rest of it is run from the bytecode.
+            if (trace.deferSave) {
+                frames_.setTop(*val);
+            }
+            if (succeeded) {
+                return op.next;
+            }
+            if (isJumpOnFailure(op.opcode)) {
+                frames_.swapTop(*val);
+                return op.failTarget;
+            }
+            val = std::nullopt;
+            return op.next;
+        }
+
+        if (trace.saveInput && !trace.deferSave) {
+            frames_.setTop(*val);
+        }
+    }
+}
+
+uint32_t Interpreter::enterLoop(const BytecodeModule &bytecode, uint32_t header, std::optional<BigInt> &val) {
+    auto loop = std::find_if(loops_.begin(), loops_.end(), [&] (const TracedLoop &tracedLoop) {
+        return tracedLoop.header == header;
+    });
+    if (loop == loops_.end()) {
+        if (loops_.size() < maxTracedLoops) {
+            loops_.push_back({header, 0, false, std::nullopt});
+        }
+        return header;
+    }
+
+    if (!loop->trace) {
+        if (loop->rejected || ++loop->count < traceThreshold) {
+            return header;
+        }
+        loop->trace = recordTrace(bytecode, header, *val);
+        if (!loop->trace) {
+            loop->rejected = true;
+            return header;
+        }
+    }
+
+    return runTrace(*loop->trace, val);
+}
+
+std::string Interpreter::formatStackTrace(const BytecodeModule &bytecode, uint32_t address) const {
+    std::ostringstream stream;
+    size_t lines = 0;
+    size_t hiddenFrames = 0;
+
+    // Each line shows the function and branch a frame is in, along with where
+    // it was defined for the top frame, or the call it's making for the rest.
+    auto addLine = [&] (uint32_t location, const CallSite *callSite, size_t count) {
+        if (lines == maxStackTraceLines) {
+            hiddenFrames += count;
+            return;
+        }
+        lines++;
+
+        auto function = getFunctionIndex(bytecode, location);
+        auto &info = bytecode.functions[function];
+        stream << "  " << getDisplayName(bytecode, function);
+        if (info.branchStarts.size() > 1) {
+            stream << ", branch " << getBranchIndex(info, location) + 1;
+        }
+        if (callSite) {
+            stream << ", call at " << callSite->pos.line << ':' << callSite->pos.col;
+        }
+        else if (function != 0 && info.pos.line != 0) {
+            stream << ", defined at " << info.pos.line << ':' << info.pos.col;
+        }
+        if (count > 1) {
+            stream << ", " << count << " times";
+        }
+        stream << '\n';
+    };
+
+    // The top frame is left out when it's the built in ? function itself,
+    // which is only called when it hasn't been inlined.
+    auto &top = bytecode.functions[getFunctionIndex(bytecode, address)];
+    if (top.name != "?" || top.pos.line != 0) {
+        addLine(address, nullptr, 1);
+    }
+
+    // Frames which return to the same place are shown on one line. The bottom
+    // frame is the one the evaluation started with, which has no caller.
+    std::optional<uint32_t> returnAddress;
+    size_t count = 0;
+    for (size_t i = frames_.runCount(); i-- > 0; ) {
+        auto run = frames_.getRun(i);
+        auto runCount = i == 0 ? run.count - 1 : run.count;
+        if (runCount == 0) {
+            continue;
+        }
+        if (returnAddress != run.instIndex) {
+            if (returnAddress) {
+                addLine(*returnAddress - 1, findCallSite(bytecode, *returnAddress), count);
+            }
+            returnAddress = run.instIndex;
+            count = 0;
+        }
+        count += runCount;
+    }
+    if (returnAddress) {
+        addLine(*returnAddress - 1, findCallSite(bytecode, *returnAddress), count);
+    }
+
+    if (hiddenFrames > 0) {
+        stream << "  ... " << hiddenFrames << " more frames\n";
+    }
+    return stream.str();
+}
+
+template <bool Profiling, bool Budgeted>
+std::optional<BigInt> Interpreter::run(
+    const BytecodeModule &bytecodeModule,
+    BigInt initialVal,
+    uint32_t address,
+    Profiler *profiler,
+    [[maybe_unused]] const Budget *budget)
+{
+    auto &bytecode = bytecodeModule.instructions;
+    auto &constants = bytecodeModule.constants;
+    auto &divisors = bytecodeModule.divisors;
+    std::optional<BigInt> val = std::move(initialVal);
+    uint32_t instIndex = address;
+    [[maybe_unused]] uint32_t opIndex = 0;
+#ifdef UNACPP_OPCODE_STATS
+    std::optional<uint8_t> prevOpcode;
+#endif
+
+    // Loops are only run from traces when nothing needs to see each of their
+    // instructions.
+    constexpr bool tracing = !Profiling && !Budgeted;
+
+    // When running with a budget, every instruction is counted, but they're
+    // only checked against the budget on calls, along with the depth and
+    // memory. Every loop has to go through a call, so this is enough to stop
+    // any evaluation.
+    [[maybe_unused]] uint64_t instructionCount = 0;
+
+    exceededLimit_ = std::nullopt;
+    if (loopsModuleId_ != bytecodeModule.id.get()) {
+        loops_.clear();
+        loopsModuleId_ = bytecodeModule.id.get();
+    }
+    frames_.clear();
+    frames_.push(*val, 0, noFailureTarget);
+
+    // However the evaluation ends, none of its speculations may still be
+    // reading the module once it has returned.
+    struct SpeculationGuard {
+        Interpreter &interpreter;
+
+        ~SpeculationGuard() {
+            interpreter.stopSpeculations();
+        }
+    } speculationGuard{*this};
+
+    if constexpr (Profiling) {
+        profiler->startEvaluation(instIndex);
+    }
+
+    auto withinBudget = [&] {
+        // A speculative evaluation stops as soon as its result isn't needed.
+        if (cancelled_ != nullptr && cancelled_->load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        if (instructionCount > budget->maxInstructions) {
+            exceededLimit_ = BudgetLimit::Instructions;
+        }
+        else if (frames_.size() > budget->maxDepth) {
+            exceededLimit_ = BudgetLimit::Depth;
+        }
+        else if (frames_.memoryUsage() + getLimbBytes(*val) > budget->maxMemory) {
+            exceededLimit_ = BudgetLimit::Memory;
+        }
+        else {
+            return true;
+        }
+
+        exceededAddress_ = instIndex;
+        if constexpr (Profiling) {
+            profiler->finishEvaluation();
+        }
+        return false;
+    };
+
+    if constexpr (Budgeted) {
+        if (!withinBudget()) {
+            return std::nullopt;
+        }
+    }
 
     auto getByte = [&] {
         return bytecode[instIndex++];
     };
 
-    auto getValue = [&] () -> const BigInt & {
+    auto getConstantIndex = [&] {
         uint16_t index = 0;
         index |= getByte() << 8;
         index |= getByte() << 0;
-        return constants[index];
+        return index;
+    };
+
+    auto getValue = [&] () -> const BigInt & {
+        return constants[getConstantIndex()];
+    };
+
+    auto getImmediate = [&] {
+        uint64_t immediate = 0;
+        for (int i = 0; i < 8; i++) {
+            immediate = (immediate << 8) | getByte();
+        }
+        return static_cast<Limb>(immediate);
     };
 
     auto getAddress = [&] {
@@ -79,16 +786,126 @@ std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt ini
         return address;
     };
 
+    // Restores the value the current function was called with. The value is
+    // swapped out of the frame rather than copied, so a branch which may need
+    // it again after this starts with a SAVE.
+    auto restoreInput = [&] {
+        if (val == std::nullopt) {
+            val.emplace();
+        }
+        frames_.swapTop(*val);
+    };
+
+    // Pushes a frame for a call, saving the current value in it if the
+    // function being called might need to restore it.
+    auto callFunction = [&] (uint32_t address, uint32_t failInst, bool saveInput) {
+        if (saveInput) {
+            frames_.push(*val, instIndex, failInst);
+        }
+        else {
+            frames_.push(instIndex, failInst);
+        }
+        instIndex = address;
+        if constexpr (Profiling) {
+            profiler->callFunction(address);
+        }
+        if constexpr (Budgeted) {
+            return withinBudget();
+        }
+        else {
+            return true;
+        }
+    };
+
+    // Used by the fused instructions when they fail, to restore the value the
+    // function was called with and continue from the next branch.
+    auto jumpToNextBranch = [&] (uint32_t address) {
+        restoreInput();
+        instIndex = address;
+        if constexpr (Profiling) {
+            profiler->branchFailed(opIndex);
+        }
+    };
+
+    // Pops the current frame, and continues from where it was called. If the
+    // call was a CALL_FAIL_JMP and the function failed, then the caller
+    // continues from its next branch instead.
+    auto returnToCaller = [&] {
+        auto frame = frames_.pop();
+        instIndex = frame.instIndex;
+
+        if (val == std::nullopt && frame.failIndex != noFailureTarget) {
+            restoreInput();
+            instIndex = frame.failIndex;
+            if constexpr (Profiling) {
+                // The address before the next branch is in the branch that
+                // made the call.
+                profiler->branchFailed(frame.failIndex - 1);
+            }
+        }
+    };
+
     while (true) {
+        if constexpr (Profiling) {
+            profiler->countInstruction();
+            opIndex = instIndex;
+        }
+
+        if constexpr (Budgeted) {
+            instructionCount++;
+        }
+
+#ifdef UNACPP_OPCODE_STATS
+        if (opcodeStats_) {
+            auto opcode = bytecode[instIndex];
+            opcodeStats_->counts[opcode]++;
+            if (prevOpcode) {
+                opcodeStats_->pairCounts[*prevOpcode * 256 + opcode]++;
+            }
+            prevOpcode = opcode;
+        }
+#endif
+
         switch (getByte()) {
         case OpCode::Add:
             add(*val, getValue());
             break;
 
+        case OpCode::AddImmediate:
+            addWord(*val, getImmediate());
+            break;
+
         case OpCode::Call: {
             auto newInst = getAddress();
-            frames.emplace_back(*val, instIndex);
-            instIndex = newInst;
+            if (!callFunction(newInst, noFailureTarget, true)) {
+                return std::nullopt;
+            }
+            break;
+        }
+
+        case OpCode::CallJumpOnFailure: {
+            auto newInst = getAddress();
+            auto failInst = getAddress();
+            if (!callFunction(newInst, failInst, true)) {
+                return std::nullopt;
+            }
+            break;
+        }
+
+        case OpCode::CallNoSave: {
+            auto newInst = getAddress();
+            if (!callFunction(newInst, noFailureTarget, false)) {
+                return std::nullopt;
+            }
+            break;
+        }
+
+        case OpCode::CallNoSaveJumpOnFailure: {
+            auto newInst = getAddress();
+            auto failInst = getAddress();
+            if (!callFunction(newInst, failInst, false)) {
+                return std::nullopt;
+            }
             break;
         }
 
@@ -98,15 +915,36 @@ std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt ini
             }
             break;
 
-        case OpCode::DivFail:
-            if (!divide(*val, getValue())) {
+        case OpCode::DecJumpOnFailure: {
+            auto failInst = getAddress();
+            if (!subtract(*val, 1)) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
+
+        case OpCode::DivFail: {
+            auto divisor = getConstantIndex();
+            if (!divide(*val, constants[divisor], divisors[divisor])) {
                 val = std::nullopt;
             }
             break;
+        }
+
+        case OpCode::DivFailJumpOnFailure: {
+            auto divisor = getConstantIndex();
+            auto failInst = getAddress();
+            if (!divide(*val, constants[divisor], divisors[divisor])) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
 
-        case OpCode::DivFloor:
-            divide(*val, getValue());
+        case OpCode::DivFloor: {
+            auto divisor = getConstantIndex();
+            divide(*val, constants[divisor], divisors[divisor]);
             break;
+        }
 
         case OpCode::Equal:
             if (*val != getValue()) {
@@ -114,6 +952,30 @@ std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt ini
             }
             break;
 
+        case OpCode::EqualJumpOnFailure: {
+            auto &cmp = getValue();
+            auto failInst = getAddress();
+            if (*val != cmp) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
+
+        case OpCode::EqualImmediate:
+            if (*val != getImmediate()) {
+                val = std::nullopt;
+            }
+            break;
+
+        case OpCode::EqualImmediateJumpOnFailure: {
+            auto cmp = getImmediate();
+            auto failInst = getAddress();
+            if (*val != cmp) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
+
         case OpCode::Inc:
             add(*val, 1);
             break;
@@ -122,25 +984,58 @@ std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt ini
             auto jumpIndex = getAddress();
 
             if (val == std::nullopt) {
-                val = frames.back().val;
+                restoreInput();
                 instIndex = jumpIndex;
+                if constexpr (Profiling) {
+                    profiler->branchFailed(opIndex);
+                }
             }
             break;
         }
 
         case OpCode::ModEqual: {
-            auto cmp = getValue();
-            auto modulo = getValue();
-            if (*val % modulo != cmp) {
+            auto &cmp = getValue();
+            auto modulo = getConstantIndex();
+            if (!modEquals(*val, constants[modulo], divisors[modulo], cmp)) {
                 val = std::nullopt;
             }
             break;
         }
 
+        case OpCode::ModEqualJumpOnFailure: {
+            auto &cmp = getValue();
+            auto modulo = getConstantIndex();
+            auto failInst = getAddress();
+            if (!modEquals(*val, constants[modulo], divisors[modulo], cmp)) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
+
         case OpCode::Mult:
             multiply(*val, getValue());
             break;
 
+        case OpCode::MultImmediate:
+            multiplyWord(*val, getImmediate());
+            break;
+
+        case OpCode::MultAdd: {
+            auto &factor = getValue();
+            auto &addend = getValue();
+            multiply(*val, factor);
+            add(*val, addend);
+            break;
+        }
+
+        case OpCode::MultAddImmediate: {
+            auto factor = getImmediate();
+            auto addend = getImmediate();
+            multiplyWord(*val, factor);
+            addWord(*val, addend);
+            break;
+        }
+
         case OpCode::Not:
             if (*val == 0) {
                 val = 1;
@@ -151,30 +1046,125 @@ std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt ini
             break;
 
         case OpCode::Print:
+            if (cancelled_ != nullptr) {
+                abandoned_ = true;
+                return std::nullopt;
+            }
             std::cout << *val << '\n';
             break;
 
+        case OpCode::PrintStack:
+            if (cancelled_ != nullptr) {
+                abandoned_ = true;
+                return std::nullopt;
+            }
+            std::cout << "Stack trace:\n" << formatStackTrace(bytecodeModule, instIndex - 1);
+            break;
+
         case OpCode::Ret:
-            if (frames.size() == 1) {
+            if constexpr (Profiling) {
+                profiler->returnFromFunction(opIndex, val == std::nullopt);
+            }
+            if (frames_.size() == 1) {
+                if constexpr (Profiling) {
+                    profiler->finishEvaluation();
+                }
                 return val;
             }
             else {
-                instIndex = frames.back().instIndex;
-                frames.pop_back();
+                returnToCaller();
             }
             break;
 
         case OpCode::RetOnFailure:
             if (val == std::nullopt) {
-                if (frames.size() == 1) {
+                if constexpr (Profiling) {
+                    profiler->returnFromFunction(opIndex, true);
+                }
+                if (frames_.size() == 1) {
+                    if constexpr (Profiling) {
+                        profiler->finishEvaluation();
+                    }
                     return val;
                 }
                 else {
-                    instIndex = frames.back().instIndex;
-                    frames.pop_back();
+                    returnToCaller();
+                }
+            }
+            break;
+
+        case OpCode::Save: {
+            frames_.setTop(*val);
+            break;
+        }
+
+        case OpCode::ShiftLeft:
+            *val <<= getImmediate();
+            break;
+
+        case OpCode::ShiftRightExact: {
+            auto shift = getImmediate();
+            if (!lowBitsEqual(*val, shift, 0)) {
+                val = std::nullopt;
+            }
+            else {
+                *val >>= shift;
+            }
+            break;
+        }
+
+        case OpCode::ShiftRightExactJumpOnFailure: {
+            auto shift = getImmediate();
+            auto failInst = getAddress();
+            if (!lowBitsEqual(*val, shift, 0)) {
+                jumpToNextBranch(failInst);
+            }
+            else {
+                *val >>= shift;
+            }
+            break;
+        }
+
+        case OpCode::ShiftRightFloor:
+            *val >>= getImmediate();
+            break;
+
+        case OpCode::SpeculativeCall: {
+            auto firstInst = getAddress();
+            auto restInst = getAddress();
+            std::shared_ptr<SpeculativeResult> result;
+            if constexpr (!Profiling && !Budgeted) {
+                if (speculationPool_ != nullptr) {
+                    result = speculate(bytecodeModule, restInst, *val);
                 }
             }
+            speculations_.push_back({result, result ? BigInt{} : *val, restInst});
+            if (!callFunction(firstInst, noFailureTarget, false)) {
+                return std::nullopt;
+            }
             break;
+        }
+
+        case OpCode::SpeculativeJoin: {
+            auto pending = std::move(speculations_.back());
+            speculations_.pop_back();
+            if (val != std::nullopt) {
+                if (pending.result) {
+                    pending.result->cancel();
+                    cancelledSpeculations_.push_back(std::move(pending.result));
+                }
+            }
+            else if (pending.result && pending.result->wait()) {
+                val = pending.result->takeResult();
+            }
+            else {
+                val = pending.result ? pending.result->getInput() : std::move(pending.input);
+                if (!callFunction(pending.restAddress, noFailureTarget, true)) {
+                    return std::nullopt;
+                }
+            }
+            break;
+        }
 
         case OpCode::Sub:
             if (!subtract(*val, getValue())) {
@@ -182,12 +1172,159 @@ std::optional<BigInt> getResult(const BytecodeModule &bytecodeModule, BigInt ini
             }
             break;
 
-        case OpCode::TailCall:
+        case OpCode::SubJumpOnFailure: {
+            auto &subtrahend = getValue();
+            auto failInst = getAddress();
+            if (!subtract(*val, subtrahend)) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
+
+        case OpCode::SubImmediate:
+            if (!subtractWord(*val, getImmediate())) {
+                val = std::nullopt;
+            }
+            break;
+
+        case OpCode::SubImmediateJumpOnFailure: {
+            auto subtrahend = getImmediate();
+            auto failInst = getAddress();
+            if (!subtractWord(*val, subtrahend)) {
+                jumpToNextBranch(failInst);
+            }
+            break;
+        }
+
+        case OpCode::TailCall: {
+            auto callIndex = instIndex - 1;
+            instIndex = getAddress();
+            frames_.setTop(*val);
+            if constexpr (Profiling) {
+                profiler->tailCallFunction(instIndex);
+            }
+            if constexpr (Budgeted) {
+                if (!withinBudget()) {
+                    return std::nullopt;
+                }
+            }
+            if constexpr (tracing) {
+                if (instIndex <= callIndex && opcodeStats_ == nullptr) {
+                    instIndex = enterLoop(bytecodeModule, instIndex, val);
+                }
+            }
+            break;
+        }
+
+        case OpCode::TailCallNoSave: {
+            auto callIndex = instIndex - 1;
             instIndex = getAddress();
-            frames.back().val = *val;
+            if constexpr (Profiling) {
+                profiler->tailCallFunction(instIndex);
+            }
+            if constexpr (Budgeted) {
+                if (!withinBudget()) {
+                    return std::nullopt;
+                }
+            }
+            if constexpr (tracing) {
+                if (instIndex <= callIndex && opcodeStats_ == nullptr) {
+                    instIndex = enterLoop(bytecodeModule, instIndex, val);
+                }
+            }
+            break;
+        }
+
+        case OpCode::TestLowBits: {
+            auto cmp = getImmediate();
+            auto bits = getImmediate();
+            if (!lowBitsEqual(*val, bits, cmp)) {
+                val = std::nullopt;
+            }
+            break;
+        }
+
+        case OpCode::TestLowBitsJumpOnFailure: {
+            auto cmp = getImmediate();
+            auto bits = getImmediate();
+            auto failInst = getAddress();
+            if (!lowBitsEqual(*val, bits, cmp)) {
+                jumpToNextBranch(failInst);
+            }
             break;
         }
+        }
+    }
+}
+
+std::shared_ptr<SpeculativeResult> Interpreter::speculate(const BytecodeModule &bytecode, uint32_t address, const BigInt &val) {
+    auto result = std::make_shared<SpeculativeResult>(val);
+    bool started = speculationPool_->trySubmit([result, &bytecode, address] {
+        // Each thread keeps its own interpreter, so that its stack is reused
+        // between speculations. The evaluation is budgeted, with no limits,
+        // so that it checks whether it has been cancelled on every call, and
+        // it never speculates any further itself.
+        thread_local Interpreter interpreter;
+        Budget unlimited;
+        interpreter.cancelled_ = &result->getCancelled();
+        interpreter.abandoned_ = false;
+        auto value = interpreter.run<false, true>(bytecode, result->getInput(), address, nullptr, &unlimited);
+        interpreter.cancelled_ = nullptr;
+        result->finish(std::move(value), interpreter.abandoned_);
+    });
+
+    if (!started) {
+        return nullptr;
+    }
+    return result;
+}
+
+void Interpreter::stopSpeculations() {
+    for (auto &pending: speculations_) {
+        if (pending.result) {
+            pending.result->cancel();
+            cancelledSpeculations_.push_back(std::move(pending.result));
+        }
+    }
+    speculations_.clear();
+
+    for (auto &result: cancelledSpeculations_) {
+        result->wait();
     }
+    cancelledSpeculations_.clear();
+}
+
+std::optional<BigInt> Interpreter::getResult(const BytecodeModule &bytecode, BigInt initialVal, size_t entryPoint) {
+    return run<false, false>(bytecode, std::move(initialVal), bytecode.entryPoints[entryPoint], nullptr, nullptr);
+}
+
+std::optional<BigInt> Interpreter::getResult(const BytecodeModule &bytecode, BigInt initialVal, Profiler &profiler, size_t entryPoint) {
+    return run<true, false>(bytecode, std::move(initialVal), bytecode.entryPoints[entryPoint], &profiler, nullptr);
+}
+
+BoundedResult Interpreter::getResult(
+    const BytecodeModule &bytecode,
+    BigInt initialVal,
+    const Budget &budget,
+    Profiler *profiler,
+    size_t entryPoint)
+{
+    auto result = profiler
+        ? run<true, true>(bytecode, std::move(initialVal), bytecode.entryPoints[entryPoint], profiler, &budget)
+        : run<false, true>(bytecode, std::move(initialVal), bytecode.entryPoints[entryPoint], nullptr, &budget);
+
+    if (exceededLimit_) {
+        return BudgetExceeded{*exceededLimit_};
+    }
+    return result;
+}
+
+std::string Interpreter::getStackTrace(const BytecodeModule &bytecode) const {
+    return formatStackTrace(bytecode, exceededAddress_);
+}
+
+std::optional<BigInt> getResult(const BytecodeModule &bytecode, BigInt initialVal) {
+    return Interpreter{}.getResult(bytecode, std::move(initialVal));
 }
 
 } // namespace unacpp
@@ -0,0 +1,241 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "ir.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+namespace unacpp {
+
+namespace {
+
+size_t countInstructions(std::span<const IrFunction> functions) {
+    size_t count = 0;
+    for (auto &function: functions) {
+        for (auto &block: function.blocks) {
+            count += block.instructions.size();
+        }
+    }
+    return count;
+}
+
+IrFunction lowerProgram(const std::string &name, const Program &program) {
+    IrFunction function{name, program.getPos(), {}};
+
+    auto branches = program.getBranches();
+    for (size_t i = 0; i < branches.size(); i++) {
+        auto insts = branches[i].getInstructions();
+        std::optional<size_t> failure;
+        if (i + 1 < branches.size()) {
+            failure = i + 1;
+        }
+        function.blocks.push_back({{insts.begin(), insts.end()}, std::nullopt, failure});
+    }
+
+    return function;
+}
+
+} // anonymous namespace
+
+bool BasicBlock::hasFailingInstruction() const {
+    return std::any_of(instructions.begin(), instructions.end(), [] (const Instruction &inst) {
+        if (auto div = std::get_if<DivideProgram>(&inst); div) {
+            return div->getRemainderBehavior() == DivideProgram::Remainder::Fail;
+        }
+        return std::holds_alternative<SubtractProgram>(inst) ||
+               std::holds_alternative<EqualProgram>(inst) ||
+               std::holds_alternative<ModEqualProgram>(inst);
+    });
+}
+
+bool IrFunction::isBranchList() const {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        bool lastBlock = i + 1 == blocks.size();
+        if (blocks[i].success || (lastBlock ? blocks[i].failure.has_value() : blocks[i].failure != i + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IrFunction::startsBranch(size_t blockIndex) const {
+    if (blockIndex == 0) {
+        return true;
+    }
+    return std::any_of(blocks.begin(), blocks.end(), [&] (const BasicBlock &block) {
+        return block.failure == blockIndex;
+    });
+}
+
+IrModule::IrModule(std::vector<IrFunction> functions, std::vector<std::string> entryNames, std::shared_ptr<ConstantPool> pool)
+    : functions_(std::move(functions))
+    , entryNames_(std::move(entryNames))
+    , pool_(std::move(pool))
+{
+    updateIndices();
+}
+
+void IrModule::updateIndices() {
+    indices_.clear();
+    for (size_t i = 0; i < functions_.size(); i++) {
+        indices_[functions_[i].name] = i;
+    }
+}
+
+std::span<IrFunction> IrModule::getFunctions() {
+    return functions_;
+}
+
+std::span<const IrFunction> IrModule::getFunctions() const {
+    return functions_;
+}
+
+const IrFunction *IrModule::findFunction(std::string_view name) const {
+    auto it = indices_.find(std::string{name});
+    if (it == indices_.end()) {
+        return nullptr;
+    }
+    return &functions_[it->second];
+}
+
+std::span<const std::string> IrModule::getEntryNames() const {
+    return entryNames_;
+}
+
+const std::shared_ptr<ConstantPool> &IrModule::getConstantPool() const {
+    return pool_;
+}
+
+bool IrModule::isEntryPoint(std::string_view name) const {
+    return std::find(entryNames_.begin(), entryNames_.end(), name) != entryNames_.end();
+}
+
+void IrModule::addExternal(const std::string &name, CallSummary summary) {
+    externals_[name] = summary;
+}
+
+const CallSummary *IrModule::findExternal(std::string_view name) const {
+    auto it = externals_.find(std::string{name});
+    if (it == externals_.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void IrModule::addSpeculation(const std::string &name, SpeculativeSplit split) {
+    speculations_[name] = std::move(split);
+}
+
+const SpeculativeSplit *IrModule::findSpeculation(std::string_view name) const {
+    auto it = speculations_.find(std::string{name});
+    if (it == speculations_.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void IrModule::addFunction(IrFunction function) {
+    indices_[function.name] = functions_.size();
+    functions_.push_back(std::move(function));
+}
+
+void IrModule::removeFunctions(const std::function<bool(const IrFunction &)> &predicate) {
+    std::erase_if(functions_, [&] (const IrFunction &function) {
+        return !isEntryPoint(function.name) && predicate(function);
+    });
+    updateIndices();
+}
+
+bool transformFunctions(IrModule &module, ParallelThreads &threads, const std::function<bool(IrFunction &)> &transform) {
+    auto functions = module.getFunctions();
+
+    // Each function gets its own flag, so that threads don't share a byte.
+    std::vector<char> changed(functions.size(), false);
+    parallelFor(functions.size(), minParallelFunctions, threads, [&] (size_t i) {
+        changed[i] = transform(functions[i]);
+    });
+
+    return std::find(changed.begin(), changed.end(), true) != changed.end();
+}
+
+IrModule lowerPrograms(const ProgramMap &programs, std::span<const std::string> entryNames, std::shared_ptr<ConstantPool> pool) {
+    auto &mainName = entryNames.front();
+    std::vector<IrFunction> functions;
+
+    functions.push_back(lowerProgram(mainName, programs.at(mainName)));
+    for (auto &[name, program]: programs) {
+        if (name != mainName) {
+            functions.push_back(lowerProgram(name, program));
+        }
+    }
+
+    return IrModule{std::move(functions), {entryNames.begin(), entryNames.end()}, std::move(pool)};
+}
+
+bool runPass(std::string_view name, const IrPass &pass, IrModule &module, CompileStats *stats, size_t round) {
+    if (stats == nullptr) {
+        return pass(module);
+    }
+
+    // The functions are copied so that the ones the pass changed can be
+    // counted, which is only worth doing when the stats are wanted.
+    auto functions = module.getFunctions();
+    std::vector<IrFunction> before{functions.begin(), functions.end()};
+    std::unordered_map<std::string_view, const IrFunction *> beforeByName;
+    for (auto &function: before) {
+        beforeByName[function.name] = &function;
+    }
+
+    auto start = CompileStats::Clock::now();
+    bool changed = pass(module);
+    auto time = CompileStats::Clock::now() - start;
+
+    size_t changedCount = 0;
+    for (auto &function: module.getFunctions()) {
+        auto it = beforeByName.find(function.name);
+        if (it == beforeByName.end() || it->second->blocks != function.blocks) {
+            changedCount++;
+        }
+    }
+
+    stats->addPass({
+        std::string{name},
+        round,
+        time,
+        before.size(),
+        module.getFunctions().size(),
+        countInstructions(before),
+        countInstructions(module.getFunctions()),
+        changedCount,
+    });
+
+    return changed;
+}
+
+void PassManager::add(std::string_view name, IrPass pass) {
+    passes_.push_back({name, std::move(pass)});
+}
+
+bool PassManager::run(IrModule &module, CompileStats *stats, size_t round) const {
+    bool changed = false;
+    for (auto &[name, pass]: passes_) {
+        changed |= runPass(name, pass, module, stats, round);
+    }
+    return changed;
+}
+
+std::vector<std::string_view> PassManager::getPassNames() const {
+    std::vector<std::string_view> names;
+    for (auto &[name, pass]: passes_) {
+        names.push_back(name);
+    }
+    return names;
+}
+
+} // namespace unacpp
@@ -0,0 +1,394 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "linker.hpp"
+#include "serialize.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+
+namespace unacpp {
+
+namespace {
+
+constexpr uint8_t objectMagic[] = { 'U', 'N', 'B', 'O' };
+
+// Returns the instructions of the function if it's a single branch without
+// any calls, which is the same shape the optimizer inlines.
+std::optional<std::vector<Instruction>> getInlineBody(const IrFunction &function) {
+    if (function.blocks.size() != 1 || !function.isBranchList()) {
+        return std::nullopt;
+    }
+
+    auto &instructions = function.blocks[0].instructions;
+    bool callsFunction = std::any_of(instructions.begin(), instructions.end(), [] (const Instruction &inst) {
+        return std::holds_alternative<FuncCall>(inst);
+    });
+    if (callsFunction) {
+        return std::nullopt;
+    }
+
+    return instructions;
+}
+
+// Parses and optimizes the file, with an entry point for each of the given
+// names if exports are wanted, or for each of the expressions otherwise.
+CompileObjectResult compileObject(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    std::span<const BytecodeObject> libraries,
+    bool debugMode,
+    const OptimizerOptions &options,
+    bool exportFunctions,
+    CompileStats *stats)
+{
+    // When more than one library exports a function, the first one wins, the
+    // same as when linking.
+    std::unordered_map<std::string, const FunctionSummary *> imports;
+    std::vector<std::string> importNames;
+    for (auto &library: libraries) {
+        for (auto &summary: library.exports) {
+            if (imports.emplace(summary.name, &summary).second) {
+                importNames.push_back(summary.name);
+            }
+        }
+    }
+
+    auto tokens = timePhase(stats, "tokenize", [&] {
+        return getTokens(fileContent);
+    });
+    auto parser = timePhase(stats, "parse", [&] {
+        return Parser{std::move(tokens), exprs, debugMode, importNames};
+    });
+    auto fileParseResult = parser.getParseResult();
+    if (std::holds_alternative<ParseErrors>(fileParseResult)) {
+        return std::get<ParseErrors>(fileParseResult);
+    }
+    auto &programs = std::get<ProgramMap>(fileParseResult);
+    auto &pool = *parser.getConstantPool();
+
+    std::vector<std::string> entryNames;
+    if (exportFunctions) {
+        for (auto &[name, program]: programs) {
+            if (program.getPos().line != 0 && name.back() != ' ') {
+                entryNames.push_back(name);
+            }
+        }
+        if (entryNames.empty()) {
+            return ParseErrors{{{1, 1}, "There are no functions to export"}};
+        }
+        std::sort(entryNames.begin(), entryNames.end());
+    }
+    else {
+        entryNames = parser.getExpressionNames();
+    }
+
+    // Functions defined in the file take precedence over the libraries'.
+    // Imported functions with a body are compiled like functions in the file,
+    // at line 0 like the built-in programs, so they aren't exported again.
+    // Their bodies are copied into this file's pool, so that the result
+    // doesn't depend on the libraries' pools.
+    std::vector<std::pair<std::string, CallSummary>> externals;
+    for (auto &[name, summary]: imports) {
+        if (programs.count(name)) {
+            continue;
+        }
+        if (summary->body) {
+            std::vector<Instruction> body;
+            for (auto &inst: *summary->body) {
+                body.push_back(copyInstruction(pool, inst));
+            }
+            programs.insert({name, Program{{Branch{std::move(body)}}, {0, 0}}});
+        }
+        else {
+            externals.emplace_back(name, summary->call);
+        }
+    }
+
+    ParallelThreads threads{options.threads};
+    auto module = optimizePrograms(programs, entryNames, parser.getConstantPool(), options, stats, &threads);
+    for (auto &[name, call]: externals) {
+        module.addExternal(name, call);
+    }
+
+    BytecodeObject object;
+    object.pool = module.getConstantPool();
+    object.code = timePhase(stats, "generate", [&] {
+        return generateBytecode(module, object.relocations, threads);
+    });
+    if (stats != nullptr) {
+        stats->setBytecode(object.code);
+    }
+    if (exportFunctions) {
+        for (auto &name: entryNames) {
+            auto body = getInlineBody(*module.findFunction(name));
+            object.exports.push_back({name, summarizeCall(module, name), std::move(body)});
+        }
+    }
+
+    return object;
+}
+
+void writeInstruction(std::vector<uint8_t> &data, const Instruction &inst) {
+    // Instructions are written as their index in the Instruction variant,
+    // followed by their arguments.
+    data.push_back(static_cast<uint8_t>(inst.index()));
+
+    if (auto add = std::get_if<AddProgram>(&inst); add) {
+        writeBigInt(data, add->getAmount());
+    }
+    else if (auto div = std::get_if<DivideProgram>(&inst); div) {
+        writeBigInt(data, div->getDivisor());
+        data.push_back(div->getRemainderBehavior() == DivideProgram::Remainder::Fail ? 0 : 1);
+    }
+    else if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
+        writeBigInt(data, eq->getAmount());
+    }
+    else if (auto modEq = std::get_if<ModEqualProgram>(&inst); modEq) {
+        writeBigInt(data, modEq->getAmount());
+        writeBigInt(data, modEq->getModulo());
+    }
+    else if (auto mul = std::get_if<MultiplyProgram>(&inst); mul) {
+        writeBigInt(data, mul->getAmount());
+    }
+    else if (auto sub = std::get_if<SubtractProgram>(&inst); sub) {
+        writeBigInt(data, sub->getAmount());
+    }
+}
+
+// Reads back an instruction written by writeInstruction. Bodies never call
+// functions, so function calls aren't accepted.
+std::optional<Instruction> readInstruction(ByteReader &reader, ConstantPool &pool) {
+    auto index = reader.getUint8();
+    if (index == std::nullopt) {
+        return std::nullopt;
+    }
+
+    if (*index == Instruction{DebugPrint{}}.index()) {
+        return DebugPrint{};
+    }
+    if (*index == Instruction{DebugStackTrace{}}.index()) {
+        return DebugStackTrace{};
+    }
+    if (*index == Instruction{NotProgram{}}.index()) {
+        return NotProgram{};
+    }
+
+    auto amount = reader.getBigInt();
+    if (amount == std::nullopt) {
+        return std::nullopt;
+    }
+
+    if (*index == Instruction{AddProgram{pool, 0}}.index()) {
+        return AddProgram{pool, *amount};
+    }
+    if (*index == Instruction{EqualProgram{pool, 0}}.index()) {
+        return EqualProgram{pool, *amount};
+    }
+    if (*index == Instruction{MultiplyProgram{pool, 0}}.index()) {
+        return MultiplyProgram{pool, *amount};
+    }
+    if (*index == Instruction{SubtractProgram{pool, 0}}.index()) {
+        return SubtractProgram{pool, *amount};
+    }
+    if (*index == Instruction{ModEqualProgram{pool, 0, 0}}.index()) {
+        auto modulo = reader.getBigInt();
+        if (modulo == std::nullopt) {
+            return std::nullopt;
+        }
+        return ModEqualProgram{pool, *amount, *modulo};
+    }
+    if (*index == Instruction{DivideProgram{pool, 0, DivideProgram::Remainder::Fail}}.index()) {
+        auto remainder = reader.getUint8();
+        if (remainder == std::nullopt || *remainder > 1) {
+            return std::nullopt;
+        }
+        return DivideProgram{pool, *amount, *remainder == 0 ? DivideProgram::Remainder::Fail : DivideProgram::Remainder::Floor};
+    }
+
+    return std::nullopt;
+}
+
+} // anonymous namespace
+
+CompileObjectResult compileLibrary(
+    std::string_view fileContent,
+    std::span<const BytecodeObject> libraries,
+    bool debugMode,
+    const OptimizerOptions &options,
+    CompileStats *stats)
+{
+    return compileObject(fileContent, {}, libraries, debugMode, options, true, stats);
+}
+
+CompileObjectResult compileProgram(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    std::span<const BytecodeObject> libraries,
+    bool debugMode,
+    const OptimizerOptions &options,
+    CompileStats *stats)
+{
+    return compileObject(fileContent, exprs, libraries, debugMode, options, false, stats);
+}
+
+LinkResult linkObjects(const BytecodeObject &program, std::span<const BytecodeObject> libraries) {
+    auto module = program.code;
+
+    std::vector<std::pair<uint32_t, const BytecodeObject *>> offsets{{0, &program}};
+    std::unordered_map<std::string, uint32_t> exportAddresses;
+    for (auto &library: libraries) {
+        auto offset = appendBytecode(module, library.code);
+        if (offset == std::nullopt) {
+            return std::string{"The linked module has too many constants"};
+        }
+        offsets.emplace_back(*offset, &library);
+
+        for (size_t i = 0; i < library.exports.size(); i++) {
+            exportAddresses.emplace(library.exports[i].name, *offset + library.code.entryPoints[i]);
+        }
+    }
+
+    for (auto [offset, object]: offsets) {
+        for (auto &relocation: object->relocations) {
+            auto it = exportAddresses.find(relocation.funcName);
+            if (it == exportAddresses.end()) {
+                return "Undefined program: " + relocation.funcName;
+            }
+            resolveRelocation(module, offset, relocation, it->second);
+        }
+    }
+
+    // The relocations come from files which could have been tampered with,
+    // so the result is checked the same as a module read from a file.
+    if (!verifyBytecode(module)) {
+        return std::string{"The linked objects are corrupt"};
+    }
+
+    return module;
+}
+
+std::vector<uint8_t> serializeObject(const BytecodeObject &object) {
+    std::vector<uint8_t> data{std::begin(objectMagic), std::end(objectMagic)};
+
+    writeUint32(data, objectFormatVersion);
+
+    auto code = serializeBytecode(object.code);
+    writeUint32(data, static_cast<uint32_t>(code.size()));
+    data.insert(data.end(), code.begin(), code.end());
+
+    writeUint32(data, static_cast<uint32_t>(object.exports.size()));
+    for (auto &summary: object.exports) {
+        writeString(data, summary.name);
+        data.push_back(summary.call.canFail);
+        data.push_back(summary.call.needsInput);
+        data.push_back(summary.body.has_value());
+        if (summary.body) {
+            writeUint32(data, static_cast<uint32_t>(summary.body->size()));
+            for (auto &inst: *summary.body) {
+                writeInstruction(data, inst);
+            }
+        }
+    }
+
+    writeUint32(data, static_cast<uint32_t>(object.relocations.size()));
+    for (auto &relocation: object.relocations) {
+        writeUint32(data, relocation.byteIndex);
+        writeString(data, relocation.funcName);
+    }
+
+    return data;
+}
+
+std::optional<BytecodeObject> deserializeObject(std::span<const uint8_t> data) {
+    ByteReader reader{data};
+
+    auto magic = reader.getBytes(sizeof(objectMagic));
+    if (magic == std::nullopt || !std::equal(magic->begin(), magic->end(), std::begin(objectMagic))) {
+        return std::nullopt;
+    }
+
+    if (reader.getUint32() != objectFormatVersion) {
+        return std::nullopt;
+    }
+
+    auto codeSize = reader.getUint32();
+    if (codeSize == std::nullopt) {
+        return std::nullopt;
+    }
+    auto codeData = reader.getBytes(*codeSize);
+    if (codeData == std::nullopt) {
+        return std::nullopt;
+    }
+    auto code = deserializeBytecode(*codeData);
+    if (code == std::nullopt) {
+        return std::nullopt;
+    }
+
+    BytecodeObject object;
+    object.code = std::move(*code);
+    object.pool = std::make_shared<ConstantPool>();
+
+    auto exportCount = reader.getUint32();
+    if (exportCount == std::nullopt) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *exportCount; i++) {
+        auto name = reader.getString();
+        auto canFail = reader.getUint8();
+        auto needsInput = reader.getUint8();
+        auto hasBody = reader.getUint8();
+        if (name == std::nullopt || canFail == std::nullopt || needsInput == std::nullopt || hasBody == std::nullopt) {
+            return std::nullopt;
+        }
+
+        FunctionSummary summary{std::move(*name), {*canFail != 0, *needsInput != 0}, std::nullopt};
+        if (*hasBody) {
+            auto instCount = reader.getUint32();
+            if (instCount == std::nullopt) {
+                return std::nullopt;
+            }
+            summary.body.emplace();
+            for (uint32_t j = 0; j < *instCount; j++) {
+                auto inst = readInstruction(reader, *object.pool);
+                if (inst == std::nullopt) {
+                    return std::nullopt;
+                }
+                summary.body->push_back(std::move(*inst));
+            }
+        }
+        object.exports.push_back(std::move(summary));
+    }
+
+    auto relocationCount = reader.getUint32();
+    if (relocationCount == std::nullopt) {
+        return std::nullopt;
+    }
+    for (uint32_t i = 0; i < *relocationCount; i++) {
+        auto byteIndex = reader.getUint32();
+        auto funcName = reader.getString();
+        if (byteIndex == std::nullopt || funcName == std::nullopt) {
+            return std::nullopt;
+        }
+        if (*byteIndex == 0 || uint64_t{*byteIndex} + 4 > object.code.instructions.size()) {
+            return std::nullopt;
+        }
+        object.relocations.push_back({*byteIndex, std::move(*funcName)});
+    }
+
+    // Libraries have an entry point for each of their exports.
+    if (!reader.atEnd() || (!object.exports.empty() && object.exports.size() != object.code.entryPoints.size())) {
+        return std::nullopt;
+    }
+
+    return object;
+}
+
+} // namespace unacpp
@@ -6,44 +6,226 @@
 //  http://www.boost.org/LICENSE_1_0.txt
 //
 
+#include "cache.hpp"
+#include "compiler.hpp"
 #include "interpreter.hpp"
-#include "optimizer.hpp"
-#include "parser.hpp"
+#include "linker.hpp"
+#include "profiler.hpp"
+#include "server.hpp"
+#include "sweep.hpp"
+#include "threadpool.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 void printResult(const std::optional<unacpp::BigInt> &result) {
     if (result == std::nullopt) {
-        std::cout << "-\n";
+        std::cout << '-';
     }
     else {
-        std::cout << *result << '\n';
+        std::cout << *result;
     }
 }
 
-void runInterpreter(const unacpp::BytecodeModule &bytecode, bool readInput) {
-    if (readInput) {
+// Prints ? for an evaluation that went over its budget, to tell it apart from
+// one that failed, with the reason and where it was on stderr.
+void printBudgetExceeded(const unacpp::BigInt &input, unacpp::BudgetExceeded exceeded, const std::string &stackTrace) {
+    std::cout << '?';
+
+    std::cerr << "Evaluating " << input << " exceeded the ";
+    switch (exceeded.limit) {
+        case unacpp::BudgetLimit::Instructions:
+            std::cerr << "instruction";
+            break;
+        case unacpp::BudgetLimit::Depth:
+            std::cerr << "stack depth";
+            break;
+        case unacpp::BudgetLimit::Memory:
+            std::cerr << "memory";
+            break;
+    }
+    std::cerr << " limit, at:\n" << stackTrace;
+}
+
+void runInterpreter(
+    const unacpp::BytecodeModule &bytecode,
+    bool readInput,
+    const std::optional<unacpp::InputRange> &range,
+    unacpp::Profiler *profiler,
+    unacpp::OpcodeStats *opcodeStats,
+    const std::optional<unacpp::Budget> &budget,
+    unacpp::ThreadPool *speculationPool)
+{
+    unacpp::Interpreter interpreter;
+    interpreter.setOpcodeStats(opcodeStats);
+    interpreter.setSpeculationPool(speculationPool);
+
+    auto evaluateEntry = [&] (const unacpp::BigInt &num, size_t entryPoint) {
+        if (budget) {
+            auto result = interpreter.getResult(bytecode, num, *budget, profiler, entryPoint);
+            if (auto exceeded = std::get_if<unacpp::BudgetExceeded>(&result); exceeded) {
+                printBudgetExceeded(num, *exceeded, interpreter.getStackTrace(bytecode));
+            }
+            else {
+                printResult(std::get<std::optional<unacpp::BigInt>>(result));
+            }
+        }
+        else if (profiler) {
+            printResult(interpreter.getResult(bytecode, num, *profiler, entryPoint));
+        }
+        else {
+            printResult(interpreter.getResult(bytecode, num, entryPoint));
+        }
+    };
+
+    // Each input is only read once, with the result of each expression
+    // printed in its own column.
+    auto evaluate = [&] (const unacpp::BigInt &num) {
+        for (size_t i = 0; i < bytecode.entryPoints.size(); i++) {
+            if (i > 0) {
+                std::cout << ' ';
+            }
+            evaluateEntry(num, i);
+        }
+        std::cout << '\n';
+    };
+
+    if (range) {
+        for (auto num = range->first; num <= range->last; num += range->step) {
+            evaluate(num);
+        }
+    }
+    else if (readInput) {
         while (std::cin) {
             unacpp::BigInt num;
             if (std::cin >> num) {
-                printResult(unacpp::getResult(bytecode, num));
+                evaluate(num);
             }
         }
     }
     else {
-        printResult(unacpp::getResult(bytecode, 0));
+        evaluate(0);
+    }
+}
+
+// Prints the combined results of each expression. Histograms have a line for
+// each result, so they're printed one after the other, while the rest are
+// printed in columns like the results for a single input.
+void printReductions(const std::vector<unacpp::Accumulator> &accumulators, unacpp::Reduction reduction) {
+    uint64_t exceededCount = 0;
+
+    for (size_t i = 0; i < accumulators.size(); i++) {
+        if (i > 0) {
+            std::cout << (reduction == unacpp::Reduction::Histogram ? "\n\n" : " ");
+        }
+        std::cout << accumulators[i].getReport();
+        exceededCount += accumulators[i].getExceededCount();
+    }
+    std::cout << '\n';
+
+    if (exceededCount > 0) {
+        std::cerr << exceededCount << " evaluations exceeded their limits, and were left out\n";
+    }
+}
+
+void printParseErrors(const unacpp::ParseErrors &errors) {
+    for (auto &error: errors) {
+        std::cerr << "On line " << error.pos.line << ", column " << error.pos.col
+                << ": " << error.message << '\n';
+    }
+}
+
+std::optional<unacpp::BytecodeModule> compileBytecode(
+    const std::string &fileContents,
+    const std::vector<std::string> &exprs,
+    std::span<const unacpp::BytecodeObject> libraries,
+    bool debugMode,
+    const unacpp::OptimizerOptions &optimizerOptions,
+    unacpp::CompileStats *stats)
+{
+    if (libraries.empty()) {
+        auto result = unacpp::compileBytecode(fileContents, exprs, debugMode, optimizerOptions, stats);
+        if (auto errors = std::get_if<unacpp::ParseErrors>(&result); errors) {
+            printParseErrors(*errors);
+            return std::nullopt;
+        }
+        return std::get<unacpp::BytecodeModule>(std::move(result));
+    }
+
+    auto result = unacpp::compileProgram(fileContents, exprs, libraries, debugMode, optimizerOptions, stats);
+    if (auto errors = std::get_if<unacpp::ParseErrors>(&result); errors) {
+        printParseErrors(*errors);
+        return std::nullopt;
+    }
+
+    auto linked = unacpp::timePhase(stats, "link", [&] {
+        return unacpp::linkObjects(std::get<unacpp::BytecodeObject>(result), libraries);
+    });
+    if (auto error = std::get_if<std::string>(&linked); error) {
+        std::cerr << *error << '\n';
+        return std::nullopt;
+    }
+
+    auto &module = std::get<unacpp::BytecodeModule>(linked);
+    if (stats != nullptr) {
+        stats->setBytecode(module);
+    }
+    return std::move(module);
+}
+
+// Prints the stats to stderr and writes them to the JSON file, if either was
+// asked for. Returns false if the file couldn't be written.
+bool reportCompileStats(const unacpp::CompileStats &stats, bool printStats, const std::string &jsonFile) {
+    if (printStats) {
+        std::cerr << stats.getReport();
     }
+
+    if (!jsonFile.empty()) {
+        std::ofstream output{jsonFile};
+        if (!output.is_open()) {
+            std::cerr << "Unable to open " << jsonFile << '\n';
+            return false;
+        }
+        output << stats.getJson();
+    }
+
+    return true;
+}
+
+std::optional<std::vector<uint8_t>> readBinaryFile(const std::string &path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+    return std::vector<uint8_t>{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
 }
 
 int main(int argc, char **argv) {
     std::string filename;
-    std::string expr = "main";
+    std::vector<std::string> exprs;
     bool readInput = false;
     bool debugMode = false;
     bool outputBytecode = false;
+    bool noCache = false;
+    bool profile = false;
+    std::string profileStacksFile;
+    bool outputOpcodeStats = false;
+    bool outputCompileStats = false;
+    std::string compileStatsFile;
+    unsigned optimizationLevel = unacpp::defaultOptimizationLevel;
+    std::vector<std::string> enabledPasses;
+    std::vector<std::string> disabledPasses;
+    unacpp::Budget budget;
+    std::string serveSocket;
+    size_t jobs = 0;
+    std::string rangeStr;
+    std::string reductionName;
+    std::string objectFile;
+    std::vector<std::string> linkFiles;
+    std::vector<std::string> speculate;
 
     CLI::App app{"An interpreter for Unarian"};
 
@@ -52,14 +234,115 @@ int main(int argc, char **argv) {
 
     app.add_flag("-g,--debug", debugMode, "Enables debug printing with the ! command.");
 
-    app.add_option("-e,--expr", expr, "The expression to evaluate.");
+    app.add_option("-e,--expr", exprs, "The expression to evaluate. Given more than once, each expression is evaluated on every input, with their results printed on the same line.")
+       ->allow_extra_args(false);
 
     app.add_flag("-i,--input", readInput, "Uses input from stdin as input to the evaluated expression.");
 
     app.add_flag("-b,--bytecode", outputBytecode, "Outputs the bytecode generated from the unarian file.");
 
+    app.add_option("-O,--optimize", optimizationLevel, "The optimization level, from 0 for no optimization to 3. Defaults to 2.")
+       ->check(CLI::Range(0u, unacpp::maxOptimizationLevel));
+
+    std::vector<std::string> passNames{unacpp::optimizerPassNames.begin(), unacpp::optimizerPassNames.end()};
+
+    app.add_option("--enable-pass", enabledPasses, "Runs the given optimizer pass, regardless of the optimization level.")
+       ->check(CLI::IsMember(passNames));
+
+    app.add_option("--disable-pass", disabledPasses, "Doesn't run the given optimizer pass, regardless of the optimization level.")
+       ->check(CLI::IsMember(passNames));
+
+    app.add_flag("--no-cache", noCache, "Always compiles the program, instead of using or updating the bytecode cache.");
+
+    app.add_flag("--profile", profile, "Prints statistics about each function called to stderr after running.");
+
+    app.add_option("--profile-stacks", profileStacksFile, "Profiles the program, writing the instructions executed for each call stack to the given file, for use with flame graph tools.");
+
+    app.add_flag("--stats", outputCompileStats, "Prints how long each step of compiling the program and each optimizer pass took, and what they changed, to stderr.");
+
+    app.add_option("--stats-json", compileStatsFile, "Writes the same statistics as --stats to the given file as JSON.");
+
+    app.add_option("--max-instructions", budget.maxInstructions, "Stops evaluating an input after roughly this many instructions, printing ? as the result.");
+
+    app.add_option("--max-depth", budget.maxDepth, "Stops evaluating an input once it makes this many nested calls, printing ? as the result.");
+
+    app.add_option("--max-memory", budget.maxMemory, "Stops evaluating an input once the values on its stack take up roughly this many bytes, printing ? as the result.");
+
+    app.add_option("--serve", serveSocket, "Listens on the given Unix domain socket for requests to evaluate, instead of evaluating a single file.");
+
+    app.add_option("-j,--jobs", jobs, "How many threads to compile and evaluate with. Defaults to one per hardware thread.");
+
+    app.add_option("--range", rangeStr, "Evaluates every input in a range, written as a..b or a..b:step, including both ends.");
+
+    app.add_option("--compile-object", objectFile, "Compiles every function in the file into a library object at the given path, which other files can use with --link, instead of evaluating anything.");
+
+    app.add_option("--link", linkFiles, "Links with a library object made by --compile-object, so that the file can call its functions. Given more than once, calls go to the first library defining the function.")
+       ->check(CLI::ExistingFile);
+
+    app.add_option("--speculate", speculate, "Evaluates the branches after the first of the given function on another thread while its first branch is evaluated, using the result if the first branch fails. Given more than once, each function is speculated.");
+
+    std::vector<std::string> reductions{unacpp::reductionNames.begin(), unacpp::reductionNames.end()};
+
+    app.add_option("--reduce", reductionName, "Combines the results over the --range, split between -j threads, instead of printing each one.")
+       ->check(CLI::IsMember(reductions));
+
+    if constexpr (unacpp::opcodeStatsEnabled) {
+        app.add_flag("--opcode-stats", outputOpcodeStats, "Prints how many times each opcode and pair of opcodes was executed to stderr.");
+    }
+
     CLI11_PARSE(app, argc, argv);
 
+    if (exprs.empty()) {
+        exprs.push_back("main");
+    }
+
+    std::optional<unacpp::InputRange> range;
+    if (!rangeStr.empty()) {
+        range = unacpp::InputRange::parse(rangeStr);
+        if (range == std::nullopt) {
+            std::cerr << "Invalid range: " << rangeStr << '\n';
+            return 1;
+        }
+    }
+
+    if (range && readInput) {
+        std::cerr << "--range can't be used with --input\n";
+        return 1;
+    }
+
+    auto reduction = unacpp::parseReduction(reductionName);
+    if (reduction && !range) {
+        std::cerr << "--reduce needs a --range to reduce\n";
+        return 1;
+    }
+    if (reduction && (profile || !profileStacksFile.empty())) {
+        std::cerr << "--reduce can't be used while profiling\n";
+        return 1;
+    }
+
+    auto optimizerOptions = unacpp::OptimizerOptions::forLevel(optimizationLevel);
+    for (auto &pass: enabledPasses) {
+        optimizerOptions.setPass(pass, true);
+    }
+    for (auto &pass: disabledPasses) {
+        optimizerOptions.setPass(pass, false);
+    }
+    optimizerOptions.speculate = speculate;
+    optimizerOptions.threads = jobs;
+
+    // Evaluating without a budget is a little faster, so it's only used when
+    // one of the limits was given.
+    std::optional<unacpp::Budget> evalBudget;
+    if (budget != unacpp::Budget{}) {
+        evalBudget = budget;
+    }
+
+    if (!serveSocket.empty()) {
+        unacpp::Server server{serveSocket, {optimizerOptions, evalBudget, jobs}};
+        std::cerr << server.run() << '\n';
+        return 1;
+    }
+
     std::ifstream file{filename};
     if (!file.is_open() && !filename.empty()) {
         std::cerr << "Unable to open " << filename << '\n';
@@ -74,27 +357,123 @@ int main(int argc, char **argv) {
         fileContents = fileStream.str();
     }
 
-    unacpp::Parser parser{fileContents, expr, debugMode};
-    auto fileParseResult = parser.getParseResult();
-    if (std::holds_alternative<unacpp::ParseErrors>(fileParseResult)) {
-        auto errors = std::get<unacpp::ParseErrors>(fileParseResult);
-        for (auto &error: errors) {
-            std::cerr << "On line " << error.pos.line << ", column " << error.pos.col
-                    << ": " << error.message << '\n';
+    std::vector<std::vector<uint8_t>> libraryData;
+    std::vector<unacpp::BytecodeObject> libraries;
+    for (auto &linkFile: linkFiles) {
+        auto data = readBinaryFile(linkFile);
+        if (data == std::nullopt) {
+            std::cerr << "Unable to open " << linkFile << '\n';
+            return 1;
+        }
+        auto library = unacpp::deserializeObject(*data);
+        if (library == std::nullopt) {
+            std::cerr << linkFile << " isn't a library object, or was compiled by a different version\n";
+            return 1;
+        }
+        libraryData.push_back(std::move(*data));
+        libraries.push_back(std::move(*library));
+    }
+
+    // Loading a program from the cache skips compiling it, so there would be
+    // nothing to report.
+    std::optional<unacpp::CompileStats> compileStats;
+    if (outputCompileStats || !compileStatsFile.empty()) {
+        compileStats.emplace();
+        noCache = true;
+    }
+    auto *compileStatsPtr = compileStats ? &*compileStats : nullptr;
+
+    if (!objectFile.empty()) {
+        auto result = unacpp::compileLibrary(fileContents, libraries, debugMode, optimizerOptions, compileStatsPtr);
+        if (auto errors = std::get_if<unacpp::ParseErrors>(&result); errors) {
+            printParseErrors(*errors);
+            return 2;
+        }
+        if (compileStats && !reportCompileStats(*compileStats, outputCompileStats, compileStatsFile)) {
+            return 1;
+        }
+
+        auto data = unacpp::serializeObject(std::get<unacpp::BytecodeObject>(result));
+        std::ofstream output{objectFile, std::ios::binary};
+        if (!output.is_open()) {
+            std::cerr << "Unable to open " << objectFile << '\n';
+            return 1;
         }
-        return 2;
+        output.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        return 0;
+    }
+
+    std::optional<unacpp::BytecodeCache> cache;
+    std::string cacheKey;
+    if (auto cacheDir = unacpp::BytecodeCache::getDefaultDirectory(); cacheDir && !noCache) {
+        cache.emplace(*cacheDir);
+        cacheKey = unacpp::BytecodeCache::getKey(fileContents, exprs, debugMode, optimizerOptions, libraryData);
+    }
+
+    std::optional<unacpp::BytecodeModule> bytecode;
+    if (cache) {
+        bytecode = cache->load(cacheKey);
     }
 
-    const auto &programs = std::get<unacpp::ProgramMap>(fileParseResult);
+    if (bytecode == std::nullopt) {
+        bytecode = compileBytecode(fileContents, exprs, libraries, debugMode, optimizerOptions, compileStatsPtr);
+        if (bytecode == std::nullopt) {
+            return 2;
+        }
+        if (cache) {
+            cache->store(cacheKey, *bytecode);
+        }
+    }
 
-    auto programName = parser.getExpressionName();
-    auto optimizedPrograms = unacpp::optimizePrograms(programs, programName);
+    if (compileStats && !reportCompileStats(*compileStats, outputCompileStats, compileStatsFile)) {
+        return 1;
+    }
 
-    auto bytecode = unacpp::generateBytecode(optimizedPrograms, programName);
     if (outputBytecode) {
-        std::cout << unacpp::bytecodeToString(bytecode);
+        std::cout << unacpp::bytecodeToString(*bytecode);
         return 0;
     }
 
-    runInterpreter(bytecode, readInput);
+    std::optional<unacpp::OpcodeStats> opcodeStats;
+    if (outputOpcodeStats) {
+        opcodeStats.emplace();
+    }
+    auto *opcodeStatsPtr = opcodeStats ? &*opcodeStats : nullptr;
+
+    // The first branch of a speculated function is evaluated on this thread,
+    // so the pool has one thread fewer than -j.
+    std::optional<unacpp::ThreadPool> speculationPool;
+    size_t threadCount = jobs > 0 ? jobs : std::thread::hardware_concurrency();
+    if (!speculate.empty() && threadCount > 1) {
+        speculationPool.emplace(threadCount - 1);
+    }
+    auto *speculationPoolPtr = speculationPool ? &*speculationPool : nullptr;
+
+    if (reduction) {
+        printReductions(unacpp::sweepRange(*bytecode, *range, *reduction, jobs, evalBudget), *reduction);
+    }
+    else if (!profile && profileStacksFile.empty()) {
+        runInterpreter(*bytecode, readInput, range, nullptr, opcodeStatsPtr, evalBudget, speculationPoolPtr);
+    }
+    else {
+        unacpp::Profiler profiler{*bytecode};
+        runInterpreter(*bytecode, readInput, range, &profiler, opcodeStatsPtr, evalBudget, speculationPoolPtr);
+
+        if (profile) {
+            std::cerr << profiler.getReport();
+        }
+
+        if (!profileStacksFile.empty()) {
+            std::ofstream stacksFile{profileStacksFile};
+            if (!stacksFile.is_open()) {
+                std::cerr << "Unable to open " << profileStacksFile << '\n';
+                return 1;
+            }
+            stacksFile << profiler.getCollapsedStacks();
+        }
+    }
+
+    if (opcodeStats) {
+        std::cerr << opcodeStats->getReport();
+    }
 }
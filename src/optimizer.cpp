@@ -7,22 +7,55 @@
 //
 
 #include "optimizer.hpp"
+#include "threadpool.hpp"
 
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <map>
+#include <memory>
 #include <optional>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <variant>
 
 namespace unacpp {
 
 namespace {
 
-bool canInline(const Program &program) {
-    auto branches = program.getBranches();
-    if (branches.size() > 1) {
+// The flags for each pass, in the same order as optimizerPassNames.
+constexpr std::array<bool OptimizerOptions::*, optimizerPassNames.size()> optimizerPassFlags = {
+    &OptimizerOptions::inlinePrograms,
+    &OptimizerOptions::condenseMath,
+    &OptimizerOptions::simplifyMultiply,
+    &OptimizerOptions::simplifyDivide,
+    &OptimizerOptions::simplifyModEqual,
+    &OptimizerOptions::simplifyNot,
+    &OptimizerOptions::simplifyEqual,
+    &OptimizerOptions::recognizeIdioms,
+    &OptimizerOptions::partialEvaluate,
+};
+
+// Returns the instructions of each branch of the function, or nothing if its
+// blocks have been rearranged so that it's no longer a list of branches.
+std::vector<std::span<const Instruction>> getBranches(const IrFunction &function) {
+    std::vector<std::span<const Instruction>> branches;
+    if (function.isBranchList()) {
+        for (auto &block: function.blocks) {
+            branches.emplace_back(block.instructions);
+        }
+    }
+    return branches;
+}
+
+bool canInline(const IrFunction &function) {
+    auto branches = getBranches(function);
+    if (branches.size() != 1) {
         return false;
     }
 
-    for (auto &inst: branches[0].getInstructions()) {
+    for (auto &inst: branches[0]) {
         if (std::holds_alternative<FuncCall>(inst))
         {
             return false;
@@ -32,15 +65,17 @@ bool canInline(const Program &program) {
     return true;
 }
 
-Branch inlineBranch(const Branch &branch, const ProgramMap &programs, bool &inlined) {
+std::vector<Instruction> inlineInstructions(
+    std::span<const Instruction> instructions,
+    const std::unordered_map<std::string, std::vector<Instruction>> &inlinable,
+    bool &inlined)
+{
     std::vector<Instruction> insts;
 
-    for (auto &inst: branch.getInstructions()) {
-        if (auto *func = std::get_if<FuncCall>(&inst); func && programs.count(func->getFuncName())) {
-            auto toInline = programs.at(func->getFuncName()).getBranches()[0];
-            for (auto &inlineInst: toInline.getInstructions()) {
-                insts.push_back(inlineInst);
-            }
+    for (auto &inst: instructions) {
+        auto *func = std::get_if<FuncCall>(&inst);
+        if (auto it = func ? inlinable.find(func->getFuncName()) : inlinable.end(); it != inlinable.end()) {
+            insts.insert(insts.end(), it->second.begin(), it->second.end());
             inlined = true;
         }
         else {
@@ -48,42 +83,33 @@ Branch inlineBranch(const Branch &branch, const ProgramMap &programs, bool &inli
         }
     }
 
-    return Branch{insts};
+    return insts;
 }
 
-Program inlineProgram(const Program &program, const ProgramMap &programs, bool &inlined) {
-    std::vector<Branch> branches;
+bool inlineFunctions(IrModule &module, ParallelThreads &threads) {
+    std::unordered_map<std::string, std::vector<Instruction>> inlinable;
 
-    for (auto &branch: program.getBranches()) {
-        branches.push_back(inlineBranch(branch, programs, inlined));
-    }
-
-    return Program{branches};
-}
-
-bool inlinePrograms(ProgramMap &programs, const std::string &programName) {
-    ProgramMap inlinablePrograms;
-
-    for (auto it = programs.begin(); it != programs.end(); ) {
-        if (canInline(it->second) && it->first != programName) {
-            inlinablePrograms.insert(*it);
-            it = programs.erase(it);
-        }
-        else {
-            ++it;
+    // Entry points are inlined into their callers too, but are kept around,
+    // since they can still be called from outside the module.
+    for (auto &function: module.getFunctions()) {
+        if (canInline(function)) {
+            inlinable[function.name] = function.blocks[0].instructions;
         }
     }
-
-    bool inlinedProgram = false;
-
-    for (auto &[name, prog]: programs) {
-        prog = inlineProgram(prog, inlinablePrograms, inlinedProgram);
-    }
-
-    return inlinedProgram;
+    module.removeFunctions([&] (const IrFunction &function) {
+        return inlinable.count(function.name) > 0;
+    });
+
+    return transformFunctions(module, threads, [&] (IrFunction &function) {
+        bool inlined = false;
+        for (auto &block: function.blocks) {
+            block.instructions = inlineInstructions(block.instructions, inlinable, inlined);
+        }
+        return inlined;
+    });
 }
 
-Branch condenseMathBranch(const Branch &branch) {
+std::vector<Instruction> condenseMathInstructions(ConstantPool &pool, std::span<const Instruction> instructions) {
     BigInt curAdd = 0;
     BigInt curSub = 0;
     BigInt curMul = 1;
@@ -94,28 +120,28 @@ Branch condenseMathBranch(const Branch &branch) {
 
     auto pushInstructions = [&] {
         if (curSub > 0) {
-            insts.push_back(SubtractProgram{std::move(curSub)});
+            insts.push_back(SubtractProgram{pool, std::move(curSub)});
             curSub = 0;
         }
 
         if (curDiv != 1) {
-            insts.push_back(DivideProgram{std::move(curDiv), *divType});
+            insts.push_back(DivideProgram{pool, std::move(curDiv), *divType});
             curDiv = 1;
             divType = std::nullopt;
         }
 
         if (curMul != 1) {
-            insts.push_back(MultiplyProgram{std::move(curMul)});
+            insts.push_back(MultiplyProgram{pool, std::move(curMul)});
             curMul = 1;
         }
 
         if (curAdd > 0) {
-            insts.push_back(AddProgram{std::move(curAdd)});
+            insts.push_back(AddProgram{pool, std::move(curAdd)});
             curAdd = 0;
         }
     };
 
-    for (auto &inst: branch.getInstructions()) {
+    for (auto &inst: instructions) {
         if (auto add = std::get_if<AddProgram>(&inst); add) {
             if (curSub > 0) {
                 pushInstructions();
@@ -139,8 +165,13 @@ Branch condenseMathBranch(const Branch &branch) {
         }
         else if (auto mul = std::get_if<MultiplyProgram>(&inst); mul) {
             if (mul->getAmount() == 0) {
+                // A division that fails on a remainder still has to be done,
+                // since whether it fails doesn't depend on what comes after.
                 curAdd = 0;
-                curDiv = 1;
+                if (divType != DivideProgram::Remainder::Fail) {
+                    curDiv = 1;
+                    divType = std::nullopt;
+                }
                 curMul = 0;
                 pushInstructions();
             }
@@ -170,34 +201,36 @@ Branch condenseMathBranch(const Branch &branch) {
 
     pushInstructions();
 
-    return Branch{insts};
+    return insts;
 }
 
-void condenseMath(ProgramMap &programs) {
-    for (auto &[name, prog]: programs) {
-        std::vector<Branch> branches;
-
-        for (auto &branch: prog.getBranches()) {
-            branches.emplace_back(condenseMathBranch(branch));
+bool condenseMath(IrModule &module, ParallelThreads &threads) {
+    auto &pool = *module.getConstantPool();
+    return transformFunctions(module, threads, [&pool] (IrFunction &function) {
+        bool changed = false;
+        for (auto &block: function.blocks) {
+            auto condensed = condenseMathInstructions(pool, block.instructions);
+            if (condensed != block.instructions) {
+                block.instructions = std::move(condensed);
+                changed = true;
+            }
         }
-
-        prog = Program{branches};
-    }
+        return changed;
+    });
 }
 
-std::optional<BigInt> checkMultiply(const Program &program, const std::string &funcName) {
-    auto branches = program.getBranches();
+std::optional<BigInt> checkMultiply(const IrFunction &function) {
+    auto branches = getBranches(function);
     if (branches.size() != 2) {
         return std::nullopt;
     }
 
     auto &identBranch = branches[1];
-    if (!identBranch.getInstructions().empty()) {
+    if (!identBranch.empty()) {
         return std::nullopt;
     }
 
-    auto &multBranch = branches[0];
-    auto multInsts = multBranch.getInstructions();
+    auto multInsts = branches[0];
     if (multInsts.size() != 3 && multInsts.size() != 2) {
         return std::nullopt;
     }
@@ -209,7 +242,7 @@ std::optional<BigInt> checkMultiply(const Program &program, const std::string &f
     }
 
     if (!std::holds_alternative<FuncCall>(multInsts[1]) ||
-        std::get<FuncCall>(multInsts[1]).getFuncName() != funcName)
+        std::get<FuncCall>(multInsts[1]).getFuncName() != function.name)
     {
         return std::nullopt;
     }
@@ -225,13 +258,13 @@ std::optional<BigInt> checkMultiply(const Program &program, const std::string &f
     return std::get<AddProgram>(multInsts[2]).getAmount();
 }
 
-bool checkNot(const Program &program) {
-    auto branches = program.getBranches();
+bool checkNot(const IrFunction &function) {
+    auto branches = getBranches(function);
     if (branches.size() != 2) {
         return false;
     }
 
-    auto firstBranchInsts = branches[0].getInstructions();
+    auto firstBranchInsts = branches[0];
     if (firstBranchInsts.size() != 2) {
         return false;
     }
@@ -248,7 +281,7 @@ bool checkNot(const Program &program) {
         return false;
     }
 
-    auto secondBranchInsts = branches[1].getInstructions();
+    auto secondBranchInsts = branches[1];
     if (secondBranchInsts.size() != 1) {
         return false;
     }
@@ -262,13 +295,13 @@ bool checkNot(const Program &program) {
     return true;
 }
 
-std::optional<uint32_t> checkIfEqual(const Program &program) {
-    auto branches = program.getBranches();
+std::optional<uint32_t> checkIfEqual(const IrFunction &function) {
+    auto branches = getBranches(function);
     if (branches.size() != 1) {
         return std::nullopt;
     }
 
-    auto branchInsts = branches[0].getInstructions();
+    auto branchInsts = branches[0];
     if (branchInsts.size() != 2) {
         return std::nullopt;
     }
@@ -283,13 +316,13 @@ std::optional<uint32_t> checkIfEqual(const Program &program) {
     return 0;
 }
 
-std::optional<std::pair<BigInt, DivideProgram::Remainder>> checkDivision(const Program &program, const std::string &funcName) {
-    auto branches = program.getBranches();
+std::optional<std::pair<BigInt, DivideProgram::Remainder>> checkDivision(const IrFunction &function) {
+    auto branches = getBranches(function);
     if (branches.size() != 2) {
         return std::nullopt;
     }
 
-    auto firstInsts = branches[0].getInstructions();
+    auto firstInsts = branches[0];
     if (firstInsts.size() != 3) {
         return std::nullopt;
     }
@@ -301,7 +334,7 @@ std::optional<std::pair<BigInt, DivideProgram::Remainder>> checkDivision(const P
     auto divisor = std::get<SubtractProgram>(firstInsts[0]).getAmount();
 
     if (!std::holds_alternative<FuncCall>(firstInsts[1]) ||
-        std::get<FuncCall>(firstInsts[1]).getFuncName() != funcName)
+        std::get<FuncCall>(firstInsts[1]).getFuncName() != function.name)
     {
         return std::nullopt;
     }
@@ -312,7 +345,7 @@ std::optional<std::pair<BigInt, DivideProgram::Remainder>> checkDivision(const P
         return std::nullopt;
     }
 
-    auto secondInsts = branches[1].getInstructions();
+    auto secondInsts = branches[1];
     if (secondInsts.size() != 1) {
         return std::nullopt;
     }
@@ -332,13 +365,13 @@ std::optional<std::pair<BigInt, DivideProgram::Remainder>> checkDivision(const P
     return std::nullopt;
 }
 
-std::optional<std::pair<BigInt, BigInt>> checkModEqual(const Program &program, const std::string &funcName) {
-    auto branches = program.getBranches();
+std::optional<std::pair<BigInt, BigInt>> checkModEqual(const IrFunction &function) {
+    auto branches = getBranches(function);
     if (branches.size() != 2) {
         return std::nullopt;
     }
 
-    auto firstInsts = branches[0].getInstructions();
+    auto firstInsts = branches[0];
     if (firstInsts.size() != 3) {
         return std::nullopt;
     }
@@ -350,7 +383,7 @@ std::optional<std::pair<BigInt, BigInt>> checkModEqual(const Program &program, c
     auto &divisor = std::get<SubtractProgram>(firstInsts[0]).getAmount();
 
     if (!std::holds_alternative<FuncCall>(firstInsts[1]) ||
-        std::get<FuncCall>(firstInsts[1]).getFuncName() != funcName)
+        std::get<FuncCall>(firstInsts[1]).getFuncName() != function.name)
     {
         return std::nullopt;
     }
@@ -361,7 +394,7 @@ std::optional<std::pair<BigInt, BigInt>> checkModEqual(const Program &program, c
         return std::nullopt;
     }
 
-    auto secondInsts = branches[1].getInstructions();
+    auto secondInsts = branches[1];
     if (secondInsts.size() != 1) {
         return std::nullopt;
     }
@@ -375,55 +408,1196 @@ std::optional<std::pair<BigInt, BigInt>> checkModEqual(const Program &program, c
     return std::nullopt;
 }
 
-void simplifyFunctions(ProgramMap &programs) {
-    for (auto &[name, prog]: programs) {
-        auto factor = checkMultiply(prog, name);
-        if (factor != std::nullopt) {
-            prog = Program{{Branch{{MultiplyProgram{*factor}}}}};
+// Replaces each function the check recognizes with the single instruction it
+// returns for it.
+bool replaceFunctions(IrModule &module, ParallelThreads &threads, std::optional<Instruction> (*check)(ConstantPool &, const IrFunction &)) {
+    auto &pool = *module.getConstantPool();
+    return transformFunctions(module, threads, [&pool, check] (IrFunction &function) {
+        auto inst = check(pool, function);
+        if (inst) {
+            function.blocks = {BasicBlock{{std::move(*inst)}, std::nullopt, std::nullopt}};
+        }
+        return inst.has_value();
+    });
+}
+
+// How many instructions evaluating a single call at compile time may run
+// before it's left to be made at run time instead.
+constexpr uint64_t partialEvalFuel = 100'000;
+
+// How deeply calls evaluated at compile time may nest.
+constexpr size_t partialEvalMaxDepth = 1'000;
+
+// Values which grow past this many bits while evaluating a call stop it from
+// being evaluated, so that the constants left behind stay a reasonable size.
+constexpr unsigned partialEvalMaxBits = 1 << 16;
+
+// How many copies of functions specialized for a known input the partial
+// evaluation pass may create.
+constexpr size_t maxSpecializations = 32;
+
+// Stands in for the result of a call which couldn't be evaluated at compile
+// time, because it used up its fuel, printed something, or grew too large.
+struct NotEvaluated {};
+
+// The result of a call evaluated at compile time, where std::nullopt means the
+// call failed.
+using ConstantResult = std::variant<std::optional<BigInt>, NotEvaluated>;
+
+// Runs calls on known values while optimizing. Only functions which don't
+// print anything can be evaluated, since every other instruction only depends
+// on the value it's given.
+class ConstantEvaluator {
+private:
+    const IrModule &module_;
+
+    uint64_t fuel_ = 0;
+
+    size_t depth_ = 0;
+
+    // The results of the calls evaluated so far, including the ones which
+    // couldn't be.
+    std::map<std::pair<std::string, BigInt>, ConstantResult> results_;
+
+    ConstantResult run(const IrFunction &function, const BigInt &input);
+
+    ConstantResult runCall(const std::string &name, const BigInt &input);
+
+public:
+    explicit ConstantEvaluator(const IrModule &module)
+        : module_(module)
+    {}
+
+    // Returns whether the instruction succeeds on the value, updating it, or
+    // std::nullopt if it can't be evaluated at compile time.
+    std::optional<bool> runInstruction(const Instruction &inst, BigInt &value);
+
+    // Evaluates a call to the function with the given name.
+    ConstantResult call(const std::string &name, const BigInt &input);
+};
+
+std::optional<bool> ConstantEvaluator::runInstruction(const Instruction &inst, BigInt &value) {
+    if (auto add = std::get_if<AddProgram>(&inst); add) {
+        value += add->getAmount();
+    }
+    else if (auto sub = std::get_if<SubtractProgram>(&inst); sub) {
+        if (value < sub->getAmount()) {
+            return false;
+        }
+        value -= sub->getAmount();
+    }
+    else if (auto mul = std::get_if<MultiplyProgram>(&inst); mul) {
+        value *= mul->getAmount();
+    }
+    else if (auto div = std::get_if<DivideProgram>(&inst); div) {
+        if (div->getDivisor() == 0) {
+            return std::nullopt;
+        }
+        if (div->getRemainderBehavior() == DivideProgram::Remainder::Fail && value % div->getDivisor() != 0) {
+            return false;
+        }
+        value /= div->getDivisor();
+    }
+    else if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
+        return value == eq->getAmount();
+    }
+    else if (auto modEq = std::get_if<ModEqualProgram>(&inst); modEq) {
+        if (modEq->getModulo() == 0) {
+            return std::nullopt;
+        }
+        return value % modEq->getModulo() == modEq->getAmount();
+    }
+    else if (std::holds_alternative<NotProgram>(inst)) {
+        value = value == 0 ? 1 : 0;
+    }
+    else if (auto func = std::get_if<FuncCall>(&inst); func) {
+        auto result = runCall(func->getFuncName(), value);
+        if (std::holds_alternative<NotEvaluated>(result)) {
+            return std::nullopt;
+        }
+        auto &returned = std::get<std::optional<BigInt>>(result);
+        if (returned == std::nullopt) {
+            return false;
+        }
+        value = std::move(*returned);
+    }
+    else {
+        return std::nullopt;
+    }
+
+    if (value != 0 && boost::multiprecision::msb(value) >= partialEvalMaxBits) {
+        return std::nullopt;
+    }
+    return true;
+}
+
+ConstantResult ConstantEvaluator::run(const IrFunction &function, const BigInt &input) {
+    BigInt value = input;
+    size_t blockIndex = 0;
+
+    while (true) {
+        auto &block = function.blocks[blockIndex];
+
+        bool failed = false;
+        for (auto &inst: block.instructions) {
+            if (fuel_ == 0) {
+                return NotEvaluated{};
+            }
+            fuel_--;
+
+            auto succeeded = runInstruction(inst, value);
+            if (succeeded == std::nullopt) {
+                return NotEvaluated{};
+            }
+            if (!*succeeded) {
+                failed = true;
+                break;
+            }
+        }
+
+        if (failed) {
+            if (!block.failure) {
+                return std::nullopt;
+            }
+            blockIndex = *block.failure;
+            value = input;
+        }
+        else if (block.success) {
+            blockIndex = *block.success;
+        }
+        else {
+            return value;
+        }
+    }
+}
+
+ConstantResult ConstantEvaluator::runCall(const std::string &name, const BigInt &input) {
+    auto key = std::make_pair(name, input);
+    if (auto it = results_.find(key); it != results_.end()) {
+        return it->second;
+    }
+
+    auto *function = module_.findFunction(name);
+    if (function == nullptr || depth_ >= partialEvalMaxDepth) {
+        return NotEvaluated{};
+    }
+
+    depth_++;
+    auto result = run(*function, input);
+    depth_--;
+
+    // Whether a nested call could be evaluated depends on how much fuel was
+    // left for it, so only the results of finished calls are kept.
+    if (!std::holds_alternative<NotEvaluated>(result)) {
+        results_.insert_or_assign(std::move(key), result);
+    }
+    return result;
+}
+
+ConstantResult ConstantEvaluator::call(const std::string &name, const BigInt &input) {
+    auto key = std::make_pair(name, input);
+    if (auto it = results_.find(key); it != results_.end()) {
+        return it->second;
+    }
+
+    fuel_ = partialEvalFuel;
+    auto result = runCall(name, input);
+    results_.insert_or_assign(std::move(key), result);
+    return result;
+}
+
+// Evaluates calls made with a value known at compile time, which is the case
+// after instructions such as *0 or if=3. Each call is replaced with the
+// constant it returns or an instruction which always fails, and calls which
+// take too long to evaluate are made to a copy of the function specialized for
+// the value instead, so that the work leading up to the call isn't repeated.
+class PartialEvaluationPass {
+private:
+    size_t specializationCount_ = 0;
+
+    // The function each specialized function is a copy of.
+    std::unordered_map<std::string, std::string> specializedFrom_;
+
+    // Returns the name of a copy of the function which uses the given value in
+    // place of its input, adding it to the new functions unless it already
+    // exists. Returns std::nullopt if no more copies can be made.
+    std::optional<std::string> specialize(
+        const IrModule &module,
+        const std::string &caller,
+        const std::string &name,
+        const BigInt &input,
+        std::vector<IrFunction> &newFunctions);
+
+    std::vector<Instruction> evaluateBlock(
+        const IrModule &module,
+        const std::string &caller,
+        std::span<const Instruction> instructions,
+        ConstantEvaluator &evaluator,
+        std::vector<IrFunction> &newFunctions);
+
+public:
+    bool operator()(IrModule &module);
+};
+
+std::optional<std::string> PartialEvaluationPass::specialize(
+    const IrModule &module,
+    const std::string &caller,
+    const std::string &name,
+    const BigInt &input,
+    std::vector<IrFunction> &newFunctions)
+{
+    // The space keeps the name from clashing with any function in the source,
+    // and is left out when it's shown, as name@input.
+    auto specializedName = name + std::string{specializedSeparator} + input.str();
+
+    bool exists = std::any_of(newFunctions.begin(), newFunctions.end(), [&] (const IrFunction &function) {
+        return function.name == specializedName;
+    });
+    if (exists || module.findFunction(specializedName) != nullptr) {
+        return specializedName;
+    }
+
+    // A recursive function would otherwise be specialized again for each
+    // value it calls itself with, without any of them being evaluated.
+    if (auto it = specializedFrom_.find(caller); it != specializedFrom_.end() && it->second == name) {
+        return std::nullopt;
+    }
+
+    auto *function = module.findFunction(name);
+    if (function == nullptr || specializationCount_ >= maxSpecializations || input > std::numeric_limits<uint64_t>::max()) {
+        return std::nullopt;
+    }
+    specializationCount_++;
+    specializedFrom_[specializedName] = name;
+
+    // The value is restored to the input at the start of each branch, so
+    // that's where the known value is put in its place.
+    auto &pool = *module.getConstantPool();
+    IrFunction specialized{specializedName, function->pos, function->blocks};
+    for (size_t i = 0; i < specialized.blocks.size(); i++) {
+        if (function->startsBranch(i)) {
+            auto &insts = specialized.blocks[i].instructions;
+            std::vector<Instruction> prefix{MultiplyProgram{pool, 0}};
+            if (input > 0) {
+                prefix.push_back(AddProgram{pool, input});
+            }
+            insts.insert(insts.begin(), prefix.begin(), prefix.end());
+        }
+    }
+    newFunctions.push_back(std::move(specialized));
+
+    return specializedName;
+}
+
+std::vector<Instruction> PartialEvaluationPass::evaluateBlock(
+    const IrModule &module,
+    const std::string &caller,
+    std::span<const Instruction> instructions,
+    ConstantEvaluator &evaluator,
+    std::vector<IrFunction> &newFunctions)
+{
+    auto &pool = *module.getConstantPool();
+    std::vector<Instruction> insts;
+
+    // The value at the current instruction, if it's known, and whether it
+    // still has to be set by an instruction before it can be used.
+    std::optional<BigInt> known;
+    bool pending = false;
+
+    auto setKnownValue = [&] {
+        if (pending) {
+            insts.push_back(MultiplyProgram{pool, 0});
+            if (*known > 0) {
+                insts.push_back(AddProgram{pool, *known});
+            }
+            pending = false;
+        }
+    };
+
+    for (auto &inst: instructions) {
+        if (known == std::nullopt) {
+            if (auto mul = std::get_if<MultiplyProgram>(&inst); mul && mul->getAmount() == 0) {
+                known = 0;
+                pending = true;
+                continue;
+            }
+
+            insts.push_back(inst);
+            if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
+                known = eq->getAmount();
+            }
+            continue;
+        }
+
+        auto func = std::get_if<FuncCall>(&inst);
+        std::optional<bool> succeeded;
+        auto value = *known;
+        if (func) {
+            auto result = evaluator.call(func->getFuncName(), value);
+            if (auto returned = std::get_if<std::optional<BigInt>>(&result); returned) {
+                succeeded = returned->has_value();
+                if (*succeeded) {
+                    value = std::move(**returned);
+                }
+            }
+        }
+        else {
+            succeeded = evaluator.runInstruction(inst, value);
+        }
+
+        if (succeeded == std::nullopt) {
+            // A specialized function ignores the value it's called with, so
+            // there's no need to set it first.
+            if (auto name = func ? specialize(module, caller, func->getFuncName(), *known, newFunctions) : std::nullopt; name) {
+                insts.push_back(FuncCall{pool, *name, func->getPos()});
+                known = std::nullopt;
+                pending = false;
+                continue;
+            }
+
+            setKnownValue();
+            insts.push_back(inst);
+            if (!std::holds_alternative<DebugPrint>(inst) && !std::holds_alternative<DebugStackTrace>(inst)) {
+                known = std::nullopt;
+            }
+        }
+        else if (*succeeded) {
+            pending = pending || value != *known;
+            known = std::move(value);
+        }
+        else {
+            // Nothing after this is ever reached.
+            insts.push_back(MultiplyProgram{pool, 0});
+            insts.push_back(SubtractProgram{pool, 1});
+            known = std::nullopt;
+            pending = false;
+            return insts;
+        }
+    }
+
+    setKnownValue();
+    return insts;
+}
+
+bool PartialEvaluationPass::operator()(IrModule &module) {
+    ConstantEvaluator evaluator{module};
+    std::vector<IrFunction> newFunctions;
+    bool changed = false;
+
+    auto evaluateFunctions = [&] (std::span<IrFunction> functions) {
+        for (auto &function: functions) {
+            for (auto &block: function.blocks) {
+                auto evaluated = evaluateBlock(module, function.name, block.instructions, evaluator, newFunctions);
+                if (evaluated != block.instructions) {
+                    block.instructions = std::move(evaluated);
+                    changed = true;
+                }
+            }
+        }
+    };
+
+    evaluateFunctions(module.getFunctions());
+
+    // Specialized functions are evaluated right away, since the work they
+    // save is only done once their known input has been followed through.
+    while (!newFunctions.empty()) {
+        auto first = module.getFunctions().size();
+        for (auto &function: newFunctions) {
+            module.addFunction(std::move(function));
+        }
+        newFunctions.clear();
+        changed = true;
+
+        evaluateFunctions(module.getFunctions().subspan(first));
+    }
+
+    return changed;
+}
+
+// How many inputs a recursive function is evaluated on to guess which idiom
+// it's written as.
+constexpr uint64_t idiomSamples = 64;
+
+// The largest modulus and threshold of the piecewise functions guessed for
+// idioms. Larger ones would take more branches to compute than they'd save.
+constexpr uint64_t maxIdiomModulus = 8;
+constexpr uint64_t maxIdiomThreshold = 4;
+
+// How many pieces evaluating a function symbolically may split its inputs into
+// before giving up on it.
+constexpr size_t maxSymbolicPieces = 4096;
+
+// The most residue classes a single instruction may split a piece into.
+constexpr uint64_t maxSymbolicPeriod = 64;
+
+// The value start + step * u, for the parameter u of a piece.
+struct Affine {
+    BigInt start;
+
+    BigInt step;
+};
+
+// A set of inputs to a function, given by the parameters u from 0 up to the
+// count, along with a stack of the values computed from each of them. The
+// bottom of the stack is the input itself, and the top two values are the
+// value the innermost call was made with and its current value.
+struct Piece {
+    // How many parameters the piece covers, or std::nullopt for all of them.
+    std::optional<BigInt> count;
+
+    std::vector<Affine> values;
+};
+
+struct SymbolicOutcome {
+    Piece piece;
+
+    bool failed;
+};
+
+using BranchList = std::vector<std::span<const Instruction>>;
+
+// Evaluates a function on every input at once, by splitting the inputs into
+// pieces on which each value is an affine function of the parameter. Calls the
+// function makes to itself are evaluated as calls to a candidate for what it
+// computes instead. If the function then computes the same thing as the
+// candidate, and every one of those calls is made with a smaller value than
+// the function's input, the candidate is right by induction.
+class SymbolicEvaluator {
+private:
+    const std::string &name_;
+
+    const BranchList &candidate_;
+
+    size_t pieceCount_ = 0;
+
+    // Adds the piece narrowed down to the parameters offset + stride * w, for
+    // w from 0 up to the count, unless that doesn't leave anything.
+    bool restrict(
+        const Piece &piece,
+        const BigInt &offset,
+        const BigInt &stride,
+        const std::optional<BigInt> &count,
+        std::vector<Piece> &pieces);
+
+    // Splits the piece into the parameters below the given one and the rest.
+    bool splitAt(const Piece &piece, const BigInt &at, std::vector<Piece> &below, std::vector<Piece> &rest);
+
+    // Splits the piece into pieces on which the current value always has the
+    // same remainder when divided by the modulus.
+    bool splitPeriod(const Piece &piece, const BigInt &modulus, std::vector<Piece> &pieces);
+
+    bool runCall(Piece piece, std::vector<Piece> &succeeded, std::vector<Piece> &failed);
+
+    // Runs the instruction on the piece, adding the pieces it succeeds and
+    // fails on to the lists. Returns false if it can't be evaluated.
+    bool runInstruction(const Instruction &inst, Piece piece, std::vector<Piece> &succeeded, std::vector<Piece> &failed);
+
+public:
+    SymbolicEvaluator(const std::string &name, const BranchList &candidate)
+        : name_(name)
+        , candidate_(candidate)
+    {}
+
+    // Runs the branches on the piece, whose current value must be the value
+    // the branches are called with. Returns std::nullopt if they can't be
+    // evaluated symbolically.
+    std::optional<std::vector<SymbolicOutcome>> run(const BranchList &branches, Piece piece);
+};
+
+bool SymbolicEvaluator::restrict(
+    const Piece &piece,
+    const BigInt &offset,
+    const BigInt &stride,
+    const std::optional<BigInt> &count,
+    std::vector<Piece> &pieces)
+{
+    if (count && *count <= 0) {
+        return true;
+    }
+    if (++pieceCount_ > maxSymbolicPieces) {
+        return false;
+    }
+
+    Piece restricted{count, piece.values};
+    for (auto &value: restricted.values) {
+        value.start += value.step * offset;
+        value.step *= stride;
+    }
+    pieces.push_back(std::move(restricted));
+    return true;
+}
+
+bool SymbolicEvaluator::splitAt(const Piece &piece, const BigInt &at, std::vector<Piece> &below, std::vector<Piece> &rest) {
+    BigInt limit = piece.count ? std::min(at, *piece.count) : at;
+    if (limit > 0 && !restrict(piece, 0, 1, limit, below)) {
+        return false;
+    }
+
+    std::optional<BigInt> restCount;
+    if (piece.count) {
+        restCount = *piece.count - limit;
+    }
+    return restrict(piece, limit, 1, restCount, rest);
+}
+
+bool SymbolicEvaluator::splitPeriod(const Piece &piece, const BigInt &modulus, std::vector<Piece> &pieces) {
+    BigInt period = modulus / boost::multiprecision::gcd(piece.values.back().step, modulus);
+    if (period > maxSymbolicPeriod) {
+        return false;
+    }
+
+    for (BigInt offset = 0; offset < period; offset++) {
+        std::optional<BigInt> count;
+        if (piece.count) {
+            count = (*piece.count - offset + period - 1) / period;
+        }
+        if (!restrict(piece, offset, period, count, pieces)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SymbolicEvaluator::runCall(Piece piece, std::vector<Piece> &succeeded, std::vector<Piece> &failed) {
+    // The candidate can only be assumed to be right about calls made with a
+    // smaller value than the input, on every parameter of the piece.
+    auto &input = piece.values.front();
+    auto &value = piece.values.back();
+    Affine gap{input.start - value.start, input.step - value.step};
+    if (gap.start <= 0) {
+        return false;
+    }
+    if (gap.step < 0 && (!piece.count || gap.start + gap.step * (*piece.count - 1) <= 0)) {
+        return false;
+    }
+
+    piece.values.push_back(value);
+    auto outcomes = run(candidate_, std::move(piece));
+    if (!outcomes) {
+        return false;
+    }
+
+    for (auto &[result, callFailed]: *outcomes) {
+        auto returned = std::move(result.values.back());
+        result.values.pop_back();
+        if (callFailed) {
+            failed.push_back(std::move(result));
+        }
+        else {
+            result.values.back() = std::move(returned);
+            succeeded.push_back(std::move(result));
+        }
+    }
+    return true;
+}
+
+bool SymbolicEvaluator::runInstruction(const Instruction &inst, Piece piece, std::vector<Piece> &succeeded, std::vector<Piece> &failed) {
+    auto &value = piece.values.back();
+    if (value.step < 0) {
+        return false;
+    }
+
+    if (auto add = std::get_if<AddProgram>(&inst); add) {
+        value.start += add->getAmount();
+        succeeded.push_back(std::move(piece));
+    }
+    else if (auto sub = std::get_if<SubtractProgram>(&inst); sub) {
+        auto &amount = sub->getAmount();
+        BigInt at = 0;
+        if (value.start < amount) {
+            if (value.step == 0) {
+                failed.push_back(std::move(piece));
+                return true;
+            }
+            at = (amount - value.start + value.step - 1) / value.step;
+        }
+
+        std::vector<Piece> rest;
+        if (!splitAt(piece, at, failed, rest)) {
+            return false;
+        }
+        for (auto &restPiece: rest) {
+            restPiece.values.back().start -= amount;
+            succeeded.push_back(std::move(restPiece));
+        }
+    }
+    else if (auto mul = std::get_if<MultiplyProgram>(&inst); mul) {
+        value.start *= mul->getAmount();
+        value.step *= mul->getAmount();
+        succeeded.push_back(std::move(piece));
+    }
+    else if (auto div = std::get_if<DivideProgram>(&inst); div) {
+        auto &divisor = div->getDivisor();
+        std::vector<Piece> parts;
+        if (divisor == 0 || !splitPeriod(piece, divisor, parts)) {
+            return false;
+        }
+        for (auto &part: parts) {
+            auto &partValue = part.values.back();
+            if (div->getRemainderBehavior() == DivideProgram::Remainder::Fail && partValue.start % divisor != 0) {
+                failed.push_back(std::move(part));
+                continue;
+            }
+            partValue.start /= divisor;
+            partValue.step /= divisor;
+            succeeded.push_back(std::move(part));
+        }
+    }
+    else if (auto modEq = std::get_if<ModEqualProgram>(&inst); modEq) {
+        std::vector<Piece> parts;
+        if (modEq->getModulo() == 0 || !splitPeriod(piece, modEq->getModulo(), parts)) {
+            return false;
+        }
+        for (auto &part: parts) {
+            bool equal = part.values.back().start % modEq->getModulo() == modEq->getAmount();
+            (equal ? succeeded : failed).push_back(std::move(part));
+        }
+    }
+    else if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
+        auto &amount = eq->getAmount();
+        if (value.step == 0 || value.start > amount || (amount - value.start) % value.step != 0) {
+            (value.start == amount && value.step == 0 ? succeeded : failed).push_back(std::move(piece));
+            return true;
+        }
+
+        std::vector<Piece> rest;
+        if (!splitAt(piece, (amount - value.start) / value.step, failed, rest)) {
+            return false;
+        }
+        for (auto &restPiece: rest) {
+            if (!splitAt(restPiece, 1, succeeded, failed)) {
+                return false;
+            }
+        }
+    }
+    else if (std::holds_alternative<NotProgram>(inst)) {
+        if (value.step == 0 || value.start != 0) {
+            value = {value.start == 0 && value.step == 0 ? 1 : 0, 0};
+            succeeded.push_back(std::move(piece));
+            return true;
+        }
+
+        // Only the first parameter gives a value of zero.
+        std::vector<Piece> zero, rest;
+        if (!splitAt(piece, 1, zero, rest)) {
+            return false;
+        }
+        for (auto &zeroPiece: zero) {
+            zeroPiece.values.back() = {1, 0};
+            succeeded.push_back(std::move(zeroPiece));
+        }
+        for (auto &restPiece: rest) {
+            restPiece.values.back() = {0, 0};
+            succeeded.push_back(std::move(restPiece));
+        }
+    }
+    else if (auto func = std::get_if<FuncCall>(&inst); func && func->getFuncName() == name_) {
+        return runCall(std::move(piece), succeeded, failed);
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+std::optional<std::vector<SymbolicOutcome>> SymbolicEvaluator::run(const BranchList &branches, Piece piece) {
+    std::vector<SymbolicOutcome> outcomes;
+    std::vector<Piece> pending;
+    pending.push_back(std::move(piece));
+
+    for (auto &branch: branches) {
+        auto current = std::move(pending);
+        pending.clear();
+
+        for (auto &inst: branch) {
+            std::vector<Piece> next;
+            for (auto &currentPiece: current) {
+                if (!runInstruction(inst, std::move(currentPiece), next, pending)) {
+                    return std::nullopt;
+                }
+            }
+            current = std::move(next);
+        }
+
+        for (auto &currentPiece: current) {
+            outcomes.push_back({std::move(currentPiece), false});
+        }
+
+        // The next branch starts over from the value the call was made with.
+        for (auto &pendingPiece: pending) {
+            auto &values = pendingPiece.values;
+            values.back() = values[values.size() - 2];
+        }
+    }
+
+    for (auto &pendingPiece: pending) {
+        outcomes.push_back({std::move(pendingPiece), true});
+    }
+    return outcomes;
+}
+
+// Returns whether the function computes the same thing as the candidate, which
+// mustn't make any calls.
+bool proveIdiom(const std::string &name, const BranchList &branches, const BranchList &candidate) {
+    SymbolicEvaluator evaluator{name, candidate};
+
+    Affine input{0, 1};
+    auto outcomes = evaluator.run(branches, {std::nullopt, {input, input}});
+    if (!outcomes) {
+        return false;
+    }
+
+    for (auto &[piece, failed]: *outcomes) {
+        auto &pieceInput = piece.values.front();
+        Piece check{piece.count, {pieceInput, piece.values.back(), pieceInput, pieceInput}};
+        auto results = evaluator.run(candidate, std::move(check));
+        if (!results) {
+            return false;
+        }
+
+        for (auto &[result, candidateFailed]: *results) {
+            if (candidateFailed != failed) {
+                return false;
+            }
+
+            auto &expected = result.values[1];
+            auto &actual = result.values.back();
+            bool singleInput = result.count && *result.count == 1;
+            if (!failed && (expected.start != actual.start || (!singleInput && expected.step != actual.step))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// A residue class of a piecewise function, on which it gives offset + slope *
+// w for the inputs threshold + residue + modulus * w.
+struct AffineClass {
+    BigInt offset;
+
+    BigInt slope;
+
+    bool operator==(const AffineClass &) const = default;
+};
+
+// Returns the affine function the results fit, std::nullopt if they all fail,
+// or std::nullopt inside an optional if they don't fit one.
+std::optional<std::optional<AffineClass>> fitClass(std::span<const std::optional<BigInt>> results) {
+    if (std::all_of(results.begin(), results.end(), [] (auto &result) { return !result; })) {
+        return std::optional<AffineClass>{};
+    }
+    if (std::any_of(results.begin(), results.end(), [] (auto &result) { return !result; })) {
+        return std::nullopt;
+    }
+
+    AffineClass fit{*results[0], 0};
+    if (results.size() > 1) {
+        fit.slope = *results[1] - fit.offset;
+    }
+    if (fit.slope < 0) {
+        return std::nullopt;
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        if (*results[i] != fit.offset + fit.slope * i) {
+            return std::nullopt;
+        }
+    }
+    return fit;
+}
+
+// Returns the instructions taking the input from w to offset + slope * w.
+std::vector<Instruction> affineInstructions(ConstantPool &pool, const AffineClass &fit) {
+    std::vector<Instruction> insts;
+    if (fit.slope != 1) {
+        insts.push_back(MultiplyProgram{pool, fit.slope});
+    }
+    if (fit.offset != 0) {
+        insts.push_back(AddProgram{pool, fit.offset});
+    }
+    return insts;
+}
+
+// Guesses what a recursive function computes from its results on the first
+// few inputs, as a piecewise function. Each input below a threshold has its own
+// result, and from the threshold on, each residue class threshold + r +
+// modulus * w either always fails or gives an affine function of w. Returns the
+// branches computing it, or std::nullopt if there's no such function.
+std::optional<std::vector<std::vector<Instruction>>> fitIdiom(ConstantPool &pool, std::span<const std::optional<BigInt>> samples) {
+    for (uint64_t modulus = 1; modulus <= maxIdiomModulus; modulus++) {
+        for (uint64_t threshold = 0; threshold <= maxIdiomThreshold; threshold++) {
+            std::vector<std::optional<AffineClass>> classes;
+            for (uint64_t residue = 0; residue < modulus; residue++) {
+                std::vector<std::optional<BigInt>> results;
+                for (auto input = threshold + residue; input < samples.size(); input += modulus) {
+                    results.push_back(samples[input]);
+                }
+
+                auto fit = fitClass(results);
+                if (!fit) {
+                    break;
+                }
+                classes.push_back(std::move(*fit));
+            }
+            if (classes.size() < modulus) {
+                continue;
+            }
+
+            std::vector<std::vector<Instruction>> branches;
+            for (uint64_t input = 0; input < threshold; input++) {
+                if (auto &result = samples[input]; result) {
+                    std::vector<Instruction> branch{EqualProgram{pool, input}};
+                    if (*result != input) {
+                        branch.push_back(MultiplyProgram{pool, 0});
+                        branch.push_back(AddProgram{pool, *result});
+                    }
+                    branches.push_back(std::move(branch));
+                }
+            }
+
+            std::vector<Instruction> prefix;
+            if (threshold > 0) {
+                prefix.push_back(SubtractProgram{pool, threshold});
+            }
+
+            // When every class has the same function, or only the first one
+            // doesn't fail, it's a single division.
+            bool sameClasses = std::all_of(classes.begin(), classes.end(), [&] (auto &fit) { return fit == classes[0]; });
+            bool onlyFirst = classes[0] && std::all_of(classes.begin() + 1, classes.end(), [] (auto &fit) { return !fit; });
+            if (sameClasses || onlyFirst) {
+                if (modulus > 1) {
+                    auto remainder = sameClasses ? DivideProgram::Remainder::Floor : DivideProgram::Remainder::Fail;
+                    prefix.push_back(DivideProgram{pool, modulus, remainder});
+                }
+                if (classes[0]) {
+                    auto insts = affineInstructions(pool, *classes[0]);
+                    prefix.insert(prefix.end(), insts.begin(), insts.end());
+                    branches.push_back(std::move(prefix));
+                }
+            }
+            else {
+                for (uint64_t residue = 0; residue < modulus; residue++) {
+                    if (!classes[residue]) {
+                        continue;
+                    }
+                    auto branch = prefix;
+                    branch.push_back(ModEqualProgram{pool, residue, modulus});
+                    branch.push_back(DivideProgram{pool, modulus, DivideProgram::Remainder::Floor});
+                    auto insts = affineInstructions(pool, *classes[residue]);
+                    branch.insert(branch.end(), insts.begin(), insts.end());
+                    branches.push_back(std::move(branch));
+                }
+            }
+
+            if (branches.empty()) {
+                branches.push_back({MultiplyProgram{pool, 0}, SubtractProgram{pool, 1}});
+            }
+            return branches;
+        }
+    }
+
+    return std::nullopt;
+}
+
+// Returns the results of the function on each of the sample inputs, or
+// std::nullopt if any of them couldn't be evaluated at compile time.
+std::optional<std::vector<std::optional<BigInt>>> sampleFunction(ConstantEvaluator &evaluator, const IrFunction &function) {
+    std::vector<std::optional<BigInt>> samples;
+    for (uint64_t input = 0; input < idiomSamples; input++) {
+        auto result = evaluator.call(function.name, input);
+        if (std::holds_alternative<NotEvaluated>(result)) {
+            return std::nullopt;
+        }
+        samples.push_back(std::get<std::optional<BigInt>>(std::move(result)));
+    }
+    return samples;
+}
+
+// What the idiom pass found out about a function it couldn't replace. None of
+// the passes change what a function computes, so once it has been sampled,
+// the idiom fitting the samples stays the same, and only the proof needs to
+// be tried again when the function's blocks change.
+struct IdiomAttempt {
+    // The blocks of the function when it was last tried.
+    std::vector<BasicBlock> blocks;
+
+    // Whether every sample could be evaluated. If not, the function is
+    // sampled again once it changes, as it may have been simplified enough
+    // to evaluate.
+    bool sampled = false;
+
+    // The idiom fitting the samples, if there is one.
+    std::optional<std::vector<std::vector<Instruction>>> candidate;
+};
+
+// The attempts for each function, keyed by its name, which are kept across
+// rounds so that sampling, by far the slowest part of the pass, isn't
+// repeated for functions which haven't changed.
+using IdiomAttempts = std::unordered_map<std::string, IdiomAttempt>;
+
+// Replaces recursive functions with the arithmetic they compute, however
+// they're written. A piecewise function is guessed from the results of each
+// function on its first few inputs, and it's only used if the function can be
+// proven to compute it.
+bool recognizeIdioms(IrModule &module, IdiomAttempts &attempts) {
+    ConstantEvaluator evaluator{module};
+    bool changed = false;
+
+    for (auto &function: module.getFunctions()) {
+        auto branches = getBranches(function);
+        bool recursive = std::any_of(branches.begin(), branches.end(), [&] (std::span<const Instruction> branch) {
+            return std::any_of(branch.begin(), branch.end(), [&] (const Instruction &inst) {
+                auto func = std::get_if<FuncCall>(&inst);
+                return func && func->getFuncName() == function.name;
+            });
+        });
+        if (!recursive) {
             continue;
         }
 
-        auto divide = checkDivision(prog, name);
-        if (divide != std::nullopt) {
-            auto [divisor, failBehavior] = *divide;
-            prog = Program{{Branch{{DivideProgram{divisor, failBehavior}}}}};
+        auto [it, firstAttempt] = attempts.try_emplace(function.name);
+        auto &attempt = it->second;
+        if (!firstAttempt && (attempt.blocks == function.blocks || (attempt.sampled && !attempt.candidate))) {
             continue;
         }
 
-        auto eq = checkIfEqual(prog);
-        if (eq != std::nullopt) {
-            prog = Program{{Branch{{EqualProgram{*eq}}}}};
+        if (!attempt.sampled) {
+            auto samples = sampleFunction(evaluator, function);
+            attempt.sampled = samples.has_value();
+            if (samples) {
+                attempt.candidate = fitIdiom(*module.getConstantPool(), *samples);
+            }
+        }
+        attempt.blocks = function.blocks;
+        if (!attempt.candidate) {
             continue;
         }
 
-        if (checkNot(prog)) {
-            prog = Program{{Branch{{NotProgram{}}}}};
+        BranchList candidateBranches{attempt.candidate->begin(), attempt.candidate->end()};
+        if (!proveIdiom(function.name, branches, candidateBranches)) {
             continue;
         }
 
-        auto modEq = checkModEqual(prog, name);
-        if (modEq != std::nullopt) {
-            auto &[equalVal, divisor] = *modEq;
-            prog = Program{{Branch{{ModEqualProgram{equalVal, divisor}}}}};
+        auto candidate = std::move(*attempt.candidate);
+        attempts.erase(it);
+
+        function.blocks.clear();
+        for (size_t i = 0; i < candidate.size(); i++) {
+            std::optional<size_t> failure;
+            if (i + 1 < candidate.size()) {
+                failure = i + 1;
+            }
+            function.blocks.push_back({std::move(candidate[i]), std::nullopt, failure});
+        }
+        changed = true;
+    }
+
+    return changed;
+}
+
+// Returns the passes run after each round of inlining, in the order they run.
+// The passes which transform functions in parallel use the given threads.
+PassManager getPasses(const OptimizerOptions &options, ParallelThreads &threads) {
+    PassManager passes;
+
+    if (options.condenseMath) {
+        passes.add("condense", [&threads] (IrModule &module) {
+            return condenseMath(module, threads);
+        });
+    }
+
+    if (options.simplifyMultiply) {
+        passes.add("multiply", [&threads] (IrModule &module) {
+            return replaceFunctions(module, threads, [] (ConstantPool &pool, const IrFunction &function) -> std::optional<Instruction> {
+                auto factor = checkMultiply(function);
+                if (factor == std::nullopt) {
+                    return std::nullopt;
+                }
+                return MultiplyProgram{pool, *factor};
+            });
+        });
+    }
+
+    if (options.simplifyDivide) {
+        passes.add("divide", [&threads] (IrModule &module) {
+            return replaceFunctions(module, threads, [] (ConstantPool &pool, const IrFunction &function) -> std::optional<Instruction> {
+                auto divide = checkDivision(function);
+                if (divide == std::nullopt) {
+                    return std::nullopt;
+                }
+                auto &[divisor, failBehavior] = *divide;
+                return DivideProgram{pool, divisor, failBehavior};
+            });
+        });
+    }
+
+    if (options.simplifyEqual) {
+        passes.add("equal", [&threads] (IrModule &module) {
+            return replaceFunctions(module, threads, [] (ConstantPool &pool, const IrFunction &function) -> std::optional<Instruction> {
+                auto eq = checkIfEqual(function);
+                if (eq == std::nullopt) {
+                    return std::nullopt;
+                }
+                return EqualProgram{pool, *eq};
+            });
+        });
+    }
+
+    if (options.simplifyNot) {
+        passes.add("not", [&threads] (IrModule &module) {
+            return replaceFunctions(module, threads, [] (ConstantPool &, const IrFunction &function) -> std::optional<Instruction> {
+                if (!checkNot(function)) {
+                    return std::nullopt;
+                }
+                return NotProgram{};
+            });
+        });
+    }
+
+    if (options.simplifyModEqual) {
+        passes.add("mod-eq", [&threads] (IrModule &module) {
+            return replaceFunctions(module, threads, [] (ConstantPool &pool, const IrFunction &function) -> std::optional<Instruction> {
+                auto modEq = checkModEqual(function);
+                if (modEq == std::nullopt) {
+                    return std::nullopt;
+                }
+                auto &[equalVal, divisor] = *modEq;
+                return ModEqualProgram{pool, equalVal, divisor};
+            });
+        });
+    }
+
+    if (options.recognizeIdioms) {
+        passes.add("idiom", [attempts = std::make_shared<IdiomAttempts>()] (IrModule &module) {
+            return recognizeIdioms(module, *attempts);
+        });
+    }
+
+    if (options.partialEvaluate) {
+        passes.add("partial", PartialEvaluationPass{});
+    }
+
+    return passes;
+}
+
+// Splits each of the named functions which still has more than one branch into
+// a function with its first branch and one with the rest, so that calls to it
+// can start the rest before running the first. The function itself is kept,
+// for entry points and for when nothing can be spared to speculate.
+void splitSpeculatedFunctions(IrModule &module, std::span<const std::string> names) {
+    for (auto &name: names) {
+        auto function = module.findFunction(name);
+        if (function == nullptr || !function->isBranchList() || function->blocks.size() < 2) {
             continue;
         }
+
+        IrFunction first{name + " first", function->pos, {function->blocks.front()}};
+        first.blocks.front().failure = std::nullopt;
+
+        IrFunction rest{name + " rest", function->pos, {function->blocks.begin() + 1, function->blocks.end()}};
+        for (auto &block: rest.blocks) {
+            if (block.failure) {
+                *block.failure -= 1;
+            }
+        }
+
+        module.addSpeculation(name, {first.name, rest.name});
+        module.addFunction(std::move(first));
+        module.addFunction(std::move(rest));
     }
 }
 
 } // anonymous namespace
 
-ProgramMap optimizePrograms(ProgramMap programs, const std::string &programName) {
-    bool keepOptimizing = true;
+OptimizerOptions OptimizerOptions::forLevel(unsigned level) {
+    OptimizerOptions options;
+    for (auto flag: optimizerPassFlags) {
+        options.*flag = level >= defaultOptimizationLevel;
+    }
+
+    if (level == 1) {
+        options.inlinePrograms = true;
+        options.condenseMath = true;
+    }
+
+    options.partialEvaluate = level >= 3;
+
+    return options;
+}
 
-    while (keepOptimizing) {
-        keepOptimizing = inlinePrograms(programs, programName);
-        if (keepOptimizing) {
-            condenseMath(programs);
-            simplifyFunctions(programs);
+bool OptimizerOptions::setPass(std::string_view name, bool enabled) {
+    for (size_t i = 0; i < optimizerPassNames.size(); i++) {
+        if (optimizerPassNames[i] == name) {
+            this->*optimizerPassFlags[i] = enabled;
+            return true;
         }
     }
 
-    return programs;
+    return false;
+}
+
+std::string OptimizerOptions::toString() const {
+    std::string passes;
+    for (size_t i = 0; i < optimizerPassNames.size(); i++) {
+        if (this->*optimizerPassFlags[i]) {
+            if (!passes.empty()) {
+                passes += ',';
+            }
+            passes += optimizerPassNames[i];
+        }
+    }
+    return passes;
+}
+
+IrModule optimizePrograms(
+    const ProgramMap &programs,
+    const std::string &programName,
+    std::shared_ptr<ConstantPool> pool,
+    const OptimizerOptions &options,
+    CompileStats *stats,
+    ParallelThreads *threads)
+{
+    return optimizePrograms(programs, std::span{&programName, 1}, std::move(pool), options, stats, threads);
+}
+
+IrModule optimizePrograms(
+    const ProgramMap &programs,
+    std::span<const std::string> programNames,
+    std::shared_ptr<ConstantPool> pool,
+    const OptimizerOptions &options,
+    CompileStats *stats,
+    ParallelThreads *threads)
+{
+    std::optional<ParallelThreads> ownThreads;
+    if (threads == nullptr) {
+        threads = &ownThreads.emplace(options.threads);
+    }
+
+    auto module = timePhase(stats, "lower", [&] {
+        return lowerPrograms(programs, programNames, std::move(pool));
+    });
+    auto passes = getPasses(options, *threads);
+
+    // Inlining can expose more functions to simplify, and simplifying
+    // functions can make them inlinable, so this is repeated until nothing
+    // more can be inlined.
+    if (options.inlinePrograms) {
+        auto inlinePass = [&] (IrModule &module) {
+            return inlineFunctions(module, *threads);
+        };
+        for (size_t round = 1; runPass("inline", inlinePass, module, stats, round); round++) {
+            passes.run(module, stats, round);
+        }
+    }
+    else {
+        passes.run(module, stats);
+    }
+
+    splitSpeculatedFunctions(module, options.speculate);
+
+    return module;
 }
 
 } // namespace unacpp
@@ -60,11 +60,11 @@ Branch Parser::parseBranch() {
             if (program != std::nullopt) {
                 auto progName = getAnonymousProgramName();
                 programs_.insert({progName, *program});
-                instructions.push_back(FuncCall{progName, token->pos});
+                instructions.push_back(FuncCall{*pool_, progName, token->pos});
             }
         }
         else {
-            instructions.push_back(FuncCall{token->content, token->pos});
+            instructions.push_back(FuncCall{*pool_, token->content, token->pos});
         }
     }
 
@@ -98,7 +98,7 @@ std::optional<Program> Parser::parseProgram() {
         return std::nullopt;
     }
 
-    return Program{std::move(branches)};
+    return Program{std::move(branches), startGroup->pos};
 }
 
 void Parser::parseExpression(std::string_view expr) {
@@ -115,8 +115,8 @@ void Parser::parseExpression(std::string_view expr) {
         errors_.emplace_back(tokens_[index_].pos, "Unexpected " + std::string{tokens_[index_].content} + " encountered");
     }
 
-    exprName_ = getAnonymousProgramName();
-    programs_.insert({exprName_, Program{branches}});
+    exprNames_.push_back(getAnonymousProgramName());
+    programs_.insert({exprNames_.back(), Program{branches, {1, 1}}});
 }
 
 void Parser::parseNamedProgram() {
@@ -149,7 +149,7 @@ void Parser::parseFilePrograms() {
 void Parser::checkForUndefinedPrograms(const Branch &branch) {
     for (auto &inst: branch.getInstructions()) {
         auto *func = std::get_if<FuncCall>(&inst);
-        if (func && !programs_.count(func->getFuncName())) {
+        if (func && !programs_.count(func->getFuncName()) && !externalNames_.count(func->getFuncName())) {
             errors_.emplace_back(func->getPos(), "Undefined program: " + std::string{func->getFuncName()});
         }
     }
@@ -164,26 +164,68 @@ void Parser::checkForUndefinedPrograms() {
 }
 
 Parser::Parser(std::string_view fileContent, std::string_view expr, bool debugMode)
-    : tokens_(getTokens(fileContent))
-    , index_(0)
+    : Parser(getTokens(fileContent), expr, debugMode)
 {
-    programs_.insert({"-", Program{{Branch{{SubtractProgram{1}}}}}});
-    programs_.insert({"+", Program{{Branch{{AddProgram{1}}}}}});
+}
+
+void Parser::addBuiltinPrograms(bool debugMode) {
+    programs_.insert({"-", Program{{Branch{{SubtractProgram{*pool_, 1}}}}, {0, 0}}});
+    programs_.insert({"+", Program{{Branch{{AddProgram{*pool_, 1}}}}, {0, 0}}});
 
     if (debugMode) {
-        programs_.insert({"!", Program{{Branch{{DebugPrint{}}}}}});
+        programs_.insert({"!", Program{{Branch{{DebugPrint{}}}}, {0, 0}}});
+        programs_.insert({"?", Program{{Branch{{DebugStackTrace{}}}}, {0, 0}}});
     }
     else {
-        programs_.insert({"!", Program{{Branch{{}}}}});
+        programs_.insert({"!", Program{{Branch{{}}}, {0, 0}}});
+        programs_.insert({"?", Program{{Branch{{}}}, {0, 0}}});
     }
+}
 
+Parser::Parser(std::vector<Token> tokens, std::string_view expr, bool debugMode)
+    : tokens_(std::move(tokens))
+    , index_(0)
+    , pool_(std::make_shared<ConstantPool>())
+{
+    addBuiltinPrograms(debugMode);
     parseFilePrograms();
     parseExpression(expr);
     checkForUndefinedPrograms();
 }
 
+Parser::Parser(
+    std::string_view fileContent,
+    std::span<const std::string> exprs,
+    bool debugMode,
+    std::span<const std::string> externalNames)
+    : Parser(getTokens(fileContent), exprs, debugMode, externalNames)
+{
+}
+
+Parser::Parser(
+    std::vector<Token> tokens,
+    std::span<const std::string> exprs,
+    bool debugMode,
+    std::span<const std::string> externalNames)
+    : tokens_(std::move(tokens))
+    , index_(0)
+    , pool_(std::make_shared<ConstantPool>())
+    , externalNames_(externalNames.begin(), externalNames.end())
+{
+    addBuiltinPrograms(debugMode);
+    parseFilePrograms();
+    for (auto &expr: exprs) {
+        parseExpression(expr);
+    }
+    checkForUndefinedPrograms();
+}
+
 const std::string &Parser::getExpressionName() const {
-    return exprName_;
+    return exprNames_.front();
+}
+
+const std::vector<std::string> &Parser::getExpressionNames() const {
+    return exprNames_;
 }
 
 FileParseResult Parser::getParseResult() const {
@@ -195,4 +237,8 @@ FileParseResult Parser::getParseResult() const {
     }
 }
 
+const std::shared_ptr<ConstantPool> &Parser::getConstantPool() const {
+    return pool_;
+}
+
 } // namespace unacpp
@@ -0,0 +1,179 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+
+namespace unacpp {
+
+Profiler::Profiler(const BytecodeModule &bytecode)
+    : bytecode_(bytecode)
+    , addressFunctions_(bytecode.instructions.size())
+    , stats_(bytecode.functions.size())
+    , activeCounts_(bytecode.functions.size())
+    , nodes_{{0, 0, {}, 0}}
+    , instructionCount_(0)
+{
+    auto &functions = bytecode.functions;
+
+    for (size_t i = 0; i < functions.size(); i++) {
+        auto start = functions[i].branchStarts[0];
+        auto end = i + 1 < functions.size() ? functions[i + 1].branchStarts[0] : addressFunctions_.size();
+        std::fill(addressFunctions_.begin() + start, addressFunctions_.begin() + end, static_cast<uint32_t>(i));
+        stats_[i].branchFailures.resize(functions[i].branchStarts.size());
+    }
+}
+
+size_t Profiler::getChildNode(size_t parent, size_t function) {
+    for (auto [childFunc, child]: nodes_[parent].children) {
+        if (childFunc == function) {
+            return child;
+        }
+    }
+
+    auto child = nodes_.size();
+    nodes_.push_back({function, parent, {}, 0});
+    nodes_[parent].children.emplace_back(function, child);
+    return child;
+}
+
+void Profiler::startCall(size_t function, size_t parentNode) {
+    auto node = getChildNode(parentNode, function);
+    calls_.push_back({function, node, instructionCount_, Clock::now()});
+    stats_[function].calls++;
+    activeCounts_[function]++;
+}
+
+void Profiler::finishCall() {
+    auto call = calls_.back();
+    calls_.pop_back();
+
+    // Only the outermost of the recursive calls to a function contributes to
+    // its inclusive totals, so that the time isn't counted multiple times.
+    if (--activeCounts_[call.function] == 0) {
+        auto &stats = stats_[call.function];
+        stats.inclusiveInstructions += instructionCount_ - call.startInstructions;
+        stats.inclusiveTime += Clock::now() - call.startTime;
+    }
+}
+
+void Profiler::startEvaluation(uint32_t address) {
+    startCall(addressFunctions_[address], 0);
+}
+
+void Profiler::finishEvaluation() {
+    while (!calls_.empty()) {
+        finishCall();
+    }
+}
+
+void Profiler::callFunction(uint32_t address) {
+    startCall(addressFunctions_[address], calls_.back().node);
+}
+
+void Profiler::tailCallFunction(uint32_t address) {
+    auto parentNode = nodes_[calls_.back().node].parent;
+    finishCall();
+    startCall(addressFunctions_[address], parentNode);
+}
+
+void Profiler::returnFromFunction(uint32_t address, bool failed) {
+    if (failed) {
+        branchFailed(address);
+    }
+    finishCall();
+}
+
+void Profiler::branchFailed(uint32_t address) {
+    auto function = addressFunctions_[address];
+    auto branch = getBranchIndex(bytecode_.functions[function], address);
+    stats_[function].branchFailures[branch]++;
+}
+
+const std::vector<Profiler::FunctionStats> &Profiler::getStats() const {
+    return stats_;
+}
+
+std::string Profiler::getReport() const {
+    std::vector<uint64_t> selfInstructions(stats_.size());
+    for (size_t i = 1; i < nodes_.size(); i++) {
+        selfInstructions[nodes_[i].function] += nodes_[i].selfInstructions;
+    }
+
+    std::vector<size_t> order(stats_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+        return selfInstructions[a] > selfInstructions[b];
+    });
+
+    std::stringstream stream;
+    stream << std::left << std::setw(24) << "Function" << std::setw(12) << "Location" << std::right
+           << std::setw(12) << "Calls"
+           << std::setw(16) << "Self insts"
+           << std::setw(16) << "Total insts"
+           << std::setw(14) << "Total ms"
+           << "  Branch failures\n";
+
+    for (auto function: order) {
+        auto &stats = stats_[function];
+        if (stats.calls == 0) {
+            continue;
+        }
+
+        auto &pos = bytecode_.functions[function].pos;
+        auto location = function == 0 || pos.line == 0
+            ? std::string{"-"}
+            : std::to_string(pos.line) + ":" + std::to_string(pos.col);
+        auto millis = std::chrono::duration<double, std::milli>(stats.inclusiveTime).count();
+
+        stream << std::left << std::setw(24) << getDisplayName(bytecode_, function) << std::setw(12) << location << std::right
+               << std::setw(12) << stats.calls
+               << std::setw(16) << selfInstructions[function]
+               << std::setw(16) << stats.inclusiveInstructions
+               << std::setw(14) << std::fixed << std::setprecision(3) << millis
+               << " ";
+
+        for (auto failures: stats.branchFailures) {
+            stream << ' ' << failures;
+        }
+        stream << '\n';
+    }
+
+    return stream.str();
+}
+
+std::string Profiler::getCollapsedStacks() const {
+    std::stringstream stream;
+
+    for (size_t i = 1; i < nodes_.size(); i++) {
+        if (nodes_[i].selfInstructions == 0) {
+            continue;
+        }
+
+        std::vector<std::string> names;
+        for (auto node = i; node != 0; node = nodes_[node].parent) {
+            auto name = getDisplayName(bytecode_, nodes_[node].function);
+            // Semicolons separate the frames of a stack in this format.
+            std::replace(name.begin(), name.end(), ';', ':');
+            names.push_back(std::move(name));
+        }
+
+        for (auto name = names.rbegin(); name != names.rend(); ++name) {
+            stream << (name == names.rbegin() ? "" : ";") << *name;
+        }
+        stream << ' ' << nodes_[i].selfInstructions << '\n';
+    }
+
+    return stream.str();
+}
+
+} // namespace unacpp
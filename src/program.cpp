@@ -7,78 +7,111 @@
 //
 
 #include "program.hpp"
+#include "intern.hpp"
+
+#include <type_traits>
 
 namespace unacpp {
 
-AddProgram::AddProgram(BigInt amount)
-    : amount_(std::move(amount))
+// The optimizer copies instructions all the time, which mustn't allocate.
+static_assert(std::is_trivially_copyable_v<Instruction>);
+
+AddProgram::AddProgram(ConstantPool &pool, BigInt amount)
+    : amount_(&pool.internConstant(std::move(amount)))
 {}
 
 const BigInt &AddProgram::getAmount() const {
-    return amount_;
+    return *amount_;
 }
 
-DivideProgram::DivideProgram(BigInt divisor, Remainder remainder)
-    : divisor_(std::move(divisor))
+DivideProgram::DivideProgram(ConstantPool &pool, BigInt divisor, Remainder remainder)
+    : divisor_(&pool.internConstant(std::move(divisor)))
     , remainder_(remainder)
 {}
 
 const BigInt &DivideProgram::getDivisor() const {
-    return divisor_;
+    return *divisor_;
 }
 
 DivideProgram::Remainder DivideProgram::getRemainderBehavior() const {
     return remainder_;
 }
 
-EqualProgram::EqualProgram(BigInt amount)
-    : amount_(std::move(amount))
+EqualProgram::EqualProgram(ConstantPool &pool, BigInt amount)
+    : amount_(&pool.internConstant(std::move(amount)))
 {}
 
 const BigInt &EqualProgram::getAmount() const {
-    return amount_;
+    return *amount_;
 }
 
-FuncCall::FuncCall(std::string_view funcName, FilePosition pos)
-    : funcName_(funcName)
+FuncCall::FuncCall(ConstantPool &pool, std::string_view funcName, FilePosition pos)
+    : funcName_(&pool.internName(funcName))
     , pos_(pos)
 {}
 
 const std::string &FuncCall::getFuncName() const {
-    return funcName_;
+    return *funcName_;
 }
 
 const FilePosition &FuncCall::getPos() const {
     return pos_;
 }
 
-ModEqualProgram::ModEqualProgram(BigInt amount, BigInt modulo)
-    : amount_(std::move(amount))
-    , modulo_(std::move(modulo))
+ModEqualProgram::ModEqualProgram(ConstantPool &pool, BigInt amount, BigInt modulo)
+    : amount_(&pool.internConstant(std::move(amount)))
+    , modulo_(&pool.internConstant(std::move(modulo)))
 {}
 
 const BigInt &ModEqualProgram::getAmount() const {
-    return amount_;
+    return *amount_;
 }
 
 const BigInt &ModEqualProgram::getModulo() const {
-    return modulo_;
+    return *modulo_;
 }
 
-MultiplyProgram::MultiplyProgram(BigInt amount)
-    : amount_(std::move(amount))
+MultiplyProgram::MultiplyProgram(ConstantPool &pool, BigInt amount)
+    : amount_(&pool.internConstant(std::move(amount)))
 {}
 
 const BigInt &MultiplyProgram::getAmount() const {
-    return amount_;
+    return *amount_;
 }
 
-SubtractProgram::SubtractProgram(BigInt amount)
-    : amount_(std::move(amount))
+SubtractProgram::SubtractProgram(ConstantPool &pool, BigInt amount)
+    : amount_(&pool.internConstant(std::move(amount)))
 {}
 
 const BigInt &SubtractProgram::getAmount() const {
-    return amount_;
+    return *amount_;
+}
+
+Instruction copyInstruction(ConstantPool &pool, const Instruction &inst) {
+    if (auto add = std::get_if<AddProgram>(&inst); add) {
+        return AddProgram{pool, add->getAmount()};
+    }
+    else if (auto div = std::get_if<DivideProgram>(&inst); div) {
+        return DivideProgram{pool, div->getDivisor(), div->getRemainderBehavior()};
+    }
+    else if (auto eq = std::get_if<EqualProgram>(&inst); eq) {
+        return EqualProgram{pool, eq->getAmount()};
+    }
+    else if (auto call = std::get_if<FuncCall>(&inst); call) {
+        return FuncCall{pool, call->getFuncName(), call->getPos()};
+    }
+    else if (auto modEq = std::get_if<ModEqualProgram>(&inst); modEq) {
+        return ModEqualProgram{pool, modEq->getAmount(), modEq->getModulo()};
+    }
+    else if (auto mul = std::get_if<MultiplyProgram>(&inst); mul) {
+        return MultiplyProgram{pool, mul->getAmount()};
+    }
+    else if (auto sub = std::get_if<SubtractProgram>(&inst); sub) {
+        return SubtractProgram{pool, sub->getAmount()};
+    }
+
+    // The rest don't point to anything.
+    return inst;
 }
 
 Branch::Branch(std::vector<Instruction> instructions)
@@ -89,12 +122,17 @@ std::span<const Instruction> Branch::getInstructions() const {
     return std::span{instructions_.begin(), instructions_.size()};
 }
 
-Program::Program(std::vector<Branch> branches)
+Program::Program(std::vector<Branch> branches, FilePosition pos)
     : branches_(std::move(branches))
+    , pos_(pos)
 {}
 
 std::span<const Branch> Program::getBranches() const {
     return std::span{branches_.begin(), branches_.size()};
 }
 
+const FilePosition &Program::getPos() const {
+    return pos_;
+}
+
 } // namespace unacpp
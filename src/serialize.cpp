@@ -0,0 +1,96 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "serialize.hpp"
+
+#include <iterator>
+
+namespace unacpp {
+
+void writeUint32(std::vector<uint8_t> &data, uint32_t val) {
+    data.push_back((val >> 24) & 0xFF);
+    data.push_back((val >> 16) & 0xFF);
+    data.push_back((val >>  8) & 0xFF);
+    data.push_back((val >>  0) & 0xFF);
+}
+
+void writeString(std::vector<uint8_t> &data, std::string_view str) {
+    writeUint32(data, static_cast<uint32_t>(str.size()));
+    data.insert(data.end(), str.begin(), str.end());
+}
+
+void writeBigInt(std::vector<uint8_t> &data, const BigInt &num) {
+    std::vector<uint8_t> bytes;
+    boost::multiprecision::export_bits(num, std::back_inserter(bytes), 8);
+    writeUint32(data, static_cast<uint32_t>(bytes.size()));
+    data.insert(data.end(), bytes.begin(), bytes.end());
+}
+
+ByteReader::ByteReader(std::span<const uint8_t> data)
+    : data_(data)
+    , index_(0)
+{}
+
+std::optional<std::span<const uint8_t>> ByteReader::getBytes(size_t count) {
+    if (data_.size() - index_ < count) {
+        return std::nullopt;
+    }
+    auto bytes = data_.subspan(index_, count);
+    index_ += count;
+    return bytes;
+}
+
+std::optional<uint8_t> ByteReader::getUint8() {
+    auto bytes = getBytes(1);
+    if (bytes == std::nullopt) {
+        return std::nullopt;
+    }
+    return (*bytes)[0];
+}
+
+std::optional<uint32_t> ByteReader::getUint32() {
+    auto bytes = getBytes(4);
+    if (bytes == std::nullopt) {
+        return std::nullopt;
+    }
+    return static_cast<uint32_t>(
+        ((*bytes)[0] << 24) | ((*bytes)[1] << 16) | ((*bytes)[2] << 8) | ((*bytes)[3] << 0)
+    );
+}
+
+std::optional<std::string> ByteReader::getString() {
+    auto size = getUint32();
+    if (size == std::nullopt) {
+        return std::nullopt;
+    }
+    auto bytes = getBytes(*size);
+    if (bytes == std::nullopt) {
+        return std::nullopt;
+    }
+    return std::string{bytes->begin(), bytes->end()};
+}
+
+std::optional<BigInt> ByteReader::getBigInt() {
+    auto size = getUint32();
+    if (size == std::nullopt) {
+        return std::nullopt;
+    }
+    auto bytes = getBytes(*size);
+    if (bytes == std::nullopt) {
+        return std::nullopt;
+    }
+    BigInt num;
+    boost::multiprecision::import_bits(num, bytes->begin(), bytes->end(), 8);
+    return num;
+}
+
+bool ByteReader::atEnd() const {
+    return index_ == data_.size();
+}
+
+} // namespace unacpp
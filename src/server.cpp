@@ -0,0 +1,323 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "server.hpp"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+namespace unacpp {
+
+namespace {
+
+// Connections sending a message larger than this are closed.
+constexpr uint32_t maxMessageSize = 64 * 1024 * 1024;
+
+// Once the pool holds more modules than this, the least recently used one is
+// dropped.
+constexpr size_t maxPooledModules = 256;
+
+// A connection from a client, which is closed once the client stops sending
+// requests and every response to it has been sent.
+class Connection {
+private:
+    int fd_;
+
+    std::mutex writeMutex_;
+
+    bool readFully(char *data, size_t size) {
+        while (size > 0) {
+            auto count = recv(fd_, data, size, 0);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool writeFully(const char *data, size_t size) {
+        while (size > 0) {
+            auto count = send(fd_, data, size, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+public:
+    explicit Connection(int fd)
+        : fd_(fd)
+    {}
+
+    Connection(const Connection &) = delete;
+
+    Connection &operator=(const Connection &) = delete;
+
+    ~Connection() {
+        close(fd_);
+    }
+
+    // Returns the next message, or std::nullopt once the client is done.
+    std::optional<std::string> readMessage() {
+        unsigned char header[4];
+        if (!readFully(reinterpret_cast<char *>(header), sizeof(header))) {
+            return std::nullopt;
+        }
+
+        uint32_t size = 0;
+        for (auto byte: header) {
+            size = (size << 8) | byte;
+        }
+        if (size > maxMessageSize) {
+            return std::nullopt;
+        }
+
+        std::string message(size, '\0');
+        if (!readFully(message.data(), size)) {
+            return std::nullopt;
+        }
+        return message;
+    }
+
+    void writeMessage(const std::string &message) {
+        auto size = static_cast<uint32_t>(message.size());
+        std::string data;
+        data.reserve(message.size() + 4);
+        data += static_cast<char>(size >> 24);
+        data += static_cast<char>(size >> 16);
+        data += static_cast<char>(size >> 8);
+        data += static_cast<char>(size >> 0);
+        data += message;
+
+        // A client which went away doesn't get its responses, but that's its
+        // own problem.
+        std::lock_guard lock{writeMutex_};
+        writeFully(data.data(), data.size());
+    }
+};
+
+std::string errorResponse(const std::string &id, const std::string &message) {
+    return id + "\nerror\n" + message;
+}
+
+} // anonymous namespace
+
+ModulePool::ModulePool(const OptimizerOptions &options)
+    : options_(options)
+{}
+
+PooledModule ModulePool::compile(const std::string &file, const std::string &expr) const {
+    std::ifstream stream{file};
+    if (!stream.is_open()) {
+        return "Unable to open " + file;
+    }
+
+    std::stringstream contents;
+    contents << stream.rdbuf();
+
+    auto result = Module::compile(contents.str(), expr, false, options_);
+    if (auto errors = std::get_if<ParseErrors>(&result); errors) {
+        std::stringstream message;
+        for (auto &error: *errors) {
+            message << "On line " << error.pos.line << ", column " << error.pos.col
+                    << ": " << error.message << '\n';
+        }
+        return message.str();
+    }
+
+    return std::get<Module>(std::move(result));
+}
+
+PooledModule ModulePool::get(const std::string &file, const std::string &expr) {
+    std::error_code error;
+    auto modifiedTime = std::filesystem::last_write_time(file, error);
+    if (error) {
+        return "Unable to open " + file;
+    }
+
+    auto key = std::make_pair(file, expr);
+    std::shared_future<PooledModule> module;
+    std::optional<std::promise<PooledModule>> promise;
+    {
+        std::lock_guard lock{mutex_};
+
+        auto [it, inserted] = entries_.try_emplace(key);
+        if (inserted || it->second.modifiedTime != modifiedTime) {
+            promise.emplace();
+            it->second.modifiedTime = modifiedTime;
+            it->second.module = promise->get_future().share();
+        }
+        it->second.lastUsed = ++useCount_;
+        module = it->second.module;
+
+        if (entries_.size() > maxPooledModules) {
+            auto oldest = std::min_element(entries_.begin(), entries_.end(), [](auto &a, auto &b) {
+                return a.second.lastUsed < b.second.lastUsed;
+            });
+            entries_.erase(oldest);
+        }
+    }
+
+    // Only the request which found the module missing or out of date compiles
+    // it, and any others for it wait for that. If compiling throws, the
+    // promise is broken, so they throw instead of waiting forever.
+    if (promise) {
+        promise->set_value(compile(file, expr));
+    }
+    return module.get();
+}
+
+Server::Server(std::string socketPath, const ServerOptions &options)
+    : socketPath_(std::move(socketPath))
+    , options_(options)
+    , modules_(options.optimizerOptions)
+    , workers_(options.threadCount)
+{}
+
+std::string Server::handleRequest(const std::string &request) {
+    std::istringstream stream{request};
+    std::string id, file, expr;
+    if (!std::getline(stream, id) || !std::getline(stream, file) || !std::getline(stream, expr)) {
+        return errorResponse(id, "Malformed request");
+    }
+
+    std::vector<BigInt> inputs;
+    std::string input;
+    while (stream >> input) {
+        if (input.find_first_not_of("0123456789") != std::string::npos) {
+            return errorResponse(id, "Invalid input: " + input);
+        }
+        inputs.emplace_back(input);
+    }
+
+    auto module = modules_.get(file, expr);
+    if (auto error = std::get_if<std::string>(&module); error) {
+        return errorResponse(id, *error);
+    }
+    auto &compiled = std::get<Module>(module);
+
+    // Each worker keeps its own context, so their stacks are reused between
+    // requests.
+    thread_local Context context;
+
+    std::ostringstream response;
+    response << id << "\nok";
+    for (auto &num: inputs) {
+        response << '\n';
+        if (options_.budget) {
+            auto result = context.evaluate(compiled, num, *options_.budget);
+            if (auto value = std::get_if<std::optional<BigInt>>(&result); !value) {
+                response << '?';
+            }
+            else if (*value == std::nullopt) {
+                response << '-';
+            }
+            else {
+                response << **value;
+            }
+        }
+        else if (auto result = context.evaluate(compiled, num); result) {
+            response << *result;
+        }
+        else {
+            response << '-';
+        }
+    }
+
+    return response.str();
+}
+
+void Server::handleConnection(int fd) {
+    // Shared with every request on the connection, so it stays open until
+    // each of their responses has been written.
+    auto connection = std::make_shared<Connection>(fd);
+
+    while (auto request = connection->readMessage()) {
+        workers_.submit([this, connection, request = std::move(*request)] {
+            connection->writeMessage(handleRequest(request));
+        });
+    }
+}
+
+std::string Server::run() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath_.size() >= sizeof(address.sun_path)) {
+        return "The socket path " + socketPath_ + " is too long";
+    }
+    std::strncpy(address.sun_path, socketPath_.c_str(), sizeof(address.sun_path) - 1);
+
+    // Replace the socket left behind by an earlier server, but never anything
+    // else which happens to be at the path.
+    struct stat pathStatus;
+    if (lstat(socketPath_.c_str(), &pathStatus) == 0) {
+        if (!S_ISSOCK(pathStatus.st_mode)) {
+            return socketPath_ + " already exists and isn't a socket";
+        }
+        unlink(socketPath_.c_str());
+    }
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        return std::string{"Unable to create a socket: "} + std::strerror(errno);
+    }
+
+    if (bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+        auto message = "Unable to listen on " + socketPath_ + ": " + std::strerror(errno);
+        close(listenFd);
+        return message;
+    }
+
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            // The connection was dropped before it was accepted, which only
+            // matters to that client.
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            // Running out of file descriptors or memory clears up once other
+            // connections close, so wait for that instead of retrying
+            // straight away.
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds{100});
+                continue;
+            }
+
+            auto message = "Unable to accept connections on " + socketPath_ + ": " + std::strerror(errno);
+            close(listenFd);
+            return message;
+        }
+        std::thread{[this, fd] { handleConnection(fd); }}.detach();
+    }
+}
+
+} // namespace unacpp
@@ -0,0 +1,265 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "sweep.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <sstream>
+
+namespace unacpp {
+
+namespace {
+
+// How many inputs a thread takes at a time. Threads take the next chunk
+// whenever they finish one, so threads which get inputs that take longer
+// to evaluate simply end up evaluating fewer of them.
+constexpr uint64_t sweepChunkSize = 256;
+
+std::optional<BigInt> parseNumber(std::string_view str) {
+    if (str.empty() || str.find_first_not_of("0123456789") != std::string_view::npos) {
+        return std::nullopt;
+    }
+    return BigInt{std::string{str}};
+}
+
+} // anonymous namespace
+
+std::optional<InputRange> InputRange::parse(std::string_view str) {
+    auto dots = str.find("..");
+    if (dots == std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    auto first = parseNumber(str.substr(0, dots));
+    auto rest = str.substr(dots + 2);
+
+    std::optional<BigInt> step = 1;
+    if (auto colon = rest.find(':'); colon != std::string_view::npos) {
+        step = parseNumber(rest.substr(colon + 1));
+        rest = rest.substr(0, colon);
+    }
+    auto last = parseNumber(rest);
+
+    if (!first || !last || !step || *step == 0) {
+        return std::nullopt;
+    }
+
+    InputRange range{*first, *last, *step};
+    if (*last >= *first && (*last - *first) / *step >= std::numeric_limits<uint64_t>::max()) {
+        return std::nullopt;
+    }
+    return range;
+}
+
+uint64_t InputRange::size() const {
+    if (last < first) {
+        return 0;
+    }
+    return static_cast<uint64_t>((last - first) / step) + 1;
+}
+
+std::optional<Reduction> parseReduction(std::string_view name) {
+    auto it = std::find(reductionNames.begin(), reductionNames.end(), name);
+    if (it == reductionNames.end()) {
+        return std::nullopt;
+    }
+    return static_cast<Reduction>(it - reductionNames.begin());
+}
+
+Accumulator::Accumulator(Reduction reduction)
+    : reduction_(reduction)
+{}
+
+void Accumulator::addBest(const BigInt &input, const BigInt &result) {
+    bool better = false;
+    if (best_ == std::nullopt) {
+        better = true;
+    }
+    else if (reduction_ == Reduction::Min) {
+        better = result < *best_;
+    }
+    else {
+        // Ties go to the smallest input, so it doesn't matter which order
+        // the inputs were evaluated in.
+        better = result > *best_ || (result == *best_ && input < bestInput_);
+    }
+
+    if (better) {
+        best_ = result;
+        bestInput_ = input;
+    }
+}
+
+void Accumulator::add(const BigInt &input, const std::optional<BigInt> &result) {
+    if (result == std::nullopt) {
+        failCount_++;
+        return;
+    }
+
+    count_++;
+
+    switch (reduction_) {
+        case Reduction::Sum:
+            sum_ += *result;
+            break;
+
+        case Reduction::Min:
+        case Reduction::Max:
+        case Reduction::ArgMax:
+            addBest(input, *result);
+            break;
+
+        case Reduction::Histogram:
+            histogram_[*result]++;
+            break;
+
+        case Reduction::Count:
+        case Reduction::FailCount:
+            break;
+    }
+}
+
+void Accumulator::addExceeded() {
+    exceededCount_++;
+}
+
+void Accumulator::merge(const Accumulator &other) {
+    sum_ += other.sum_;
+    count_ += other.count_;
+    failCount_ += other.failCount_;
+    exceededCount_ += other.exceededCount_;
+
+    if (other.best_) {
+        addBest(other.bestInput_, *other.best_);
+    }
+
+    for (auto &[result, count]: other.histogram_) {
+        histogram_[result] += count;
+    }
+}
+
+uint64_t Accumulator::getExceededCount() const {
+    return exceededCount_;
+}
+
+std::string Accumulator::getReport() const {
+    std::ostringstream report;
+
+    switch (reduction_) {
+        case Reduction::Sum:
+            report << sum_;
+            break;
+
+        case Reduction::Min:
+        case Reduction::Max:
+            if (best_) {
+                report << *best_;
+            }
+            else {
+                report << '-';
+            }
+            break;
+
+        case Reduction::ArgMax:
+            if (best_) {
+                report << bestInput_;
+            }
+            else {
+                report << '-';
+            }
+            break;
+
+        case Reduction::Count:
+            report << count_;
+            break;
+
+        case Reduction::FailCount:
+            report << failCount_;
+            break;
+
+        case Reduction::Histogram: {
+            const char *separator = "";
+            for (auto &[result, count]: histogram_) {
+                report << separator << result << ' ' << count;
+                separator = "\n";
+            }
+            if (failCount_ > 0) {
+                report << separator << "- " << failCount_;
+                separator = "\n";
+            }
+            if (exceededCount_ > 0) {
+                report << separator << "? " << exceededCount_;
+            }
+            break;
+        }
+    }
+
+    return report.str();
+}
+
+std::vector<Accumulator> sweepRange(
+    const BytecodeModule &bytecode,
+    const InputRange &range,
+    Reduction reduction,
+    size_t threadCount,
+    const std::optional<Budget> &budget)
+{
+    auto entryCount = bytecode.entryPoints.size();
+    auto inputCount = range.size();
+    auto chunkCount = inputCount / sweepChunkSize + (inputCount % sweepChunkSize != 0);
+    std::atomic<uint64_t> nextChunk = 0;
+
+    ThreadPool pool{threadCount};
+    std::vector<std::vector<Accumulator>> threadAccumulators(
+        pool.size(),
+        std::vector<Accumulator>(entryCount, Accumulator{reduction}));
+
+    for (auto &accumulators: threadAccumulators) {
+        pool.submit([&] {
+            Interpreter interpreter;
+            BigInt input;
+
+            for (uint64_t chunk; (chunk = nextChunk++) < chunkCount; ) {
+                auto start = chunk * sweepChunkSize;
+                auto end = std::min(start + sweepChunkSize, inputCount);
+                input = range.first + range.step * start;
+
+                for (auto i = start; i < end; i++, input += range.step) {
+                    for (size_t entryPoint = 0; entryPoint < entryCount; entryPoint++) {
+                        if (!budget) {
+                            accumulators[entryPoint].add(input, interpreter.getResult(bytecode, input, entryPoint));
+                            continue;
+                        }
+
+                        auto result = interpreter.getResult(bytecode, input, *budget, nullptr, entryPoint);
+                        if (auto value = std::get_if<std::optional<BigInt>>(&result); value) {
+                            accumulators[entryPoint].add(input, *value);
+                        }
+                        else {
+                            accumulators[entryPoint].addExceeded();
+                        }
+                    }
+                }
+            }
+        });
+    }
+    pool.wait();
+
+    auto results = std::move(threadAccumulators[0]);
+    for (size_t i = 1; i < threadAccumulators.size(); i++) {
+        for (size_t entryPoint = 0; entryPoint < entryCount; entryPoint++) {
+            results[entryPoint].merge(threadAccumulators[i][entryPoint]);
+        }
+    }
+    return results;
+}
+
+} // namespace unacpp
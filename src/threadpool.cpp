@@ -0,0 +1,148 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace unacpp {
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    workers_.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers_.emplace_back([this] { runWorker(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock{mutex_};
+        stopping_ = true;
+    }
+    taskAvailable_.notify_all();
+
+    for (auto &worker: workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::runWorker() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock{mutex_};
+            taskAvailable_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        task();
+
+        {
+            std::lock_guard lock{mutex_};
+            pendingCount_--;
+        }
+        tasksFinished_.notify_all();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard lock{mutex_};
+        tasks_.push_back(std::move(task));
+        pendingCount_++;
+    }
+    taskAvailable_.notify_one();
+}
+
+bool ThreadPool::trySubmit(std::function<void()> task) {
+    {
+        std::lock_guard lock{mutex_};
+        if (pendingCount_ >= workers_.size()) {
+            return false;
+        }
+        tasks_.push_back(std::move(task));
+        pendingCount_++;
+    }
+    taskAvailable_.notify_one();
+    return true;
+}
+
+void ThreadPool::wait() {
+    std::unique_lock lock{mutex_};
+    tasksFinished_.wait(lock, [this] { return pendingCount_ == 0; });
+}
+
+size_t ThreadPool::size() const {
+    return workers_.size();
+}
+
+ParallelThreads::ParallelThreads(size_t threadCount)
+    : threadCount_(threadCount == 0 ? std::max(1u, std::thread::hardware_concurrency()) : threadCount)
+{}
+
+size_t ParallelThreads::size() const {
+    return threadCount_;
+}
+
+ThreadPool &ParallelThreads::getPool() {
+    if (!pool_) {
+        pool_.emplace(threadCount_);
+    }
+    return *pool_;
+}
+
+void parallelFor(size_t count, size_t minParallelCount, ParallelThreads &threads, const std::function<void(size_t)> &body) {
+    size_t threadCount = std::min(count, threads.size());
+    if (count < minParallelCount || threadCount <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    // An exception escaping a task would end the process, so the first one is
+    // kept to be rethrown on the calling thread.
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    // The indices are split into a few runs for each thread, so that a run
+    // of slow indices doesn't hold up the rest.
+    auto &pool = threads.getPool();
+    size_t runLength = (count + threadCount * 4 - 1) / (threadCount * 4);
+    for (size_t start = 0; start < count; start += runLength) {
+        pool.submit([&, start, end = std::min(count, start + runLength)] {
+            try {
+                for (size_t i = start; i < end; i++) {
+                    body(i);
+                }
+            }
+            catch (...) {
+                std::lock_guard lock{errorMutex};
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+    pool.wait();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace unacpp
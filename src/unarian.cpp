@@ -0,0 +1,58 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "unarian.hpp"
+#include "compiler.hpp"
+
+namespace unacpp {
+
+Module::Module(BytecodeModule bytecode)
+    : bytecode_(std::make_shared<const BytecodeModule>(std::move(bytecode)))
+{}
+
+CompileResult Module::compile(
+    std::string_view source,
+    std::string_view expr,
+    bool debugMode,
+    const OptimizerOptions &options)
+{
+    auto result = compileBytecode(source, expr, debugMode, options);
+    if (std::holds_alternative<ParseErrors>(result)) {
+        return std::get<ParseErrors>(std::move(result));
+    }
+    return Module{std::get<BytecodeModule>(std::move(result))};
+}
+
+Module Module::fromBytecode(BytecodeModule bytecode) {
+    return Module{std::move(bytecode)};
+}
+
+const BytecodeModule &Module::getBytecode() const {
+    return *bytecode_;
+}
+
+std::optional<BigInt> Context::evaluate(const Module &module, BigInt input) {
+    return interpreter_.getResult(module.getBytecode(), std::move(input));
+}
+
+std::vector<std::optional<BigInt>> Context::evaluate(const Module &module, std::span<const BigInt> inputs) {
+    std::vector<std::optional<BigInt>> results;
+    results.reserve(inputs.size());
+
+    for (auto &input: inputs) {
+        results.push_back(interpreter_.getResult(module.getBytecode(), input));
+    }
+
+    return results;
+}
+
+BoundedResult Context::evaluate(const Module &module, BigInt input, const Budget &budget) {
+    return interpreter_.getResult(module.getBytecode(), std::move(input), budget);
+}
+
+} // namespace unacpp
@@ -0,0 +1,200 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "unarian.h"
+#include "unarian.hpp"
+
+#include <cstring>
+#include <sstream>
+
+struct unarian_module {
+    unacpp::Module module;
+};
+
+struct unarian_context {
+    unacpp::Context context;
+
+    std::optional<unacpp::Budget> budget;
+};
+
+namespace {
+
+char *copyString(const std::string &str) {
+    auto *copy = new char[str.size() + 1];
+    std::memcpy(copy, str.c_str(), str.size() + 1);
+    return copy;
+}
+
+std::optional<unacpp::BigInt> parseInput(const char *input) {
+    if (input == nullptr || *input == '\0') {
+        return std::nullopt;
+    }
+    for (auto *c = input; *c != '\0'; c++) {
+        if (*c < '0' || *c > '9') {
+            return std::nullopt;
+        }
+    }
+    return unacpp::BigInt{input};
+}
+
+unarian_status setOutput(const std::optional<unacpp::BigInt> &result, char **output) {
+    if (result == std::nullopt) {
+        *output = nullptr;
+        return UNARIAN_FAILURE;
+    }
+    *output = copyString(result->str());
+    return UNARIAN_SUCCESS;
+}
+
+unarian_status evaluate(unarian_context *context, const unarian_module *module, unacpp::BigInt input, char **output) {
+    if (context->budget == std::nullopt) {
+        return setOutput(context->context.evaluate(module->module, std::move(input)), output);
+    }
+
+    auto result = context->context.evaluate(module->module, std::move(input), *context->budget);
+    if (std::holds_alternative<unacpp::BudgetExceeded>(result)) {
+        *output = nullptr;
+        return UNARIAN_BUDGET_EXCEEDED;
+    }
+    return setOutput(std::get<std::optional<unacpp::BigInt>>(result), output);
+}
+
+} // anonymous namespace
+
+extern "C" {
+
+unarian_module *unarian_module_compile(
+    const char *source,
+    size_t source_length,
+    const char *expr,
+    int debug_mode,
+    char **errors)
+{
+    // Exceptions can't be allowed to reach the caller, so anything thrown
+    // while compiling is reported as a failure without any parse errors.
+    if (errors != nullptr) {
+        *errors = nullptr;
+    }
+
+    try {
+        auto result = unacpp::Module::compile({source, source_length}, expr, debug_mode != 0);
+
+        if (auto parseErrors = std::get_if<unacpp::ParseErrors>(&result); parseErrors) {
+            if (errors != nullptr) {
+                std::stringstream stream;
+                for (auto &error: *parseErrors) {
+                    stream << "On line " << error.pos.line << ", column " << error.pos.col
+                           << ": " << error.message << '\n';
+                }
+                *errors = copyString(stream.str());
+            }
+            return nullptr;
+        }
+
+        return new unarian_module{std::get<unacpp::Module>(std::move(result))};
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void unarian_module_free(unarian_module *module) {
+    delete module;
+}
+
+unarian_context *unarian_context_new(void) {
+    try {
+        return new unarian_context{};
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void unarian_context_free(unarian_context *context) {
+    delete context;
+}
+
+void unarian_context_set_budget(
+    unarian_context *context,
+    uint64_t max_instructions,
+    size_t max_depth,
+    size_t max_memory)
+{
+    if (max_instructions == 0 && max_depth == 0 && max_memory == 0) {
+        context->budget = std::nullopt;
+        return;
+    }
+
+    unacpp::Budget budget;
+    if (max_instructions != 0) {
+        budget.maxInstructions = max_instructions;
+    }
+    if (max_depth != 0) {
+        budget.maxDepth = max_depth;
+    }
+    if (max_memory != 0) {
+        budget.maxMemory = max_memory;
+    }
+    context->budget = budget;
+}
+
+unarian_status unarian_evaluate(
+    unarian_context *context,
+    const unarian_module *module,
+    const char *input,
+    char **output)
+{
+    try {
+        auto inputVal = parseInput(input);
+        if (inputVal == std::nullopt) {
+            *output = nullptr;
+            return UNARIAN_INVALID_INPUT;
+        }
+
+        return evaluate(context, module, std::move(*inputVal), output);
+    }
+    catch (...) {
+        *output = nullptr;
+        return UNARIAN_INTERNAL_ERROR;
+    }
+}
+
+unarian_status unarian_evaluate_u64(
+    unarian_context *context,
+    const unarian_module *module,
+    uint64_t input,
+    char **output)
+{
+    try {
+        return evaluate(context, module, input, output);
+    }
+    catch (...) {
+        *output = nullptr;
+        return UNARIAN_INTERNAL_ERROR;
+    }
+}
+
+void unarian_evaluate_batch(
+    unarian_context *context,
+    const unarian_module *module,
+    const char *const *inputs,
+    size_t count,
+    char **outputs,
+    unarian_status *statuses)
+{
+    for (size_t i = 0; i < count; i++) {
+        statuses[i] = unarian_evaluate(context, module, inputs[i], &outputs[i]);
+    }
+}
+
+void unarian_string_free(char *str) {
+    delete[] str;
+}
+
+} // extern "C"
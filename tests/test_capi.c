@@ -0,0 +1,86 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "unarian.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char source[] =
+    "*2 { - *2 + + | }\n"
+    "if=0 { { - 0 | + } - }\n"
+    "0 { - 0 | }\n"
+    "sawtooth { - sawtooth - | }\n";
+
+static int failures = 0;
+
+static void check(int condition, const char *message) {
+    if (!condition) {
+        printf("Check failed: %s\n", message);
+        failures++;
+    }
+}
+
+int main(void) {
+    char *errors = NULL;
+    unarian_module *bad = unarian_module_compile(source, strlen(source), "undefined", 0, &errors);
+    check(bad == NULL, "compiling an undefined program fails");
+    check(errors != NULL && strstr(errors, "undefined") != NULL, "parse errors are reported");
+    unarian_string_free(errors);
+
+    unarian_module *module = unarian_module_compile(source, strlen(source), "*2 +", 0, &errors);
+    check(module != NULL && errors == NULL, "compiling a valid expression succeeds");
+    if (module == NULL) {
+        return 1;
+    }
+
+    unarian_context *context = unarian_context_new();
+    char *output = NULL;
+
+    check(unarian_evaluate(context, module, "21", &output) == UNARIAN_SUCCESS, "evaluation succeeds");
+    check(output != NULL && strcmp(output, "43") == 0, "evaluation gives the right result");
+    unarian_string_free(output);
+
+    check(unarian_evaluate_u64(context, module, 5000000000u, &output) == UNARIAN_SUCCESS, "u64 evaluation succeeds");
+    check(output != NULL && strcmp(output, "10000000001") == 0, "u64 evaluation gives the right result");
+    unarian_string_free(output);
+
+    check(unarian_evaluate(context, module, "12a", &output) == UNARIAN_INVALID_INPUT, "invalid input is rejected");
+    check(output == NULL, "invalid input has no output");
+
+    unarian_module *is_zero = unarian_module_compile(source, strlen(source), "if=0", 0, NULL);
+    const char *inputs[] = { "0", "1", "99999999999999999999999" };
+    char *outputs[3];
+    unarian_status statuses[3];
+    unarian_evaluate_batch(context, is_zero, inputs, 3, outputs, statuses);
+    check(statuses[0] == UNARIAN_SUCCESS && strcmp(outputs[0], "0") == 0, "batch result for 0");
+    check(statuses[1] == UNARIAN_FAILURE && outputs[1] == NULL, "batch result for 1");
+    check(statuses[2] == UNARIAN_FAILURE && outputs[2] == NULL, "batch result for a large input");
+    unarian_string_free(outputs[0]);
+
+    unarian_module *sawtooth = unarian_module_compile(source, strlen(source), "sawtooth", 0, NULL);
+    unarian_context_set_budget(context, 0, 1000, 0);
+    check(unarian_evaluate(context, sawtooth, "1000000", &output) == UNARIAN_BUDGET_EXCEEDED, "deep recursion exceeds the budget");
+    check(output == NULL, "exceeding the budget has no output");
+    check(unarian_evaluate(context, sawtooth, "100", &output) == UNARIAN_SUCCESS, "shallow recursion fits in the budget");
+    unarian_string_free(output);
+
+    unarian_context_set_budget(context, 1000, 0, 0);
+    check(unarian_evaluate(context, sawtooth, "1000000", &output) == UNARIAN_BUDGET_EXCEEDED, "long evaluations exceed the budget");
+
+    unarian_context_set_budget(context, 0, 0, 0);
+    check(unarian_evaluate(context, sawtooth, "1000000", &output) == UNARIAN_SUCCESS, "the budget can be removed");
+    unarian_string_free(output);
+
+    unarian_module_free(sawtooth);
+    unarian_module_free(is_zero);
+    unarian_context_free(context);
+    unarian_module_free(module);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+from typing import Any, List
+
+def run(args: List[str], inputs: str = '') -> subprocess.CompletedProcess:
+    return subprocess.run(args, input=inputs, capture_output=True, text=True)
+
+def check(actual: Any, expected: Any, description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        program_path = os.path.join(dir, 'program.un')
+        with open(program_path, 'w') as file:
+            file.write('double { - double + + | }\nhalf { - - half + | if=0 }\nif=0 { { - 0 | + } - }\n0 { - 0 | }\n')
+
+        ok = True
+        for level in ['0', '2']:
+            result = run([exe_path, program_path, '--no-cache', '-O', level, '-i', '-e', 'double', '-e', 'half', '-e', 'half double +'], '0 1 4 7')
+            ok &= check(result.stdout.splitlines(), [
+                '0 0 1',
+                '2 - -',
+                '8 2 5',
+                '14 - -',
+            ], f'the results of each expression at -O{level}')
+
+        # Without optimization, double isn't inlined or replaced, so both
+        # expressions call it, and its body must only be compiled once.
+        result = run([exe_path, program_path, '--no-cache', '-O', '0', '-b', '-e', 'double', '-e', 'double +'])
+        single = run([exe_path, program_path, '--no-cache', '-O', '0', '-b', '-e', 'double'])
+        ok &= check(result.stdout.count('FAIL_JMP'), single.stdout.count('FAIL_JMP'), 'the branches compiled for double')
+
+        return 0 if ok else 1
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
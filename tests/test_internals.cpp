@@ -0,0 +1,126 @@
+//
+//  Copyright 2022 Sam Coppini
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See accompanying file LICENSE.txt or copy at
+//  http://www.boost.org/LICENSE_1_0.txt
+//
+
+#include "bigint.hpp"
+#include "bytecode.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const std::string &message) {
+    if (!condition) {
+        std::cout << "Check failed: " << message << '\n';
+        failures++;
+    }
+}
+
+// The interpreter only divides by the word kernels when the divisor is a
+// constant which isn't a power of two, so the edges are checked directly.
+void checkWordDivisors() {
+    constexpr auto maxLimb = std::numeric_limits<unacpp::Limb>::max();
+    constexpr auto topBit = unacpp::Limb{1} << (std::numeric_limits<unacpp::Limb>::digits - 1);
+
+    unacpp::BigInt base = unacpp::BigInt{maxLimb} + 1;
+    for (unacpp::Limb divisor: {unacpp::Limb{1}, unacpp::Limb{2}, unacpp::Limb{3}, topBit, maxLimb - 1, maxLimb}) {
+        auto wordDivisor = unacpp::makeWordDivisor(divisor);
+
+        std::vector<unacpp::BigInt> dividends = {
+            0,
+            1,
+            divisor - 1,
+            divisor,
+            maxLimb,
+            base,
+            base * base - 1,
+            base * base * base + 12345,
+            unacpp::BigInt{divisor} * base * base + divisor - 1,
+        };
+        for (auto &dividend: dividends) {
+            auto description = dividend.str() + " by " + std::to_string(divisor);
+
+            auto quotient = dividend;
+            auto remainder = unacpp::divideWord(quotient, wordDivisor);
+            check(quotient == dividend / divisor, "the quotient of " + description);
+            check(remainder == dividend % divisor, "the remainder of dividing " + description);
+            check(unacpp::remainderWord(dividend, wordDivisor) == dividend % divisor, "the remainder of " + description);
+        }
+    }
+}
+
+unacpp::BytecodeModule makeModule(std::vector<uint8_t> instructions, std::vector<unacpp::BigInt> constants) {
+    unacpp::BytecodeModule module;
+    module.instructions = std::move(instructions);
+    module.instructions.push_back(unacpp::OpCode::Ret);
+    module.constants = std::move(constants);
+    module.functions.push_back({"main", {1, 1}, {0}});
+    module.entryPoints.push_back(0);
+    return module;
+}
+
+void checkVerifier() {
+    auto divide = [] (unacpp::BigInt divisor) {
+        return makeModule({unacpp::OpCode::DivFloor, 0, 0}, {divisor});
+    };
+    check(unacpp::verifyBytecode(divide(3)), "dividing by a nonzero constant is accepted");
+    check(!unacpp::verifyBytecode(divide(0)), "dividing by zero is rejected");
+
+    auto shift = [] (uint64_t bits) {
+        std::vector<uint8_t> instructions{unacpp::OpCode::ShiftLeft};
+        for (int i = 56; i >= 0; i -= 8) {
+            instructions.push_back(static_cast<uint8_t>(bits >> i));
+        }
+        return makeModule(std::move(instructions), {});
+    };
+    check(unacpp::verifyBytecode(shift(63)), "shifting by a small immediate is accepted");
+    check(!unacpp::verifyBytecode(shift(uint64_t{1} << 40)), "shifting by an oversized immediate is rejected");
+}
+
+// An exception thrown on one of the threads has to reach the caller instead of
+// ending the process, and the threads have to be usable again afterwards.
+void checkParallelFor() {
+    unacpp::ParallelThreads threads{4};
+
+    std::string message;
+    try {
+        unacpp::parallelFor(100, 1, threads, [] (size_t i) {
+            if (i == 57) {
+                throw std::runtime_error{"index 57"};
+            }
+        });
+    }
+    catch (const std::runtime_error &error) {
+        message = error.what();
+    }
+    check(message == "index 57", "an exception in parallelFor is rethrown to the caller");
+
+    std::vector<char> called(100, false);
+    unacpp::parallelFor(called.size(), 1, threads, [&] (size_t i) {
+        called[i] = true;
+    });
+    check(std::find(called.begin(), called.end(), false) == called.end(), "parallelFor calls every index after an exception");
+}
+
+} // anonymous namespace
+
+int main() {
+    checkWordDivisors();
+    checkVerifier();
+    checkParallelFor();
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+from typing import List
+
+def run(args: List[str], inputs: str = '') -> subprocess.CompletedProcess:
+    return subprocess.run(args, input=inputs, capture_output=True, text=True)
+
+def check(actual: List[str], expected: List[str], description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        def write(name: str, contents: str) -> str:
+            path = os.path.join(dir, name)
+            with open(path, 'w') as file:
+                file.write(contents)
+            return path
+
+        arith_path = write('arith.un', 'double { - double + + | }\nhalf { - - half + | }\n')
+        shifts_path = write('shifts.un', 'quadruple { double double }\n')
+        program_path = write('program.un', 'main { quadruple half + }\n')
+        undefined_path = write('undefined.un', 'main { missing }\n')
+
+        arith_object = os.path.join(dir, 'arith.uno')
+        shifts_object = os.path.join(dir, 'shifts.uno')
+
+        ok = True
+        result = run([exe_path, arith_path, '--no-cache', '--compile-object', arith_object])
+        ok &= check([str(result.returncode)], ['0'], 'compiling arith.un')
+        result = run([exe_path, shifts_path, '--no-cache', '--compile-object', shifts_object, '--link', arith_object])
+        ok &= check([str(result.returncode)], ['0'], 'compiling shifts.un')
+
+        for level in ['0', '2', '3']:
+            result = run(
+                [exe_path, program_path, '--no-cache', '-O', level, '-i', '--link', shifts_object, '--link', arith_object],
+                '0 1 5',
+            )
+            ok &= check(result.stdout.split(), ['1', '3', '11'], f'the linked program at -O{level}')
+
+        result = run([exe_path, undefined_path, '--no-cache', '-i', '--link', arith_object], '1')
+        ok &= check([str(result.returncode != 0)], ['True'], 'a program calling an undefined function')
+
+        result = run([exe_path, program_path, '--no-cache', '-i', '--link', program_path], '1')
+        ok &= check([str(result.returncode != 0)], ['True'], 'linking a file which isn\'t an object')
+
+        return 0 if ok else 1
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+from typing import Dict, List
+
+def run(args: List[str], inputs: str = '') -> subprocess.CompletedProcess:
+    return subprocess.run(args, input=inputs, capture_output=True, text=True)
+
+def check(actual, expected, description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+# Returns the calls, self instructions, total instructions and branch failures
+# of each function in the profile, leaving out the time, which changes from run
+# to run.
+def parse_profile(report: str) -> Dict[str, List[str]]:
+    rows = {}
+    for line in report.splitlines()[1:]:
+        name, location, calls, self_insts, total_insts, ms, *failures = line.split()
+        rows[name] = [calls, self_insts, total_insts, ' '.join(failures)]
+    return rows
+
+def parse_stacks(path: str) -> Dict[str, int]:
+    stacks = {}
+    with open(path) as file:
+        for line in file:
+            stack, count = line.rsplit(' ', 1)
+            stacks[stack] = int(count)
+    return stacks
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        program_path = os.path.join(dir, 'program.un')
+        stacks_path = os.path.join(dir, 'stacks.txt')
+        with open(program_path, 'w') as file:
+            file.write('0 { - 0 | }\ncount { - count + | }\nmain { count 0 }\n')
+
+        # count is replaced by arithmetic when optimized, so it only recurses
+        # at -O0.
+        result = run([exe_path, program_path, '--no-cache', '-O', '0', '-i', '--profile', '--profile-stacks', stacks_path], '3')
+        ok = check(result.stdout.split(), ['0'], 'the result while profiling')
+
+        # The recursive calls to count only add to its total once, and the
+        # + which the outermost count ends with is a tail call, so it's
+        # counted by main instead. 0 is a tail call from main, so main's total
+        # doesn't include it.
+        rows = parse_profile(result.stderr)
+        ok &= check(rows.get('count'), ['4', '11', '23', '1 0'], 'the profile of count')
+        ok &= check(rows.get('0'), ['4', '8', '16', '1 0'], 'the profile of 0')
+        ok &= check(rows.get('main'), ['1', '2', '27', '0'], 'the profile of main')
+
+        stacks = parse_stacks(stacks_path)
+        ok &= check(stacks.get('main;count;count;count;count'), 2, 'the innermost call to count')
+        ok &= check(stacks.get('main;count;+'), 2, 'a + ending a nested count')
+        ok &= check(stacks.get('main;+'), 2, 'the + ending the outermost count')
+        ok &= check(stacks.get('0;-'), 8, 'the calls to - from 0')
+        ok &= check([stack for stack in stacks if 'main;0' in stack], [], 'the stacks with 0 under main')
+
+        # Every instruction is in exactly one stack.
+        self_total = sum(int(row[1]) for row in rows.values())
+        ok &= check(sum(stacks.values()), self_total, 'the instructions in every stack')
+
+        return 0 if ok else 1
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+from typing import Dict, List, Tuple
+
+def send_message(sock: socket.socket, message: str) -> None:
+    data = bytes(message, 'utf-8')
+    sock.sendall(struct.pack('>I', len(data)) + data)
+
+def read_exactly(sock: socket.socket, size: int) -> bytes:
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError('The server closed the connection')
+        data += chunk
+    return data
+
+def read_message(sock: socket.socket) -> str:
+    size, = struct.unpack('>I', read_exactly(sock, 4))
+    return str(read_exactly(sock, size), 'utf-8')
+
+def evaluate(sock_path: str, requests: List[Tuple[str, str, str]]) -> Dict[str, List[str]]:
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(sock_path)
+
+        # Every request is sent before reading any responses.
+        for i, (file, expr, inputs) in enumerate(requests):
+            send_message(sock, f'{i}\n{file}\n{expr}\n{inputs}')
+
+        responses = {}
+        for _ in requests:
+            id, *lines = read_message(sock).split('\n')
+            responses[id] = lines
+        return responses
+
+def check(actual: List[str], expected: List[str], description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        sock_path = os.path.join(dir, 'unarian.sock')
+        program_path = os.path.join(dir, 'program.un')
+
+        with open(program_path, 'w') as program:
+            program.write('double { - double + + | }\nhalf { - - half + | }\n')
+
+        # A file which isn't a socket must be left alone.
+        result = subprocess.run([exe_path, '--serve', program_path], capture_output=True)
+        if result.returncode == 0 or not os.path.exists(program_path):
+            print('Expected serving on a regular file to fail without removing it')
+            return 1
+
+        server = subprocess.Popen([exe_path, '--serve', sock_path, '-j', '2'])
+        try:
+            for _ in range(100):
+                if os.path.exists(sock_path):
+                    break
+                time.sleep(0.05)
+
+            ok = True
+            responses = evaluate(sock_path, [
+                (program_path, 'double', '0 1 21'),
+                (program_path, 'half', '4 5'),
+                (program_path, 'half double', '7'),
+                (program_path, 'missing', '1'),
+                (program_path, 'double', 'abc'),
+            ])
+            ok &= check(responses['0'], ['ok', '0', '2', '42'], 'double')
+            ok &= check(responses['1'], ['ok', '2', '3'], 'half')
+            ok &= check(responses['2'], ['ok', '8'], 'half double')
+            ok &= check(responses['3'][:1], ['error'], 'an undefined program')
+            ok &= check(responses['4'][:1], ['error'], 'an invalid input')
+
+            # More modules than the pool keeps, so the first ones are dropped
+            # and compiled again when they're next used. Requests for the same
+            # module at once share one compile.
+            exprs = [f'double{" +" * i}' for i in range(300)]
+            responses = evaluate(sock_path, [(program_path, expr, '5') for expr in exprs + exprs[:10] * 3])
+            for i, expr in enumerate(exprs + exprs[:10] * 3):
+                ok &= check(responses[str(i)], ['ok', str(10 + expr.count('+'))], expr)
+
+            # Make sure the modification time changes, even on file systems
+            # which only keep it to the second.
+            time.sleep(1.1)
+            with open(program_path, 'w') as program:
+                program.write('double { - double + + + | }\n')
+
+            responses = evaluate(sock_path, [(program_path, 'double', '2')])
+            ok &= check(responses['0'], ['ok', '6'], 'double after modifying the file')
+
+            return 0 if ok else 1
+        finally:
+            server.kill()
+            server.wait()
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+from typing import List
+
+def run(args: List[str], inputs: str = '') -> subprocess.CompletedProcess:
+    return subprocess.run(args, input=inputs, capture_output=True, text=True)
+
+def check(actual: List[str], expected: List[str], description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        program_path = os.path.join(dir, 'program.un')
+        with open(program_path, 'w') as file:
+            file.write('leaf { ? + }\nmid { - mid + | leaf }\nmain { mid - | + }\n')
+
+        ok = True
+        for level in ['0', '2']:
+            result = run([exe_path, program_path, '--no-cache', '-g', '-O', level, '-i'], '2')
+            ok &= check(result.stdout.splitlines()[-3:], [
+                '  mid, branch 1, call at 2:9, 2 times',
+                '  main, branch 1, call at 3:8',
+                '2',
+            ], f'the stack trace at -O{level}')
+
+        result = run([exe_path, program_path, '--no-cache', '-i'], '2')
+        ok &= check(result.stdout.split(), ['2'], 'the program without debug mode')
+
+        # mid is replaced by arithmetic when optimized, so it only recurses
+        # at -O0.
+        result = run([exe_path, program_path, '--no-cache', '-O', '0', '-i', '--max-depth', '5'], '100')
+        ok &= check(result.stderr.splitlines(), [
+            'Evaluating 100 exceeded the stack depth limit, at:',
+            '  -',
+            '  mid, branch 1, call at 2:7',
+            '  mid, branch 1, call at 2:9, 3 times',
+            '  main, branch 1, call at 3:8',
+        ], 'an evaluation over the depth limit')
+
+        # At -O3, main calls a copy of e specialized for 2048, which is shown
+        # with the value it was specialized for.
+        with open(program_path, 'w') as file:
+            file.write('dbl { - dbl + + | }\ne { - e dbl | + }\nmain { 0 + dbl dbl dbl dbl dbl dbl dbl dbl dbl dbl dbl e }\n0 { - 0 | }\n')
+        result = run([exe_path, program_path, '--no-cache', '-O', '3', '-i', '--max-depth', '5'], '1')
+        ok &= check(result.stderr.splitlines(), [
+            'Evaluating 1 exceeded the stack depth limit, at:',
+            '  e, branch 1, defined at 2:3',
+            '  e, branch 1, call at 2:7, 4 times',
+            '  e@2048, branch 1, call at 2:7',
+        ], 'the stack trace of a specialized function')
+
+        return 0 if ok else 1
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
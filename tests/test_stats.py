@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+from typing import Any, List
+
+def run(args: List[str], inputs: str = '') -> subprocess.CompletedProcess:
+    return subprocess.run(args, input=inputs, capture_output=True, text=True)
+
+def check(actual: Any, expected: Any, description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        program_path = os.path.join(dir, 'program.un')
+        with open(program_path, 'w') as file:
+            file.write('*3 { - *3 + + + | }\nmain { *3 + }\n')
+        stats_path = os.path.join(dir, 'stats.json')
+
+        ok = True
+        result = run([exe_path, program_path, '-i', '--stats', '--stats-json', stats_path], '4')
+        ok &= check(result.stdout.split(), ['13'], 'the result with stats')
+        ok &= check('Pass total' in result.stderr, True, 'the stats printed to stderr')
+
+        with open(stats_path) as file:
+            stats = json.load(file)
+
+        phases = [phase['name'] for phase in stats['phases']]
+        ok &= check(phases, ['tokenize', 'parse', 'lower', 'generate'], 'the phases')
+
+        # *3 is replaced with a multiplication, and then inlined into main.
+        totals = {total['name']: total for total in stats['pass_totals']}
+        ok &= check(totals['multiply']['functions_changed'] > 0, True, 'the functions changed by multiply')
+        runs = [run for run in stats['passes'] if run['name'] == 'inline' and run['round'] == 1]
+        ok &= check([run['functions_after'] < run['functions_before'] for run in runs], [True], 'the first round of inlining')
+        ok &= check(stats['functions'], 1, 'the functions in the bytecode')
+        ok &= check(stats['bytecode_bytes'] > 0, True, 'the size of the bytecode')
+
+        return 0 if ok else 1
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+
+#
+#  Copyright 2022 Sam Coppini
+#
+#  Distributed under the Boost Software License, Version 1.0.
+#  See accompanying file LICENSE.txt or copy at
+#  http://www.boost.org/LICENSE_1_0.txt
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+from typing import Any, List
+
+reductions = ['sum', 'min', 'max', 'argmax', 'count', 'fail-count', 'histogram']
+
+def run(args: List[str], inputs: str = '') -> subprocess.CompletedProcess:
+    return subprocess.run(args, input=inputs, capture_output=True, text=True)
+
+def check(actual: Any, expected: Any, description: str) -> bool:
+    if actual != expected:
+        print(f'Expected {expected} for {description}. Received {actual}')
+        return False
+    return True
+
+def run_test(exe_path: str) -> int:
+    with tempfile.TemporaryDirectory() as dir:
+        program_path = os.path.join(dir, 'program.un')
+        with open(program_path, 'w') as file:
+            file.write('half { - - half + | if=0 }\nif=0 { { - 0 | + } - }\n0 { - 0 | }\n')
+
+        def sweep(expr: str, range_str: str, *args: str) -> subprocess.CompletedProcess:
+            return run([exe_path, program_path, '--no-cache', '-e', expr, '--range', range_str, *args])
+
+        ok = True
+        result = sweep('half', '0..4')
+        ok &= check(result.stdout.split(), ['0', '-', '1', '-', '2'], 'each result in the range')
+
+        # half fails on odd inputs, and halves the even ones.
+        expected = {
+            'sum': ['15'],
+            'min': ['0'],
+            'max': ['5'],
+            'argmax': ['10'],
+            'count': ['6'],
+            'fail-count': ['5'],
+            'histogram': ['0 1', '1 1', '2 1', '3 1', '4 1', '5 1', '- 5'],
+        }
+        for reduction in reductions:
+            result = sweep('half', '0..10', '--reduce', reduction)
+            ok &= check(result.stdout.splitlines(), expected[reduction], f'the {reduction} of half')
+
+        result = sweep('half', '0..10:2', '--reduce', 'fail-count')
+        ok &= check(result.stdout.split(), ['0'], 'a range with a step')
+        result = sweep('half', '10..1', '--reduce', 'count')
+        ok &= check(result.stdout.split(), ['0'], 'an empty range')
+
+        # Every even input gives the same result, so the first of them wins,
+        # no matter which thread evaluated it.
+        for jobs in ['1', '4']:
+            result = sweep('half 0', '1001..5000', '--reduce', 'argmax', '-j', jobs)
+            ok &= check(result.stdout.split(), ['1002'], f'the argmax of ties with -j {jobs}')
+
+        # The range covers several chunks, so it's split between the threads.
+        for reduction in reductions:
+            single = sweep('half', '0..5000', '--reduce', reduction, '-j', '1')
+            several = sweep('half', '0..5000', '--reduce', reduction, '-j', '4')
+            ok &= check(several.stdout, single.stdout, f'the {reduction} with -j 4')
+
+        for range_str in ['1..10:0', '1..', '..5', '1-10', 'a..b', '1..5:x']:
+            result = sweep('half', range_str)
+            ok &= check((result.returncode, result.stdout), (1, ''), f'the invalid range {range_str}')
+
+        result = run([exe_path, program_path, '--no-cache', '-e', 'half', '--range', '0..4', '-i'], '1')
+        ok &= check((result.returncode, result.stdout), (1, ''), 'a range with input from stdin')
+
+        return 0 if ok else 1
+
+def main() -> int:
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--exe', type=str)
+    args = parser.parse_args()
+
+    return run_test(args.exe)
+
+if __name__ == '__main__':
+    sys.exit(main())
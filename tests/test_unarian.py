@@ -13,7 +13,7 @@ from collections import namedtuple
 import re
 import subprocess
 import sys
-from typing import Dict, TextIO
+from typing import Dict, List, TextIO
 
 InputKey = namedtuple('InputKey', ['expr', 'input'])
 
@@ -32,7 +32,7 @@ def get_inputs(file: TextIO) -> Dict[InputKey, str]:
 
     return inputs
 
-def run_test(exe_path: str, test_path: str) -> int:
+def run_test(exe_path: str, test_path: str, extra_args: List[str]) -> int:
     with open(test_path, 'r') as test_file:
         inputs = get_inputs(test_file)
 
@@ -41,7 +41,7 @@ def run_test(exe_path: str, test_path: str) -> int:
     for input, output in inputs.items():
         expr, input_num = input
 
-        proc = subprocess.run([exe_path, test_path, '-ige', expr], input=bytes(input_num, 'utf-8'), capture_output=True)
+        proc = subprocess.run([exe_path, test_path, '-ige', expr, *extra_args], input=bytes(input_num, 'utf-8'), capture_output=True)
         actual_output = str(proc.stdout, 'utf-8').strip()
 
         if actual_output != output:
@@ -54,9 +54,10 @@ def main() -> int:
     parser = argparse.ArgumentParser()
     parser.add_argument('--exe', type=str)
     parser.add_argument('--test', type=str)
+    parser.add_argument('--args', type=str, default='', help='Extra arguments to run the interpreter with, separated by spaces.')
     args = parser.parse_args()
 
-    return run_test(args.exe, args.test)
+    return run_test(args.exe, args.test, args.args.split())
 
 if __name__ == '__main__':
     sys.exit(main())